@@ -5,17 +5,67 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = PhotoEdit
 TEMPLATE = app
 
+#Lambdas are used by the per-pixel effect loops
+CONFIG += c++11
+
+#PngWriter streams rows through zlib
+LIBS += -lz
+
 
 SOURCES += main.cpp\
         mainwindow.cpp \
     mdichild.cpp \
     image.cpp \
     dialog.cpp \
+    scanline.cpp \
+    convolution.cpp \
+    bandscheduler.cpp \
+    medianfilter.cpp \
+    colorquantizer.cpp \
+    imageitem.cpp \
+    scratchpool.cpp \
+    effects.cpp \
+    previewworker.cpp \
+    tiledimage.cpp \
+    undohistory.cpp \
+    packedimage.cpp \
+    historyswap.cpp \
+    batchprocessor.cpp \
+    pipeline.cpp \
+    pngwriter.cpp \
+    stripstream.cpp \
+    imagedecoder.cpp \
+    decodequeue.cpp \
+    imagesaver.cpp \
+    imagepyramid.cpp \
+    pixmaptiles.cpp \
 
 HEADERS  += mainwindow.h \
     mdichild.h \
     image.h \
     dialog.h \
+    scanline.h \
+    convolution.h \
+    bandscheduler.h \
+    medianfilter.h \
+    colorquantizer.h \
+    imageitem.h \
+    scratchpool.h \
+    effects.h \
+    previewworker.h \
+    tiledimage.h \
+    undohistory.h \
+    packedimage.h \
+    historyswap.h \
+    batchprocessor.h \
+    pipeline.h \
+    pngwriter.h \
+    stripstream.h \
+    imagedecoder.h \
+    decodequeue.h \
+    imagesaver.h \
+    imagepyramid.h \
+    pixmaptiles.h \
 
 RESOURCES += \
     PhotoEdit.qrc
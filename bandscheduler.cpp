@@ -0,0 +1,198 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Runs the Image effects in parallel, one horizontal band of rows at a
+ * time.  The scheduler has its own QThreadPool so the thread count setting
+ * does not change the global pool used by the rest of Qt.
+ *****************************************************************************/
+
+#include "bandscheduler.h"
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+namespace
+{
+
+//Bands handed out by one call to BandScheduler::run()
+struct BandJob
+{
+    BandScheduler::BandFunction function;
+    QVector<Band> bands;
+    QAtomicInt next;     //Index of the next band nobody has taken
+    QSemaphore finished; //Released once per finished band
+    const QAtomicInt *cancel;  //Skip the remaining bands once set
+    QMutex busyMutex;
+    qint64 busy;         //Nanoseconds spent in bands, summed over threads
+};
+
+//Takes bands until there are none left
+void work(BandJob &job)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int index;
+    while((index = job.next.fetchAndAddOrdered(1)) < job.bands.size())
+    {
+        //Skipped bands still count as finished so run() can return
+        if(NULL == job.cancel || 0 == job.cancel->loadAcquire())
+            job.function(job.bands[index]);
+        job.finished.release();
+    }
+
+    QMutexLocker locker(&job.busyMutex);
+    job.busy += timer.nsecsElapsed();
+}
+
+//Helps with a job.  Holds a reference so the job outlives a helper that
+//only starts after the caller is already done.
+class BandTask : public QRunnable
+{
+public:
+    explicit BandTask(const QSharedPointer<BandJob> &bandJob) : job(bandJob) {}
+    void run() { work(*job); }
+
+private:
+    QSharedPointer<BandJob> job;
+};
+
+QAtomicInt configuredThreads(0);  //0 -> one per core
+thread_local qint64 busyTotal = 0;
+thread_local const QAtomicInt *cancelFlag = NULL;
+
+QThreadPool *pool()
+{
+    static QThreadPool bandPool;
+    return &bandPool;
+}
+
+} // namespace
+
+
+/**************************************************************************//**
+ * @brief Splits height rows into bands and calls function for each of them.
+ * Returns once every band is finished.
+ *
+ * There are several bands per thread so one slow band doesn't leave the
+ * other cores idle.  Bands are never shorter than a few halos, otherwise the
+ * rows read twice by neighbouring bands would cost more than they save.
+ *
+ * @param[in] height - Number of rows in the image
+ * @param[in] halo - Rows above and below a band the function reads from
+ * @param[in] function - Called once per band, from any thread
+ *****************************************************************************/
+void BandScheduler::run(int height, int halo, const BandFunction &function)
+{
+    if(height <= 0 || cancelled())
+        return;
+
+    const int threads = threadCount();
+    const int minimumRows = qMax(16, 4 * halo);
+    const int bandCount = qMin(threads * 4, height / minimumRows);
+
+    //Not worth splitting, do it all on this thread
+    if(threads <= 1 || bandCount <= 1)
+    {
+        Band whole = { 0, height, 0, height };
+        QElapsedTimer timer;
+        timer.start();
+        function(whole);
+        busyTotal += timer.nsecsElapsed();
+        return;
+    }
+
+    QSharedPointer<BandJob> job(new BandJob);
+    job->function = function;
+    job->cancel = cancelFlag;
+    job->busy = 0;
+
+    const int rowsPerBand = (height + bandCount - 1) / bandCount;
+    for(int first = 0; first < height; first += rowsPerBand)
+    {
+        Band band;
+        band.first = first;
+        band.last = qMin(first + rowsPerBand, height);
+        band.haloFirst = qMax(band.first - halo, 0);
+        band.haloLast = qMin(band.last + halo, height);
+        job->bands.append(band);
+    }
+
+    //The calling thread is one of the workers
+    const int helpers = qMin(threads, job->bands.size()) - 1;
+    for(int i = 0; i < helpers; i++)
+        pool()->start(new BandTask(job));
+
+    work(*job);
+    job->finished.acquire(job->bands.size());
+
+    QMutexLocker locker(&job->busyMutex);
+    busyTotal += job->busy;
+}
+
+/**************************************************************************//**
+ * @brief Sets how many threads work on each effect.
+ *
+ * @param[in] count - Number of threads, 0 or less uses one per core
+ *****************************************************************************/
+void BandScheduler::setThreadCount(int count)
+{
+    configuredThreads.storeRelease(qMax(count, 0));
+    pool()->setMaxThreadCount(qMax(threadCount() - 1, 1));
+}
+
+/**************************************************************************//**
+ * @brief Returns how many threads work on each effect, counting the thread
+ * that calls run().
+ *****************************************************************************/
+int BandScheduler::threadCount()
+{
+    int count = configuredThreads.loadAcquire();
+    return (count > 0) ? count : qMax(QThread::idealThreadCount(), 1);
+}
+
+/**************************************************************************//**
+ * @brief Returns the thread count as it was set, 0 if it follows the number
+ * of cores.  Unlike threadCount() this can be saved and set again on
+ * another machine.
+ *****************************************************************************/
+int BandScheduler::configuredThreadCount()
+{
+    return configuredThreads.loadAcquire();
+}
+
+/**************************************************************************//**
+ * @brief Returns the time, summed over all threads, spent in bands started
+ * by the calling thread.  EffectTimer compares it to the wall clock time to
+ * report how busy the threads of each effect were.
+ *****************************************************************************/
+qint64 BandScheduler::busyNanoseconds()
+{
+    return busyTotal;
+}
+
+/**************************************************************************//**
+ * @brief Sets the flag that cancels the effects run from the calling thread.
+ * The flag must stay alive until it is replaced.
+ *
+ * @param[in] flag - Non-zero once the effect is no longer wanted, NULL for
+ * effects that always run to the end
+ *****************************************************************************/
+void BandScheduler::setCancelFlag(const QAtomicInt *flag)
+{
+    cancelFlag = flag;
+}
+
+/**************************************************************************//**
+ * @brief Returns whether the cancel flag of the calling thread is set.  An
+ * effect with several passes can check it to stop between them.
+ *****************************************************************************/
+bool BandScheduler::cancelled()
+{
+    return NULL != cancelFlag && 0 != cancelFlag->loadAcquire();
+}
@@ -0,0 +1,63 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the BandScheduler class.
+ *****************************************************************************/
+
+#ifndef BANDSCHEDULER_H
+#define BANDSCHEDULER_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <functional>
+
+/**************************************************************************//**
+ * @brief A horizontal strip of an image.  A band writes rows [first, last)
+ * and may read rows [haloFirst, haloLast), which includes the extra rows a
+ * neighbourhood operation needs above and below the band.
+ *****************************************************************************/
+struct Band
+{
+    int first;
+    int last;
+    int haloFirst;
+    int haloLast;
+};
+
+/**************************************************************************//**
+ * @brief Splits an effect into row bands and runs them on all cores.
+ *
+ * The calling thread works on bands too, and bands are handed out one at a
+ * time, so a fast thread simply takes more bands.  Since the caller never
+ * waits for a band nobody has started, run() can safely be called from a
+ * thread that is itself in a thread pool.
+ *
+ * A thread can hand in a cancel flag.  Once the flag is set, bands of the
+ * effects it runs that have not started yet are skipped, so an effect whose
+ * result is no longer wanted stops after the bands already in progress.
+ *****************************************************************************/
+class BandScheduler
+{
+public:
+    typedef std::function<void (const Band &band)> BandFunction;
+
+    //Calls function once for every band of an image height rows tall
+    static void run(int height, int halo, const BandFunction &function);
+
+    //Number of threads used, including the calling thread
+    static void setThreadCount(int count);
+    static int threadCount();
+
+    //The count as set, 0 for one per core; what the settings keep
+    static int configuredThreadCount();
+
+    //Total time spent inside bands started from the calling thread
+    static qint64 busyNanoseconds();
+
+    //Flag (non-zero = cancelled) checked before each band run() starts from
+    //the calling thread, NULL for none
+    static void setCancelFlag(const QAtomicInt *flag);
+    static bool cancelled();
+};
+
+#endif // BANDSCHEDULER_H
@@ -0,0 +1,403 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Runs effects over many image files from the command line, without
+ * the editor's windows.
+ *****************************************************************************/
+
+#include "batchprocessor.h"
+#include "bandscheduler.h"
+#include "imagesaver.h"
+#include "pngwriter.h"
+#include "scanline.h"
+#include "stripstream.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <string.h>
+
+/**************************************************************************//**
+ * @brief Processes one file.  The report belongs to the task until it is
+ * done; the pool waits for all tasks before the reports are read.
+ *****************************************************************************/
+class BatchProcessor::Task : public QRunnable
+{
+public:
+    Task(BatchProcessor *processor, FileReport *report)
+        : processor(processor), report(report) {}
+
+    void run() { processor->processFile(*report); }
+
+private:
+    BatchProcessor *processor;
+    FileReport *report;
+};
+
+namespace
+{
+
+//Copies of an image the batch holds at once: the loaded file, the result
+//and an idle scratch image
+const int ImagesInFlight = 3;
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Returns whether "--batch" is on the command line.  Checked before
+ * any application object exists, to know which one to make.
+ *
+ * @param[in] argc - Number of arguments
+ * @param[in] argv - The arguments
+ *****************************************************************************/
+bool BatchProcessor::isBatch(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(0 == strcmp(argv[i], "--batch"))
+            return true;
+    }
+
+    return false;
+}
+
+/**************************************************************************//**
+ * @brief Parses the command line, then loads, processes and saves every
+ * input file.  Files run in parallel on jobs threads; each effect splits its
+ * bands over the cores left over.
+ *
+ * @param[in] arguments - The command line, including the program name
+ *
+ * @returns 0 if every file was written, 1 if any failed, 2 if the command
+ * line is wrong
+ *****************************************************************************/
+int BatchProcessor::run(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Applies effects to image files without opening a window.");
+    parser.addHelpOption();
+
+    QCommandLineOption batchOption("batch", "Run headless.");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Directory the results are written to.", "directory");
+    QCommandLineOption effectOption(QStringList() << "e" << "effect",
+                                    "Effect to apply, e.g. sharpen, \"gamma(1.8)\" or \"resize(800, 600)\". "
+                                    "Repeat for more, they are applied in order.", "effect");
+    QCommandLineOption pipelineOption(QStringList() << "p" << "pipeline",
+                                      "Pipeline file saved by the macro recorder.  Effects given "
+                                      "with -e are applied after it.", "file");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "Files processed at once.",
+                                  "count", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption memoryOption("memory", "Megabytes the images in flight may take.", "MB", "1024");
+    QCommandLineOption formatOption("format", "Format of the results, e.g. png.  Default: that of the input.",
+                                    "format");
+    QCommandLineOption pngLevelOption("png-level", "Compression of PNG results, 0 (fastest) to 9 (smallest).",
+                                      "level", QString::number(PngWriter::defaultLevel()));
+
+    parser.addOption(batchOption);
+    parser.addOption(outputOption);
+    parser.addOption(effectOption);
+    parser.addOption(pipelineOption);
+    parser.addOption(jobsOption);
+    parser.addOption(memoryOption);
+    parser.addOption(formatOption);
+    parser.addOption(pngLevelOption);
+    parser.addPositionalArgument("inputs", "Image files, or directories of them.", "<inputs...>");
+    parser.process(arguments);
+
+    if(!parser.isSet(outputOption) || parser.positionalArguments().isEmpty())
+    {
+        err << "PhotoEdit --batch: an output directory and at least one input are needed\n";
+        err << parser.helpText();
+        return 2;
+    }
+
+    Pipeline pipeline;
+    QString error;
+    if(parser.isSet(pipelineOption) && !pipeline.load(parser.value(pipelineOption), &error))
+    {
+        err << "PhotoEdit --batch: " << error << "\n";
+        return 2;
+    }
+
+    foreach(const QString &effect, parser.values(effectOption))
+    {
+        if(!pipeline.append(effect, &error))
+        {
+            err << "PhotoEdit --batch: " << error << "\n";
+            return 2;
+        }
+    }
+
+    QString outputDir = parser.value(outputOption);
+    if(!QDir().mkpath(outputDir))
+    {
+        err << "PhotoEdit --batch: cannot create " << outputDir << "\n";
+        return 2;
+    }
+
+    QStringList inputs = collectInputs(parser.positionalArguments());
+    int jobs = qMax(parser.value(jobsOption).toInt(), 1);
+    int memoryMegabytes = qMax(parser.value(memoryOption).toInt(), 1);
+    PngWriter::setDefaultLevel(parser.value(pngLevelOption).toInt());
+
+    //Files already keep the cores busy, bands only split what is left
+    BandScheduler::setThreadCount(qMax(QThread::idealThreadCount() / jobs, 1));
+
+    BatchProcessor processor(pipeline, outputDir, parser.value(formatOption), memoryMegabytes);
+    if(!processor.checkOutputs(inputs, err))
+        return 2;
+
+    QVector<FileReport> reports(inputs.size());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    for(int i = 0; i < inputs.size(); i++)
+    {
+        reports[i].input = inputs[i];
+        pool.start(new Task(&processor, &reports[i]));
+    }
+    pool.waitForDone();
+
+    qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+    int failed = 0;
+    double megapixels = 0;
+    for(int i = 0; i < reports.size(); i++)
+    {
+        if(!reports[i].error.isEmpty())
+            failed++;
+        else
+            megapixels += reports[i].size.width() * double(reports[i].size.height()) / 1e6;
+    }
+
+    out << QString("%1 files, %2 failed, %3 MP in %4 s: %5 files/s, %6 MP/s\n")
+           .arg(reports.size()).arg(failed).arg(megapixels, 0, 'f', 1)
+           .arg(elapsed / 1000.0, 0, 'f', 2)
+           .arg((reports.size() - failed) * 1000.0 / elapsed, 0, 'f', 2)
+           .arg(megapixels * 1000.0 / elapsed, 0, 'f', 2);
+
+    return failed > 0 ? 1 : 0;
+}
+
+/**************************************************************************//**
+ * @brief Constructor.
+ *
+ * @param[in] pipeline - Effects to apply
+ * @param[in] outputDir - Directory the results are written to
+ * @param[in] format - Format of the results, empty for that of the input
+ * @param[in] memoryMegabytes - Megabytes the files in flight may take
+ *****************************************************************************/
+BatchProcessor::BatchProcessor(const Pipeline &pipeline, const QString &outputDir,
+                               const QString &format, int memoryMegabytes)
+    : pipeline(pipeline), outputDir(outputDir), format(format),
+      memory(memoryMegabytes), memoryMegabytes(memoryMegabytes)
+{
+}
+
+/**************************************************************************//**
+ * @brief Loads a file, applies the pipeline and saves the result, timing each
+ * part.  The file's share of the memory limit is reserved from its header
+ * before the pixels are loaded, and held until the result is written.
+ *
+ * @param[in,out] report - Names the input, filled in with the outcome
+ *****************************************************************************/
+void BatchProcessor::processFile(FileReport &report)
+{
+    report.loadTime = 0;
+    report.effectTime = 0;
+    report.saveTime = 0;
+
+    report.output = outputPath(report.input);
+
+    QImageReader reader(report.input);
+    QSize size = reader.size();
+    qint64 bytes = qint64(qMax(size.width(), 1)) * qMax(size.height(), 1) * 4 * ImagesInFlight;
+    int megabytes = qBound<qint64>(1, (bytes + 1048575) / 1048576, memoryMegabytes);
+
+    QElapsedTimer timer;
+
+    //A file that doesn't fit the whole limit goes through in strips, alone,
+    //or not at all
+    const bool tooLarge = bytes > qint64(memoryMegabytes) * 1048576;
+    QString reason;
+    report.streamed = tooLarge && StripStream::canStream(pipeline, report.input, report.output, &reason);
+    if(tooLarge && !report.streamed)
+    {
+        report.error = QString("too large for --memory %1 (needs %2 MB) and %3")
+                       .arg(memoryMegabytes).arg((bytes + 1048575) / 1048576).arg(reason);
+        print(report);
+        return;
+    }
+
+    if(report.streamed)
+    {
+        memory.acquire(memoryMegabytes);
+        timer.start();
+        StripStream::process(report.input, report.output, pipeline,
+                             qint64(memoryMegabytes) * 1048576, &report.error);
+        report.size = size;
+        report.effectTime = timer.elapsed();
+        memory.release(memoryMegabytes);
+        print(report);
+        return;
+    }
+
+    memory.acquire(megabytes);
+    timer.start();
+
+    QImage image = Scanline::stored(reader.read());
+    report.loadTime = timer.restart();
+    if(image.isNull())
+    {
+        report.error = reader.errorString();
+        memory.release(megabytes);
+        print(report);
+        return;
+    }
+    report.size = image.size();
+
+    ScratchPool scratch;
+    image = pipeline.apply(image, scratch);
+    report.effectTime = timer.restart();
+
+    QString writeError;
+    if(image.isNull())
+        report.error = "an effect rejected its parameters";
+    else if(!ImageSaver::write(report.output, image, format.toLatin1(), &writeError))
+        report.error = QString("cannot write %1: %2").arg(report.output).arg(writeError);
+    report.saveTime = timer.elapsed();
+
+    memory.release(megabytes);
+    print(report);
+}
+
+/**************************************************************************//**
+ * @brief Returns the file the result of an input is written to: its name,
+ * with the suffix of the output format, in the output directory.
+ *
+ * @param[in] input - The input file
+ *****************************************************************************/
+QString BatchProcessor::outputPath(const QString &input) const
+{
+    QFileInfo info(input);
+    QString suffix = format.isEmpty() ? info.suffix() : format;
+    return QDir(outputDir).filePath(info.completeBaseName() + "." + suffix);
+}
+
+/**************************************************************************//**
+ * @brief Checks that every input has an output of its own.  Two inputs that
+ * only differ in their suffix or directory would be written to the same
+ * file by two jobs at once, and an output in the input directory with the
+ * same format would replace its input.  Each conflict is printed.
+ *
+ * @param[in] inputs - The files to process
+ * @param[in] err - Where the conflicts are printed
+ *
+ * @returns true if there are none
+ *****************************************************************************/
+bool BatchProcessor::checkOutputs(const QStringList &inputs, QTextStream &err) const
+{
+    //The output directory exists by now, so it has a canonical path
+    QDir dir(QDir(outputDir).canonicalPath());
+    QHash<QString, QString> claimed;  //Output -> the input written to it
+    bool ok = true;
+
+    foreach(const QString &input, inputs)
+    {
+        QString output = outputPath(input);
+        QString key = dir.filePath(QFileInfo(output).fileName());
+
+        if(QFileInfo(input).canonicalFilePath() == key)
+        {
+            err << "PhotoEdit --batch: " << input << " would be overwritten by its result\n";
+            ok = false;
+        }
+        else if(claimed.contains(key))
+        {
+            err << "PhotoEdit --batch: " << claimed.value(key) << " and " << input
+                << " would both be written to " << output << "\n";
+            ok = false;
+        }
+        else
+        {
+            claimed.insert(key, input);
+        }
+    }
+
+    return ok;
+}
+
+/**************************************************************************//**
+ * @brief Prints the outcome of a file on its own line.
+ *
+ * @param[in] report - The finished file
+ *****************************************************************************/
+void BatchProcessor::print(const FileReport &report)
+{
+    QMutexLocker locker(&printMutex);
+    QTextStream out(stdout);
+
+    if(!report.error.isEmpty())
+    {
+        out << report.input << ": " << report.error << "\n";
+        return;
+    }
+
+    if(report.streamed)
+    {
+        out << QString("%1 -> %2  %3x%4  %5 ms (streamed in strips)\n")
+               .arg(report.input).arg(report.output)
+               .arg(report.size.width()).arg(report.size.height())
+               .arg(report.effectTime);
+        return;
+    }
+
+    out << QString("%1 -> %2  %3x%4  %5 ms (load %6, effects %7, save %8)\n")
+           .arg(report.input).arg(report.output)
+           .arg(report.size.width()).arg(report.size.height())
+           .arg(report.loadTime + report.effectTime + report.saveTime)
+           .arg(report.loadTime).arg(report.effectTime).arg(report.saveTime);
+}
+
+/**************************************************************************//**
+ * @brief Expands the inputs: files are kept, directories are replaced by the
+ * files in them that Qt can read (not recursively).
+ *
+ * @param[in] paths - Files and directories from the command line
+ *****************************************************************************/
+QStringList BatchProcessor::collectInputs(const QStringList &paths)
+{
+    QStringList filters;
+    foreach(const QByteArray &suffix, QImageReader::supportedImageFormats())
+        filters << "*." + QString::fromLatin1(suffix);
+
+    QStringList files;
+    foreach(const QString &path, paths)
+    {
+        QFileInfo info(path);
+        if(!info.isDir())
+        {
+            files << path;
+            continue;
+        }
+
+        QDir dir(path);
+        foreach(const QString &name, dir.entryList(filters, QDir::Files, QDir::Name))
+            files << dir.filePath(name);
+    }
+
+    return files;
+}
@@ -0,0 +1,76 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the BatchProcessor class.
+ *****************************************************************************/
+
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include "pipeline.h"
+#include "scratchpool.h"
+
+/**************************************************************************//**
+ * @brief Applies a list of effects to many files without opening a window,
+ * for "PhotoEdit --batch".
+ *
+ * Effects are written the way the undo journal names them, e.g. "sharpen",
+ * "gamma(1.8)" or "resize(800, 600)", or read from a pipeline file saved by
+ * the macro recorder, and applied by the same Pipeline as in the editor.
+ * Files are processed in parallel, one per thread.  Each file reserves
+ * memory for its pixels before it is loaded, so large files wait instead of
+ * pushing the total past the memory limit.  A line is printed per file and
+ * the throughput at the end.
+ *****************************************************************************/
+class BatchProcessor
+{
+public:
+    //Whether the command line asks for batch mode
+    static bool isBatch(int argc, char *argv[]);
+
+    //Parses the command line, processes the files and returns the exit code
+    static int run(const QStringList &arguments);
+
+private:
+    struct FileReport
+    {
+        QString input;
+        QString output;
+        QSize size;
+        qint64 loadTime;
+        qint64 effectTime;
+        qint64 saveTime;
+        bool streamed;  //Processed in strips, see StripStream
+        QString error;  //Empty if the file was processed
+    };
+
+    BatchProcessor(const Pipeline &pipeline, const QString &outputDir,
+                   const QString &format, int memoryMegabytes);
+
+    void processFile(FileReport &report);
+    QString outputPath(const QString &input) const;
+    bool checkOutputs(const QStringList &inputs, QTextStream &err) const;
+    void print(const FileReport &report);
+
+    static QStringList collectInputs(const QStringList &paths);
+
+    //Processes one file on the thread pool
+    class Task;
+
+    Pipeline pipeline;
+    QString outputDir;
+    QString format;          //Empty -> same as the input
+    QSemaphore memory;       //Megabytes free for the images in flight
+    int memoryMegabytes;
+    QMutex printMutex;
+};
+
+#endif // BATCHPROCESSOR_H
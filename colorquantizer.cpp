@@ -0,0 +1,301 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Octree colour quantizer used by the adaptive palette posterize.
+ *
+ * The image is first reduced to a histogram of its 32x32x32 colour cells,
+ * built in parallel over bands of rows.  Only the occupied cells are put in
+ * the octree, so building the palette costs the same for any image size.
+ *****************************************************************************/
+
+#include "colorquantizer.h"
+#include "scanline.h"
+#include "bandscheduler.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+
+const int Cells = 32 * 32 * 32;
+const int Depth = 5;  //Bits per channel of a cell
+
+//Pixel count and colour sums of every cell
+struct CellHistogram
+{
+    std::vector<qint64> pixels;
+    std::vector<qint64> red, green, blue;
+
+    CellHistogram() : pixels(Cells, 0), red(Cells, 0), green(Cells, 0), blue(Cells, 0) {}
+};
+
+/**************************************************************************//**
+ * @brief One node of the octree.  Leaves hold the colour sums of their
+ * pixels, every node holds the number of pixels below it.
+ *
+ * A leaf can keep some of its children when only part of them had to be
+ * merged into it.  The tree is only used to build the palette, so that is
+ * fine: the pixels are mapped to the palette through the cache.
+ *****************************************************************************/
+struct OctreeNode
+{
+    qint64 pixels;  //Pixels in the subtree
+    qint64 summed;  //Pixels in red, green and blue
+    qint64 red, green, blue;
+    int children[8];  //-1 if there is no child
+    bool leaf;
+};
+
+class Octree
+{
+public:
+    Octree() : leaves(0) { newNode(0); }
+
+    //Adds the pixels of one cell
+    void insert(int cell, qint64 pixels, qint64 red, qint64 green, qint64 blue)
+    {
+        const int r = cell >> 10, g = (cell >> 5) & 31, b = cell & 31;
+        int node = 0;
+
+        for(int depth = 0; depth < Depth; depth++)
+        {
+            nodes[node].pixels += pixels;
+
+            const int shift = Depth - 1 - depth;
+            const int child = ((r >> shift) & 1) << 2 | ((g >> shift) & 1) << 1 | ((b >> shift) & 1);
+
+            if(nodes[node].children[child] < 0)
+            {
+                int created = newNode(depth + 1);
+                nodes[node].children[child] = created;
+            }
+            node = nodes[node].children[child];
+        }
+
+        nodes[node].pixels += pixels;
+        nodes[node].summed += pixels;
+        nodes[node].red += red;
+        nodes[node].green += green;
+        nodes[node].blue += blue;
+    }
+
+    //Merges leaves until there are at most colors of them.  The deepest
+    //nodes with the fewest pixels go first.
+    void reduce(int colors)
+    {
+        for(int depth = Depth - 1; depth >= 0 && leaves > colors; depth--)
+        {
+            std::vector<int> &level = levels[depth];
+            std::sort(level.begin(), level.end(), [this](int a, int b) {
+                return nodes[a].pixels < nodes[b].pixels;
+            });
+
+            for(size_t i = 0; i < level.size() && leaves > colors; i++)
+                merge(level[i], colors);
+        }
+    }
+
+    //Average colour of every leaf
+    QVector<QRgb> palette() const
+    {
+        QVector<QRgb> colors;
+        for(size_t i = 0; i < nodes.size(); i++)
+        {
+            const OctreeNode &node = nodes[i];
+            if(!node.leaf || node.summed == 0)
+                continue;
+
+            const qint64 half = node.summed / 2;
+            colors.append(qRgb((node.red + half) / node.summed,
+                               (node.green + half) / node.summed,
+                               (node.blue + half) / node.summed));
+        }
+        return colors;
+    }
+
+private:
+    int newNode(int depth)
+    {
+        OctreeNode node;
+        node.pixels = node.summed = node.red = node.green = node.blue = 0;
+        std::fill(node.children, node.children + 8, -1);
+        node.leaf = (depth == Depth);
+
+        nodes.push_back(node);
+        const int index = int(nodes.size()) - 1;
+
+        if(node.leaf)
+            leaves++;
+        else
+            levels[depth].push_back(index);
+
+        return index;
+    }
+
+    //Turns a node whose children are all leaves into a leaf.  Only the
+    //children with the fewest pixels are merged if merging all of them
+    //would leave fewer than colors leaves.
+    void merge(int index, int colors)
+    {
+        OctreeNode &node = nodes[index];
+
+        std::vector<int> children;
+        for(int i = 0; i < 8; i++)
+        {
+            if(node.children[i] >= 0)
+                children.push_back(i);
+        }
+        std::sort(children.begin(), children.end(), [&](int a, int b) {
+            return nodes[node.children[a]].pixels < nodes[node.children[b]].pixels;
+        });
+
+        //The node itself becomes a leaf, so n merged children remove n-1
+        const int merged = qMin(int(children.size()), leaves - colors + 1);
+        for(int i = 0; i < merged; i++)
+        {
+            OctreeNode &child = nodes[node.children[children[i]]];
+            node.summed += child.summed;
+            node.red += child.red;
+            node.green += child.green;
+            node.blue += child.blue;
+            child.leaf = false;  //No longer part of the tree
+            node.children[children[i]] = -1;
+        }
+
+        node.leaf = true;
+        leaves -= merged - 1;
+    }
+
+    std::vector<OctreeNode> nodes;
+    std::vector<int> levels[Depth];  //Nodes that are not leaves, by depth
+    int leaves;
+};
+
+} // namespace
+
+
+/**************************************************************************//**
+ * @brief Builds the nearest colour cache of a palette.  Each of the 32x32x32
+ * cells maps to the palette entry closest to the centre of the cell.  The
+ * cells are searched in parallel.
+ *
+ * @param[in] palette - 1 to 256 colours
+ *****************************************************************************/
+ColorQuantizer::ColorQuantizer(const QVector<QRgb> &palette)
+    : colors(palette), cache(Cells, 0)
+{
+    if(colors.isEmpty() || colors.size() > 256)
+    {
+        qDebug() << "ColorQuantizer -> Invalid palette size" << colors.size()
+                 << ", expecting a value [1,256]";
+        colors.resize(qBound(1, colors.size(), 256));
+    }
+
+    //Each "row" is one red/green pair, the 32 blue cells are the pixels
+    BandScheduler::run(32 * 32, 0, [&](const Band &band) {
+        for(int row = band.first; row < band.last; row++)
+        {
+            const int r = (row >> 5) * 8 + 4, g = (row & 31) * 8 + 4;
+
+            for(int blue = 0; blue < 32; blue++)
+            {
+                const int b = blue * 8 + 4;
+                int best = 0, bestDistance = INT_MAX;
+
+                for(int i = 0; i < colors.size(); i++)
+                {
+                    const int dr = qRed(colors[i]) - r;
+                    const int dg = qGreen(colors[i]) - g;
+                    const int db = qBlue(colors[i]) - b;
+                    const int distance = dr * dr + dg * dg + db * db;
+
+                    if(distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = i;
+                    }
+                }
+
+                cache[(row << 5) | blue] = uchar(best);
+            }
+        }
+    });
+}
+
+/**************************************************************************//**
+ * @brief Chooses a palette for an image.
+ *
+ * @param[in] image - Format_ARGB32 image
+ * @param[in] colors - Largest number of colours in the palette, [2,256]
+ *
+ * @returns The palette, which has fewer colours than asked for if the image
+ * does not have that many.
+ *****************************************************************************/
+QVector<QRgb> ColorQuantizer::octreePalette(const QImage &image, int colors)
+{
+    if(colors < 2 || colors > 256)
+    {
+        qDebug() << "ColorQuantizer::octreePalette -> Invalid color count" << colors
+                 << ", expecting a value [2,256]";
+        colors = qBound(2, colors, 256);
+    }
+
+    //Every band fills its own histogram and adds it to the total once done
+    CellHistogram total;
+    QMutex totalMutex;
+    const int width = image.width();
+
+    BandScheduler::run(image.height(), 0, [&](const Band &band) {
+        CellHistogram histogram;
+
+        for(int y = band.first; y < band.last; y++)
+        {
+            const QRgb *in = Scanline::constRow(image, y);
+            for(int x = 0; x < width; x++)
+            {
+                const int c = cell(in[x]);
+                histogram.pixels[c]++;
+                histogram.red[c] += qRed(in[x]);
+                histogram.green[c] += qGreen(in[x]);
+                histogram.blue[c] += qBlue(in[x]);
+            }
+        }
+
+        QMutexLocker locker(&totalMutex);
+        for(int c = 0; c < Cells; c++)
+        {
+            total.pixels[c] += histogram.pixels[c];
+            total.red[c] += histogram.red[c];
+            total.green[c] += histogram.green[c];
+            total.blue[c] += histogram.blue[c];
+        }
+    });
+
+    Octree octree;
+    for(int c = 0; c < Cells; c++)
+    {
+        if(total.pixels[c] > 0)
+            octree.insert(c, total.pixels[c], total.red[c], total.green[c], total.blue[c]);
+    }
+
+    octree.reduce(colors);
+    return octree.palette();
+}
+
+/**************************************************************************//**
+ * @brief Maps every pixel onto the palette.  The palette becomes the colour
+ * table of destination.
+ *
+ * @param[in] source - Format_ARGB32 image
+ * @param[out] destination - Format_Indexed8 image of the same size
+ *****************************************************************************/
+void ColorQuantizer::apply(const QImage &source, QImage &destination) const
+{
+    destination.setColorTable(colors);
+
+    Scanline::mapIndexes(source, destination, [this](QRgb pixel) {
+        return index(pixel);
+    });
+}
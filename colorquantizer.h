@@ -0,0 +1,50 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ColorQuantizer class.
+ *****************************************************************************/
+
+#ifndef COLORQUANTIZER_H
+#define COLORQUANTIZER_H
+
+#include <QImage>
+#include <QVector>
+#include <vector>
+
+/**************************************************************************//**
+ * @brief Reduces an ARGB32 image to a palette of at most 256 colours.
+ *
+ * The palette is either chosen to fit the image with an octree (Gervautz and
+ * Purgathofer) or given by the caller.  Every pixel is mapped to a palette
+ * entry through a 32x32x32 cache holding the nearest palette entry of each
+ * cell of the colour cube, so the mapping costs one table look up per pixel
+ * no matter how many colours the palette has.  Like the other effects, the
+ * alpha channel is dropped and the palette is opaque.
+ *****************************************************************************/
+class ColorQuantizer
+{
+public:
+    explicit ColorQuantizer(const QVector<QRgb> &palette);
+
+    //Up to colors colours (2 to 256) that best fit the image
+    static QVector<QRgb> octreePalette(const QImage &image, int colors);
+
+    const QVector<QRgb> &palette() const { return colors; }
+
+    //Nearest palette entry of a colour (only as fine as the cache)
+    int index(QRgb pixel) const { return cache[cell(pixel)]; }
+
+    //destination (Format_Indexed8, same size) = source mapped onto the palette
+    void apply(const QImage &source, QImage &destination) const;
+
+private:
+    static int cell(QRgb pixel)
+    {
+        return ((pixel >> 9) & 0x7c00) | ((pixel >> 6) & 0x03e0) | ((pixel >> 3) & 0x001f);
+    }
+
+    QVector<QRgb> colors;
+    std::vector<uchar> cache;  //Palette index of every 5:5:5 cell
+};
+
+#endif // COLORQUANTIZER_H
@@ -0,0 +1,545 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Applies small (3x3 or 5x5) kernels to ARGB32 images.  This is the
+ * engine behind sharpen, soften, edge and emboss.
+ *
+ * The source rows needed for one output row are copied into padded buffers
+ * (with the edge pixel repeated radius times on both sides), so the inner
+ * loops never have to check for borders.  The inner loops unpack the 8 bit
+ * channels into 16 bit lanes: SSE2 handles 4 pixels per iteration, AVX2
+ * handles 8.  AVX2 is picked at run time when both the compiler and the CPU
+ * support it.  Rows are split into bands by the BandScheduler, each band
+ * keeping its own padded rows.
+ *****************************************************************************/
+
+#include "convolution.h"
+#include "scanline.h"
+#include "bandscheduler.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONVOLUTION_SSE2
+#include <emmintrin.h>
+#endif
+
+//GCC and clang can compile individual functions for AVX2
+#if defined(CONVOLUTION_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVOLUTION_AVX2
+#include <immintrin.h>
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+typedef Convolution::Tap Tap;
+
+namespace
+{
+
+/**************************************************************************//**
+ * @brief Keeps the 2*radius+1 source rows around the current output row,
+ * padded with radius copies of the edge pixel on both sides.  Rows are kept
+ * in a ring, so each source row is only copied once per pass.
+ *****************************************************************************/
+class PaddedRows
+{
+public:
+    PaddedRows(const QImage &source, int radius)
+        : image(source), r(radius), buffers(2 * radius + 1),
+          bufferRow(2 * radius + 1, -1), rows(2 * radius + 1)
+    {
+        for(size_t i = 0; i < buffers.size(); i++)
+            buffers[i].resize(image.width() + 2 * r);
+    }
+
+    //Row pointers for rows y-radius to y+radius.  Each pointer is valid
+    //from index -radius to width+radius-1
+    const QRgb *const *window(int y)
+    {
+        const int width = image.width(), height = image.height();
+
+        for(int i = -r; i <= r; i++)
+        {
+            int sourceRow = qBound(0, y + i, height - 1);
+            int buffer = sourceRow % buffers.size();
+
+            if(bufferRow[buffer] != sourceRow)
+            {
+                const QRgb *in = Scanline::constRow(image, sourceRow);
+                QRgb *padded = &buffers[buffer][0];
+
+                for(int x = 0; x < r; x++)
+                {
+                    padded[x] = in[0];
+                    padded[r + width + x] = in[width - 1];
+                }
+                memcpy(padded + r, in, width * sizeof(QRgb));
+                bufferRow[buffer] = sourceRow;
+            }
+
+            rows[i + r] = &buffers[buffer][r];
+        }
+
+        return &rows[0];
+    }
+
+private:
+    const QImage &image;
+    int r;
+    std::vector<std::vector<QRgb> > buffers;
+    std::vector<int> bufferRow;
+    std::vector<const QRgb *> rows;
+};
+
+inline int clampByte(int value)
+{
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+//-----------------------------------------------------------------------------
+//                   Scalar
+//-----------------------------------------------------------------------------
+void linearScalar(const QRgb *const *rows, int radius, const Tap *taps, int tapCount,
+                  int divisor, int bias, int x, int width, QRgb *out)
+{
+    for(; x < width; x++)
+    {
+        int red = 0, green = 0, blue = 0;
+        for(int t = 0; t < tapCount; t++)
+        {
+            QRgb pixel = rows[taps[t].dy + radius][x + taps[t].dx];
+            red += taps[t].weight * qRed(pixel);
+            green += taps[t].weight * qGreen(pixel);
+            blue += taps[t].weight * qBlue(pixel);
+        }
+
+        out[x] = qRgb(clampByte(red / divisor + bias),
+                      clampByte(green / divisor + bias),
+                      clampByte(blue / divisor + bias));
+    }
+}
+
+void magnitudeScalar(const QRgb *const *rows, int radius,
+                     const Tap *tapsA, int countA, const Tap *tapsB, int countB,
+                     double scale, int x, int width, QRgb *out)
+{
+    for(; x < width; x++)
+    {
+        int a[3] = {0, 0, 0}, b[3] = {0, 0, 0};
+        for(int t = 0; t < countA; t++)
+        {
+            QRgb pixel = rows[tapsA[t].dy + radius][x + tapsA[t].dx];
+            a[0] += tapsA[t].weight * qRed(pixel);
+            a[1] += tapsA[t].weight * qGreen(pixel);
+            a[2] += tapsA[t].weight * qBlue(pixel);
+        }
+        for(int t = 0; t < countB; t++)
+        {
+            QRgb pixel = rows[tapsB[t].dy + radius][x + tapsB[t].dx];
+            b[0] += tapsB[t].weight * qRed(pixel);
+            b[1] += tapsB[t].weight * qGreen(pixel);
+            b[2] += tapsB[t].weight * qBlue(pixel);
+        }
+
+        //Single precision, so the result matches the SIMD code exactly
+        int channel[3];
+        for(int c = 0; c < 3; c++)
+            channel[c] = qMin(float(scale) * sqrtf(float(a[c]) * a[c] + float(b[c]) * b[c]), 255.0f);
+
+        out[x] = qRgb(channel[0], channel[1], channel[2]);
+    }
+}
+
+#ifdef CONVOLUTION_SSE2
+//-----------------------------------------------------------------------------
+//                   SSE2 (4 pixels per iteration)
+//-----------------------------------------------------------------------------
+//Weighted sum of the taps, pixels 0-1 in lo and 2-3 in hi
+inline void accumulateSse2(const QRgb *const *rows, int radius, const Tap *taps,
+                           int tapCount, int x, __m128i &lo, __m128i &hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    lo = hi = zero;
+
+    for(int t = 0; t < tapCount; t++)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[taps[t].dy + radius] + x + taps[t].dx));
+        __m128i weight = _mm_set1_epi16(short(taps[t].weight));
+        lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weight));
+        hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weight));
+    }
+}
+
+//Sign extends 8 shorts into two vectors of 4 floats
+inline void toFloatSse2(__m128i sums, __m128 &first, __m128 &second)
+{
+    first = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(sums, sums), 16));
+    second = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(sums, sums), 16));
+}
+
+//sums / divisor rounded toward zero, like integer division.  Moving the sum
+//half a step away from 0 first keeps exact quotients from truncating low.
+inline __m128i quotientSse2(__m128 sums, __m128 inverse)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    sums = _mm_add_ps(sums, _mm_or_ps(_mm_and_ps(sums, signMask), half));
+    return _mm_cvttps_epi32(_mm_mul_ps(sums, inverse));
+}
+
+inline __m128i divideSse2(__m128i sums, __m128 inverse, __m128i bias)
+{
+    __m128 first, second;
+    toFloatSse2(sums, first, second);
+    return _mm_packs_epi32(_mm_add_epi32(quotientSse2(first, inverse), bias),
+                           _mm_add_epi32(quotientSse2(second, inverse), bias));
+}
+
+inline __m128i magnitudeSse2(__m128i sumsA, __m128i sumsB, __m128 scale)
+{
+    const __m128 maximum = _mm_set1_ps(255.0f);
+    __m128 a0, a1, b0, b1;
+    toFloatSse2(sumsA, a0, a1);
+    toFloatSse2(sumsB, b0, b1);
+
+    __m128 m0 = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a0, a0), _mm_mul_ps(b0, b0)));
+    __m128 m1 = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a1, a1), _mm_mul_ps(b1, b1)));
+    m0 = _mm_min_ps(_mm_mul_ps(m0, scale), maximum);
+    m1 = _mm_min_ps(_mm_mul_ps(m1, scale), maximum);
+    return _mm_packs_epi32(_mm_cvttps_epi32(m0), _mm_cvttps_epi32(m1));
+}
+
+int linearSse2(const QRgb *const *rows, int radius, const Tap *taps, int tapCount,
+               int divisor, int bias, int width, QRgb *out)
+{
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+    const __m128i bias16 = _mm_set1_epi16(short(bias));
+    const __m128i bias32 = _mm_set1_epi32(bias);
+    const __m128 inverse = _mm_set1_ps(1.0f / divisor);
+    int x = 0;
+
+    for(; x + 4 <= width; x += 4)
+    {
+        __m128i lo, hi, result;
+        accumulateSse2(rows, radius, taps, tapCount, x, lo, hi);
+
+        if(divisor == 1)
+            result = _mm_packus_epi16(_mm_adds_epi16(lo, bias16), _mm_adds_epi16(hi, bias16));
+        else
+            result = _mm_packus_epi16(divideSse2(lo, inverse, bias32), divideSse2(hi, inverse, bias32));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_or_si128(result, alpha));
+    }
+
+    return x;
+}
+
+int magnitudeSse2(const QRgb *const *rows, int radius,
+                  const Tap *tapsA, int countA, const Tap *tapsB, int countB,
+                  double scale, int width, QRgb *out)
+{
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+    const __m128 scaleVector = _mm_set1_ps(float(scale));
+    int x = 0;
+
+    for(; x + 4 <= width; x += 4)
+    {
+        __m128i loA, hiA, loB, hiB;
+        accumulateSse2(rows, radius, tapsA, countA, x, loA, hiA);
+        accumulateSse2(rows, radius, tapsB, countB, x, loB, hiB);
+
+        __m128i result = _mm_packus_epi16(magnitudeSse2(loA, loB, scaleVector),
+                                          magnitudeSse2(hiA, hiB, scaleVector));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_or_si128(result, alpha));
+    }
+
+    return x;
+}
+#endif // CONVOLUTION_SSE2
+
+#ifdef CONVOLUTION_AVX2
+//-----------------------------------------------------------------------------
+//                   AVX2 (8 pixels per iteration)
+//
+//The 256 bit unpack and pack instructions work on each 128 bit half on its
+//own, so pixels 0-1 and 4-5 end up in lo, 2-3 and 6-7 in hi.  Packing undoes
+//the shuffle, so the pixels come back out in order.
+//-----------------------------------------------------------------------------
+AVX2_FUNCTION
+inline void accumulateAvx2(const QRgb *const *rows, int radius, const Tap *taps,
+                           int tapCount, int x, __m256i &lo, __m256i &hi)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    lo = hi = zero;
+
+    for(int t = 0; t < tapCount; t++)
+    {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[taps[t].dy + radius] + x + taps[t].dx));
+        __m256i weight = _mm256_set1_epi16(short(taps[t].weight));
+        lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), weight));
+        hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), weight));
+    }
+}
+
+AVX2_FUNCTION
+inline void toFloatAvx2(__m256i sums, __m256 &first, __m256 &second)
+{
+    first = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_unpacklo_epi16(sums, sums), 16));
+    second = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_unpackhi_epi16(sums, sums), 16));
+}
+
+AVX2_FUNCTION
+inline __m256i quotientAvx2(__m256 sums, __m256 inverse)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    sums = _mm256_add_ps(sums, _mm256_or_ps(_mm256_and_ps(sums, signMask), half));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(sums, inverse));
+}
+
+AVX2_FUNCTION
+inline __m256i divideAvx2(__m256i sums, __m256 inverse, __m256i bias)
+{
+    __m256 first, second;
+    toFloatAvx2(sums, first, second);
+    return _mm256_packs_epi32(_mm256_add_epi32(quotientAvx2(first, inverse), bias),
+                              _mm256_add_epi32(quotientAvx2(second, inverse), bias));
+}
+
+AVX2_FUNCTION
+inline __m256i magnitudeAvx2(__m256i sumsA, __m256i sumsB, __m256 scale)
+{
+    const __m256 maximum = _mm256_set1_ps(255.0f);
+    __m256 a0, a1, b0, b1;
+    toFloatAvx2(sumsA, a0, a1);
+    toFloatAvx2(sumsB, b0, b1);
+
+    __m256 m0 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a0, a0), _mm256_mul_ps(b0, b0)));
+    __m256 m1 = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a1, a1), _mm256_mul_ps(b1, b1)));
+    m0 = _mm256_min_ps(_mm256_mul_ps(m0, scale), maximum);
+    m1 = _mm256_min_ps(_mm256_mul_ps(m1, scale), maximum);
+    return _mm256_packs_epi32(_mm256_cvttps_epi32(m0), _mm256_cvttps_epi32(m1));
+}
+
+AVX2_FUNCTION
+int linearAvx2(const QRgb *const *rows, int radius, const Tap *taps, int tapCount,
+               int divisor, int bias, int width, QRgb *out)
+{
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+    const __m256i bias16 = _mm256_set1_epi16(short(bias));
+    const __m256i bias32 = _mm256_set1_epi32(bias);
+    const __m256 inverse = _mm256_set1_ps(1.0f / divisor);
+    int x = 0;
+
+    for(; x + 8 <= width; x += 8)
+    {
+        __m256i lo, hi, result;
+        accumulateAvx2(rows, radius, taps, tapCount, x, lo, hi);
+
+        if(divisor == 1)
+            result = _mm256_packus_epi16(_mm256_adds_epi16(lo, bias16), _mm256_adds_epi16(hi, bias16));
+        else
+            result = _mm256_packus_epi16(divideAvx2(lo, inverse, bias32), divideAvx2(hi, inverse, bias32));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), _mm256_or_si256(result, alpha));
+    }
+
+    return x;
+}
+
+AVX2_FUNCTION
+int magnitudeAvx2(const QRgb *const *rows, int radius,
+                  const Tap *tapsA, int countA, const Tap *tapsB, int countB,
+                  double scale, int width, QRgb *out)
+{
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+    const __m256 scaleVector = _mm256_set1_ps(float(scale));
+    int x = 0;
+
+    for(; x + 8 <= width; x += 8)
+    {
+        __m256i loA, hiA, loB, hiB;
+        accumulateAvx2(rows, radius, tapsA, countA, x, loA, hiA);
+        accumulateAvx2(rows, radius, tapsB, countB, x, loB, hiB);
+
+        __m256i result = _mm256_packus_epi16(magnitudeAvx2(loA, loB, scaleVector),
+                                             magnitudeAvx2(hiA, hiB, scaleVector));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), _mm256_or_si256(result, alpha));
+    }
+
+    return x;
+}
+
+bool cpuHasAvx2()
+{
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+}
+#endif // CONVOLUTION_AVX2
+
+//-----------------------------------------------------------------------------
+//                   Dispatch
+//-----------------------------------------------------------------------------
+//Each returns how many pixels were done, the scalar code finishes the row
+int linearSimd(const QRgb *const *rows, int radius, const Tap *taps, int tapCount,
+               int divisor, int bias, int width, QRgb *out)
+{
+#ifdef CONVOLUTION_AVX2
+    if(cpuHasAvx2())
+        return linearAvx2(rows, radius, taps, tapCount, divisor, bias, width, out);
+#endif
+#ifdef CONVOLUTION_SSE2
+    return linearSse2(rows, radius, taps, tapCount, divisor, bias, width, out);
+#else
+    return 0;
+#endif
+}
+
+int magnitudeSimd(const QRgb *const *rows, int radius,
+                  const Tap *tapsA, int countA, const Tap *tapsB, int countB,
+                  double scale, int width, QRgb *out)
+{
+#ifdef CONVOLUTION_AVX2
+    if(cpuHasAvx2())
+        return magnitudeAvx2(rows, radius, tapsA, countA, tapsB, countB, scale, width, out);
+#endif
+#ifdef CONVOLUTION_SSE2
+    return magnitudeSse2(rows, radius, tapsA, countA, tapsB, countB, scale, width, out);
+#else
+    return 0;
+#endif
+}
+
+} // namespace
+
+
+/**************************************************************************//**
+ * @brief Constructs an empty kernel.  Every sum it produces is 0.
+ *****************************************************************************/
+Convolution::Convolution()
+{
+    kernelSize = 1;
+    kernelDivisor = 1;
+    kernelBias = 0;
+    fitsInShort = true;
+}
+
+/**************************************************************************//**
+ * @brief Constructs a kernel from a row-major array of weights.
+ *
+ * @param[in] size - Width and height of the kernel, 3 or 5
+ * @param[in] weights - size*size weights, top row first
+ * @param[in] divisor - Every weighted sum is divided by this
+ * @param[in] bias - Added to every sum after dividing
+ *****************************************************************************/
+Convolution::Convolution(int size, const int *weights, int divisor, int bias)
+{
+    if(size != 3 && size != 5)
+    {
+        qDebug() << "Convolution -> Unsupported kernel size" << size << ", expecting 3 or 5";
+        size = 1;
+        weights = NULL;
+    }
+
+    if(divisor == 0)
+    {
+        qDebug() << "Convolution -> divisor of 0, using 1 to prevent divide by 0";
+        divisor = 1;
+    }
+
+    kernelSize = size;
+    kernelDivisor = divisor;
+    kernelBias = bias;
+
+    //Only non zero weights are visited by the inner loops
+    int weightTotal = 0;
+    for(int i = 0; weights != NULL && i < size * size; i++)
+    {
+        if(weights[i] != 0)
+        {
+            Tap tap = { i / size - size / 2, i % size - size / 2, weights[i] };
+            taps.push_back(tap);
+            weightTotal += abs(weights[i]);
+        }
+    }
+
+    fitsInShort = weightTotal * 255 + abs(bias) <= 32767;
+}
+
+/**************************************************************************//**
+ * @brief Applies the kernel to every pixel of source.
+ *
+ * @param[in] source - Format_ARGB32 image to read from
+ * @param[out] destination - Format_ARGB32 image of the same size
+ *****************************************************************************/
+void Convolution::apply(const QImage &source, QImage &destination) const
+{
+    const int width = source.width(), r = radius();
+    const Tap *tapData = taps.empty() ? NULL : &taps[0];
+    const int tapCount = taps.size();
+
+    //Detach before the bands start, so the threads never do
+    uchar *outBits = destination.bits();
+    const int stride = destination.bytesPerLine();
+
+    BandScheduler::run(source.height(), r, [&](const Band &band) {
+        PaddedRows padded(source, r);
+
+        for(int y = band.first; y < band.last; y++)
+        {
+            const QRgb *const *rows = padded.window(y);
+            QRgb *out = reinterpret_cast<QRgb *>(outBits + size_t(y) * stride);
+            int x = 0;
+
+            if(fitsInShort)
+                x = linearSimd(rows, r, tapData, tapCount, kernelDivisor, kernelBias, width, out);
+
+            linearScalar(rows, r, tapData, tapCount, kernelDivisor, kernelBias, x, width, out);
+        }
+    });
+}
+
+/**************************************************************************//**
+ * @brief Applies this kernel and an optional second kernel, and combines the
+ * two sums as scale * sqrt(a^2 + b^2).  The divisor and bias are not used.
+ * With only one kernel the result is scale * |a|.
+ *
+ * @param[in] source - Format_ARGB32 image to read from
+ * @param[out] destination - Format_ARGB32 image of the same size
+ * @param[in] scale - Multiplier for the magnitude
+ * @param[in] second - The other kernel, may be NULL
+ *****************************************************************************/
+void Convolution::magnitude(const QImage &source, QImage &destination, double scale,
+                            const Convolution *second) const
+{
+    static const Convolution none;
+    if(second == NULL)
+        second = &none;
+
+    const int width = source.width();
+    const int r = qMax(radius(), second->radius());
+    const Tap *tapsA = taps.empty() ? NULL : &taps[0];
+    const Tap *tapsB = second->taps.empty() ? NULL : &second->taps[0];
+    const int countA = taps.size(), countB = second->taps.size();
+    const bool simd = fitsInShort && second->fitsInShort;
+
+    uchar *outBits = destination.bits();
+    const int stride = destination.bytesPerLine();
+
+    BandScheduler::run(source.height(), r, [&](const Band &band) {
+        PaddedRows padded(source, r);
+
+        for(int y = band.first; y < band.last; y++)
+        {
+            const QRgb *const *rows = padded.window(y);
+            QRgb *out = reinterpret_cast<QRgb *>(outBits + size_t(y) * stride);
+            int x = 0;
+
+            if(simd)
+                x = magnitudeSimd(rows, r, tapsA, countA, tapsB, countB, scale, width, out);
+
+            magnitudeScalar(rows, r, tapsA, countA, tapsB, countB, scale, x, width, out);
+        }
+    });
+}
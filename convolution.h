@@ -0,0 +1,57 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the Convolution class.
+ *****************************************************************************/
+
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <QImage>
+#include <vector>
+
+/**************************************************************************//**
+ * @brief A 3x3 or 5x5 integer kernel that can be applied to an ARGB32 image.
+ *
+ * Every output channel is the weighted sum of the neighbourhood, divided by
+ * the divisor (rounding toward zero), plus the bias, clamped to [0,255].
+ * Pixels past the border are treated as copies of the nearest edge pixel.
+ * The alpha channel is not filtered; output pixels are always opaque.
+ *
+ * Rows are processed 4 pixels at a time with SSE2 and 8 at a time with AVX2
+ * when the CPU supports it.  Kernels that could overflow 16 bit intermediate
+ * sums fall back to the scalar code.
+ *****************************************************************************/
+class Convolution
+{
+public:
+    Convolution();
+    Convolution(int size, const int *weights, int divisor = 1, int bias = 0);
+
+    int size() const { return kernelSize; }
+    int radius() const { return kernelSize / 2; }
+
+    //destination = kernel applied to source
+    void apply(const QImage &source, QImage &destination) const;
+
+    //destination = scale * sqrt(this^2 + second^2), second may be NULL
+    void magnitude(const QImage &source, QImage &destination, double scale,
+                   const Convolution *second = NULL) const;
+
+    //A single non zero weight of the kernel, as an offset from the center
+    struct Tap
+    {
+        int dy;
+        int dx;
+        int weight;
+    };
+
+private:
+    int kernelSize;
+    int kernelDivisor;
+    int kernelBias;
+    std::vector<Tap> taps;
+    bool fitsInShort;  //Sums can't overflow 16 bits, so SIMD can be used
+};
+
+#endif // CONVOLUTION_H
@@ -0,0 +1,86 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Opens many files at once, decoding them in parallel.
+ *****************************************************************************/
+
+#include "decodequeue.h"
+#include "imagedecoder.h"
+#include <QThreadPool>
+
+/**************************************************************************//**
+ * @brief Constructor.  The queue is empty.
+ *
+ * @param[in] parent - Parent object
+ *****************************************************************************/
+DecodeQueue::DecodeQueue(QObject *parent)
+    : QObject(parent)
+{
+    done = 0;
+    total = 0;
+}
+
+/**************************************************************************//**
+ * @brief Adds files to the queue and starts decoding as many as there are
+ * decoder threads.
+ *
+ * @param[in] fileNames - The files to decode, in the order to open them
+ *****************************************************************************/
+void DecodeQueue::enqueue(const QStringList &fileNames)
+{
+    foreach(const QString &fileName, fileNames)
+    {
+        if(waiting.contains(fileName) || running.contains(fileName))
+            continue;
+
+        waiting.append(fileName);
+        total++;
+    }
+
+    emit progress(done, total);
+    startNext();
+}
+
+/**************************************************************************//**
+ * @brief Hands a decoded image on and starts the next file.  Called on the
+ * GUI thread, so the receiver of decoded() has taken the image before
+ * another decode starts.
+ *
+ * @param[in] fileName - The file that was decoded
+ * @param[in] image - The image, null if it couldn't be decoded
+ * @param[in] error - Why it couldn't
+ *****************************************************************************/
+void DecodeQueue::finish(const QString &fileName, const QImage &image, const QString &error)
+{
+    running.removeAll(fileName);
+    done++;
+
+    emit decoded(fileName, image, error);
+    emit progress(done, total);
+
+    if(done == total)
+    {
+        done = 0;
+        total = 0;
+    }
+
+    startNext();
+}
+
+/**************************************************************************//**
+ * @brief Starts decoding waiting files while fewer than the decoder
+ * threads are busy.
+ *****************************************************************************/
+void DecodeQueue::startNext()
+{
+    while(!waiting.isEmpty() && running.size() < ImageDecoder::pool()->maxThreadCount())
+    {
+        QString fileName = waiting.takeFirst();
+        running.append(fileName);
+
+        ImageDecoder *decoder = new ImageDecoder(fileName);
+        connect(decoder, SIGNAL(decoded(QString,QImage,QString)),
+                this, SLOT(finish(QString,QImage,QString)));
+        ImageDecoder::pool()->start(decoder);
+    }
+}
@@ -0,0 +1,53 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the DecodeQueue class.
+ *****************************************************************************/
+
+#ifndef DECODEQUEUE_H
+#define DECODEQUEUE_H
+
+#include <QImage>
+#include <QObject>
+#include <QStringList>
+
+/**************************************************************************//**
+ * @brief Decodes many files on the ImageDecoder threads, handing each image
+ * to the GUI thread as soon as it is ready.
+ *
+ * Only as many files as there are decoder threads are decoded at once, and
+ * the next one starts when the GUI thread has taken a result.  So however
+ * many files are queued, at most that many decoded images wait in memory,
+ * and the files are opened as fast as the disk and cores allow.
+ *****************************************************************************/
+class DecodeQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DecodeQueue(QObject *parent = NULL);
+
+    //Queues files; those already queued or being decoded are skipped
+    void enqueue(const QStringList &fileNames);
+
+signals:
+    //image is null if the file couldn't be read, error says why
+    void decoded(const QString &fileName, const QImage &image, const QString &error);
+
+    //done of total files of this run have been handed out.  A run ends,
+    //and the counts start over, when done reaches total.
+    void progress(int done, int total);
+
+private slots:
+    void finish(const QString &fileName, const QImage &image, const QString &error);
+
+private:
+    void startNext();
+
+    QStringList waiting;
+    QStringList running;
+    int done;
+    int total;
+};
+
+#endif // DECODEQUEUE_H
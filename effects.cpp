@@ -0,0 +1,463 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief The image effects.  Every effect reads a Format_ARGB32 source and
+ * returns a new image taken from a ScratchPool; nothing else is touched, so
+ * the effects can run on any thread.  Image calls them for the effects that
+ * are applied at once, the PreviewWorker for the live previews of dialogs.
+ *****************************************************************************/
+
+#include "effects.h"
+#include "scanline.h"
+#include "convolution.h"
+#include "medianfilter.h"
+#include "colorquantizer.h"
+#include <math.h>
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+//                   Look up tables for the point operations
+//
+//Each table maps an input channel value to an output channel value.  The
+//single effects and balance() share them, so a balance with default values
+//for two of its stages gives the same result as the remaining effect.
+//-----------------------------------------------------------------------------
+void brightnessLut(int brightnessLevel, int lut[256])
+{
+    for(int i = 0; i < 256; i++ )
+    {
+        if( (i + brightnessLevel) > 255 )
+            lut[i] = 255;
+        else if(i + brightnessLevel < 0)
+            lut[i] = 0;
+        else
+            lut[i] = i + brightnessLevel;
+    }
+}
+
+//Expects lower < upper
+void contrastLut(int lower, int upper, int lut[256])
+{
+    for(int i = 0; i < 256; i++)
+    {
+        int value = (i - lower) * 256.0 / (upper - lower) + 0.5;
+
+        //Handle values < 0 or > 255.  Bounds outside 0..255 (from a macro
+        //or the command line) still have to give a valid channel value.
+        value = (value < lower) ? 0 : (value > upper) ? 255 : value;
+        lut[i] = qBound(0, value, 255);
+    }
+}
+
+//Rounds every value to the nearest of levels evenly spaced values
+void levelsLut(int levels, int lut[256])
+{
+    for(int i = 0; i < 256; i++)
+    {
+        int level = (i * (levels - 1) + 127) / 255;
+        lut[i] = (level * 255 + (levels - 1) / 2) / (levels - 1);
+    }
+}
+
+void gammaLut(double gammaValue, int lut[256])
+{
+    for(int i = 0; i < 256; i++)
+    {
+        //A gamma <= 0 makes pow() return inf, which has no int value
+        double value = pow( i / 255.0, gammaValue ) * 255 + 0.5;
+        lut[i] = int(qBound(0.0, value, 255.0));
+    }
+}
+
+//Sends the red, green and blue channels of every pixel through the table
+void applyLut(const int lut[256], const QImage &source, QImage &destination)
+{
+    Scanline::mapPixels(source, destination, [&](QRgb pixel) {
+        return qRgb(lut[qRed(pixel)], lut[qGreen(pixel)], lut[qBlue(pixel)]);
+    });
+}
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Converts the image to gray using 30% red 59% green and 11% blue.
+ *****************************************************************************/
+QImage Effects::grayscale(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::grayscale", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //get overall monochrome intesity value by using
+    //the grayscale method that takes into account human
+    //eye sensitivity to light.
+    //Each channel is rounded on its own, so one table per channel
+    int redLut[256], greenLut[256], blueLut[256];
+    for(int i = 0; i < 256; i++)
+    {
+        redLut[i] = i * 0.3 + 0.5;
+        greenLut[i] = i * 0.59 + 0.5;
+        blueLut[i] = i * 0.11 + 0.5;
+    }
+
+    Scanline::mapPixels(source, image, [&](QRgb pixel) {
+        int gray = redLut[qRed(pixel)] + greenLut[qGreen(pixel)] + blueLut[qBlue(pixel)];
+        return qRgb(gray, gray, gray);
+    });
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Sharpens the image.
+ *****************************************************************************/
+QImage Effects::sharpen(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::sharpen", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //For every pixel in the image, apply the following mask:
+    //  0  -1   0
+    // -1   5  -1
+    //  0  -1   0
+    static const int weights[9] = {  0, -1,  0,
+                                    -1,  5, -1,
+                                     0, -1,  0 };
+    static const Convolution mask(3, weights);
+    mask.apply(source, image);
+
+    return image;
+}
+
+
+
+/**************************************************************************//**
+ * @brief Softens the image.
+ *****************************************************************************/
+QImage Effects::soften(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::soften", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Each pixel becomes the average of its 3x3 neighbourhood
+    static const int weights[9] = { 1, 1, 1,
+                                    1, 1, 1,
+                                    1, 1, 1 };
+    static const Convolution mask(3, weights, 9);
+    mask.apply(source, image);
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Negates the image.
+ *****************************************************************************/
+QImage Effects::negative(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::negative", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Negate the image (the alpha channel is left alone)
+    Scanline::mapPixels(source, image, [](QRgb pixel) {
+        return pixel ^ 0x00ffffff;
+    });
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Removes speckles (isolated noisy pixels) from the image.  Every pixel
+ * that differs from the median of its neighbourhood by more than threshold in
+ * any channel is replaced by that median, the rest are left alone.  The
+ * median costs the same per pixel for any radius (see medianfilter.h).
+ *
+ * @param[in] threshold - Largest difference from the median that is kept
+ * @param[in] radius - Neighbourhood is (2*radius+1) pixels square
+ *****************************************************************************/
+QImage Effects::despeckle(const QImage &source, ScratchPool &scratch, int threshold, int radius)
+{
+    EffectTimer timer("Effects::despeckle", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    MedianFilter median(radius);
+    median.despeckle(source, image, threshold);
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Posterizes the image by rounding every channel to one of levels
+ * evenly spaced values.  With 6 levels or less the result has at most 216
+ * colours and is returned as an indexed image.
+ *
+ * @param[in] levels - Values per channel, [2,256]
+ *****************************************************************************/
+QImage Effects::posterize(const QImage &source, ScratchPool &scratch, int levels)
+{
+    if(levels < 2 || levels > 256)
+    {
+        qDebug() << "Effects::posterize -> Invalid levels" << levels << ", expecting a value [2,256]";
+        levels = qBound(2, levels, 256);
+    }
+
+    EffectTimer timer("Effects::posterize", source.size());
+
+    int lut[256];
+    levelsLut(levels, lut);
+
+    if(levels * levels * levels > 256)
+    {
+        QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+        applyLut(lut, source, image);
+        return image;
+    }
+
+    //Level of every channel value, and the value every level rounds to
+    int level[256], shade[6];
+    for(int i = 0; i < 256; i++)
+    {
+        level[i] = (i * (levels - 1) + 127) / 255;
+        shade[level[i]] = lut[i];
+    }
+
+    //The colour table holds every combination of levels, red major
+    QVector<QRgb> colorTable;
+    for(int r = 0; r < levels; r++)
+        for(int g = 0; g < levels; g++)
+            for(int b = 0; b < levels; b++)
+                colorTable.append(qRgb(shade[r], shade[g], shade[b]));
+
+    QImage image = scratch.acquire(source.size(), QImage::Format_Indexed8);
+    image.setColorTable(colorTable);
+    Scanline::mapIndexes(source, image, [&](QRgb pixel) {
+        return (level[qRed(pixel)] * levels + level[qGreen(pixel)]) * levels + level[qBlue(pixel)];
+    });
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Posterizes the image to a palette of colors colours chosen to fit
+ * it (see colorquantizer.h).  The result is an indexed image.
+ *
+ * @param[in] colors - Number of colours, [2,256]
+ *****************************************************************************/
+QImage Effects::posterizePalette(const QImage &source, ScratchPool &scratch, int colors)
+{
+    EffectTimer timer("Effects::posterizePalette", source.size());
+
+    ColorQuantizer quantizer(ColorQuantizer::octreePalette(source, colors));
+    QImage image = scratch.acquire(source.size(), QImage::Format_Indexed8);
+    quantizer.apply(source, image);
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Finds the edges of the image.
+ *****************************************************************************/
+QImage Effects::edge(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::edge", source.size());
+    QImage gray = scratch.acquire(source.size(), QImage::Format_ARGB32);
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Author: John M. Weiss, Ph.D.
+    //Class:  CSC421/521 GUI-OOP, Fall 2013.
+    //Posted September 25, 2013.
+    //(The gradients are computed by the convolution engine)
+    Scanline::mapPixels(source, gray, [](QRgb pixel) {
+        int g = qGray(pixel);
+        return qRgb(g, g, g);
+    });
+
+    // pseudo-Prewitt edge magnitude, 3 * sqrt(Gx^2 + Gy^2)
+    static const int vertical[9] = {  0, -1,  0,
+                                      0,  0,  0,
+                                      0,  1,  0 };
+    static const int horizontal[9] = {  0,  0,  0,
+                                       -1,  0,  1,
+                                        0,  0,  0 };
+    static const Convolution gx(3, vertical), gy(3, horizontal);
+    gx.magnitude(gray, image, 3, &gy);
+    scratch.recycle(gray);
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Embosses the image.
+ *****************************************************************************/
+QImage Effects::emboss(const QImage &source, ScratchPool &scratch)
+{
+    EffectTimer timer("Effects::emboss", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    // 0  0  0
+    // 0  1  0
+    // 0  0 -1
+    //Performs the above filter on all the RGB, then averages the RGB into
+    //a grayscale using 30% Red, 59% Green, 11% Blue
+    static const int weights[9] = { 0,  0,  0,
+                                    0,  1,  0,
+                                    0,  0, -1 };
+    static const Convolution mask(3, weights);
+    mask.magnitude(source, image, 1);
+
+    Scanline::mapPixels(image, image, [](QRgb pixel) {
+        int avg = qRed(pixel)*0.3 + qGreen(pixel)*0.59 + qBlue(pixel)*0.11;
+        return qRgb( avg, avg, avg );
+    });
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Performs the gamma function to the image.
+ *
+ *          (R/255)^(gamma) * 255 + 0.5
+ *          (G/255)^(gamma) * 255 + 0.5
+ *          (B/255)^(gamma) * 255 + 0.5
+ *
+ *  0.5 is rounding
+ *
+ * @param[in] gammaValue - Power to raise to
+ *****************************************************************************/
+QImage Effects::gamma(const QImage &source, ScratchPool &scratch, double gammaValue)
+{
+    EffectTimer timer("Effects::gamma", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Gamma of the image (as stated by function header)
+    //Only 256 possible inputs, so pow() is called 256 times, not per pixel
+    int lut[256];
+    gammaLut(gammaValue, lut);
+    applyLut(lut, source, image);
+
+    return image;
+}
+
+
+/**************************************************************************//**
+ * @brief Brightens (or darkens) based on the brightnessLevel
+ *
+ * @param[in] brightnessLevel - Number of pixels to add to each pixel
+ *****************************************************************************/
+QImage Effects::brightness(const QImage &source, ScratchPool &scratch, int brightnessLevel)
+{
+    EffectTimer timer("Effects::brightness", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Set the RGB values based on the look up table
+    int lut[256];
+    brightnessLut(brightnessLevel, lut);
+    applyLut(lut, source, image);
+
+    return image;
+}
+
+
+/**************************************************************************//**
+ * @brief Sets pixels black or white.  If the pixel is less than the threshold,
+ * the pixel is set black, otherwise it's set white.
+ *
+ * @param[in] threshold - The intensity level to check against
+ *****************************************************************************/
+QImage Effects::binaryThreshold(const QImage &source, ScratchPool &scratch, int threshold)
+{
+    //Avoid corrupted input
+    if(threshold < 0 || threshold > 255)
+    {
+        qDebug() << "Effects::binaryThreshold -> Invalid parameter, expecting a value [0,255] instead got " << threshold;
+    }
+
+    EffectTimer timer("Effects::binaryThreshold", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    int lut[256] = {0};
+
+    //Create a simple lookup table
+    for( int i = qMax(threshold, 0); i < 256; i++ )
+        lut[i] = 255;
+
+    //Compair 30% Red 59% Green, 11% Blue value against the threshold
+    //Set the value based on the lookup table
+    Scanline::mapPixels(source, image, [&](QRgb pixel) {
+        int pixelValue = lut[(int)(qRed(pixel) * 0.3 +
+                                   qGreen(pixel) * 0.59 +
+                                   qBlue(pixel) * 0.11)];
+        return qRgb( pixelValue, pixelValue, pixelValue);
+    });
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Contrasts the image.  This function works semi-well.  It individually
+ * changes the RGB values, which it should change the intensity, but it gets
+ * the point across.  The contrast is changed by specifying a lower and upper
+ * bound.  The image then maps the pixels to values within that range.
+ *
+ * @param[in] lower - Lowerbound of the intensity
+ * @param[in] upper - Upperbound of the intensity
+ *****************************************************************************/
+QImage Effects::contrast(const QImage &source, ScratchPool &scratch, int lower, int upper)
+{
+    if(lower >= upper)
+    {
+        qDebug() << "Effects::contrast -> lower >= upper, aborting to prevent divide by 0";
+        return QImage();
+    }
+
+    EffectTimer timer("Effects::contrast", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    //Perform the contrast operation/formula once for every possible value
+    int lut[256];
+    contrastLut(lower, upper, lut);
+    applyLut(lut, source, image);
+
+    return image;
+}
+
+
+/**************************************************************************//**
+ * @brief Applies brightness, contrast and gamma (in that order) in a single
+ * pass.  The three look up tables are composed into one table first, so the
+ * cost is one table look up per channel no matter how many stages are used.
+ *
+ * @param[in] brightness - Number of levels to add to each channel
+ * @param[in] contrastLower - Lowerbound of the intensity
+ * @param[in] contrastUpper - Upperbound of the intensity
+ * @param[in] gamma - Power to raise to
+ *****************************************************************************/
+QImage Effects::balance(const QImage &source, ScratchPool &scratch, int brightness, int contrastLower, int contrastUpper, double gamma)
+{
+    EffectTimer timer("Effects::balance", source.size());
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+
+    int brightnessTable[256], contrastTable[256], gammaTable[256], lut[256];
+    brightnessLut(brightness, brightnessTable);
+    gammaLut(gamma, gammaTable);
+
+    //An empty range would divide by 0, so that stage is skipped
+    if(contrastLower < contrastUpper)
+    {
+        contrastLut(contrastLower, contrastUpper, contrastTable);
+    }
+    else
+    {
+        qDebug() << "Effects::balance -> contrast lower >= upper, skipping contrast";
+        for(int i = 0; i < 256; i++)
+            contrastTable[i] = i;
+    }
+
+    //gamma(contrast(brightness(value)))
+    for(int i = 0; i < 256; i++)
+        lut[i] = gammaTable[contrastTable[brightnessTable[i]]];
+
+    applyLut(lut, source, image);
+
+    return image;
+}
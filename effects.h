@@ -0,0 +1,39 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the image effects.
+ *****************************************************************************/
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <QImage>
+#include "scratchpool.h"
+
+/**************************************************************************//**
+ * @brief The effects as plain functions of their source image.
+ *
+ * Each one reads source (Format_ARGB32), writes into an image acquired from
+ * scratch and returns it.  A null image is returned if the parameters are
+ * rejected.  The functions keep no state, so a preview can render on another
+ * thread while the document keeps showing the previous result.
+ *****************************************************************************/
+namespace Effects
+{
+    QImage grayscale(const QImage &source, ScratchPool &scratch);
+    QImage sharpen(const QImage &source, ScratchPool &scratch);
+    QImage soften(const QImage &source, ScratchPool &scratch);
+    QImage negative(const QImage &source, ScratchPool &scratch);
+    QImage despeckle(const QImage &source, ScratchPool &scratch, int threshold, int radius);
+    QImage posterize(const QImage &source, ScratchPool &scratch, int levels);
+    QImage posterizePalette(const QImage &source, ScratchPool &scratch, int colors);
+    QImage edge(const QImage &source, ScratchPool &scratch);
+    QImage emboss(const QImage &source, ScratchPool &scratch);
+    QImage gamma(const QImage &source, ScratchPool &scratch, double gammaValue);
+    QImage brightness(const QImage &source, ScratchPool &scratch, int brightnessLevel);
+    QImage binaryThreshold(const QImage &source, ScratchPool &scratch, int threshold);
+    QImage contrast(const QImage &source, ScratchPool &scratch, int lower, int upper);
+    QImage balance(const QImage &source, ScratchPool &scratch, int brightness, int contrastLower, int contrastUpper, double gamma);
+}
+
+#endif // EFFECTS_H
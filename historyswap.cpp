@@ -0,0 +1,115 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Moves undo history that doesn't fit in memory to a memory mapped
+ * file shared by all documents.
+ *****************************************************************************/
+
+#include "historyswap.h"
+#include <QDir>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTemporaryFile>
+#include <QDebug>
+
+namespace
+{
+
+QMutex swapMutex;
+qint64 usedBytes = 0;
+
+//Created on first use, removed when the program ends
+QTemporaryFile &swapFile()
+{
+    static QTemporaryFile file(QDir::tempPath() + "/PhotoEdit-history-XXXXXX.swap");
+    return file;
+}
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Constructor.  Only HistorySwap::store() makes regions.
+ *
+ * @param[in] mapped - Start of the mapping
+ * @param[in] bytes - Size of the region
+ *****************************************************************************/
+SwapRegion::SwapRegion(uchar *mapped, qint64 bytes)
+    : mapped(mapped), bytes(bytes)
+{
+}
+
+/**************************************************************************//**
+ * @brief Destructor.  Unmaps the region and gives it back to the file.
+ *****************************************************************************/
+SwapRegion::~SwapRegion()
+{
+    HistorySwap::release(this);
+}
+
+/**************************************************************************//**
+ * @brief Writes data at the end of the swap file and maps it back in.  The
+ * copy in data can be freed afterwards; the region reads the same bytes from
+ * the file.
+ *
+ * @param[in] data - Bytes to move out of memory
+ *
+ * @returns The mapped region, or null if the file couldn't be opened,
+ * written or mapped, in which case data has to stay in memory
+ *****************************************************************************/
+QSharedPointer<SwapRegion> HistorySwap::store(const QByteArray &data)
+{
+    QMutexLocker locker(&swapMutex);
+
+    QTemporaryFile &file = swapFile();
+    if(!file.isOpen() && !file.open())
+    {
+        qDebug() << "HistorySwap::store -> Cannot open" << file.fileName();
+        return QSharedPointer<SwapRegion>();
+    }
+
+    qint64 offset = file.size();
+    if(!file.seek(offset) || file.write(data) != data.size() || !file.flush())
+    {
+        qDebug() << "HistorySwap::store -> Cannot write" << file.fileName();
+        file.resize(offset);
+        return QSharedPointer<SwapRegion>();
+    }
+
+    uchar *mapped = file.map(offset, data.size());
+    if(NULL == mapped)
+    {
+        qDebug() << "HistorySwap::store -> Cannot map" << file.fileName();
+        file.resize(offset);
+        return QSharedPointer<SwapRegion>();
+    }
+
+    usedBytes += data.size();
+    return QSharedPointer<SwapRegion>(new SwapRegion(mapped, data.size()));
+}
+
+/**************************************************************************//**
+ * @brief Returns the bytes of the swap file that are in use.  Space of the
+ * regions released is only reclaimed once all of them are.
+ *****************************************************************************/
+qint64 HistorySwap::bytesInUse()
+{
+    QMutexLocker locker(&swapMutex);
+    return usedBytes;
+}
+
+/**************************************************************************//**
+ * @brief Unmaps a region.  Once no region is left the file is emptied.
+ *
+ * @param[in] region - The region going away
+ *****************************************************************************/
+void HistorySwap::release(SwapRegion *region)
+{
+    QMutexLocker locker(&swapMutex);
+
+    QTemporaryFile &file = swapFile();
+    file.unmap(region->mapped);
+    usedBytes -= region->bytes;
+
+    if(0 == usedBytes)
+        file.resize(0);
+}
@@ -0,0 +1,56 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the HistorySwap class.
+ *****************************************************************************/
+
+#ifndef HISTORYSWAP_H
+#define HISTORYSWAP_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+
+/**************************************************************************//**
+ * @brief A part of the swap file, mapped into memory for as long as anything
+ * refers to it.  The mapping is of a file, so the system can drop its pages
+ * whenever it needs the memory and read them back when they are touched.
+ *****************************************************************************/
+class SwapRegion
+{
+public:
+    ~SwapRegion();
+
+    const uchar *data() const { return mapped; }
+    qint64 size() const { return bytes; }
+
+private:
+    friend class HistorySwap;
+    SwapRegion(uchar *mapped, qint64 bytes);
+
+    uchar *mapped;
+    qint64 bytes;
+};
+
+/**************************************************************************//**
+ * @brief The swap file the undo histories of all documents move their oldest
+ * keyframes to once they take too much memory.
+ *
+ * There is one file per session, created in the temporary directory on the
+ * first write and deleted when the program ends.  Regions are only ever
+ * appended; the file is emptied again once no region is in use.
+ *****************************************************************************/
+class HistorySwap
+{
+public:
+    //Appends data to the swap file and maps it, null if it couldn't be written
+    static QSharedPointer<SwapRegion> store(const QByteArray &data);
+
+    //Bytes of the regions still in use
+    static qint64 bytesInUse();
+
+private:
+    friend class SwapRegion;
+    static void release(SwapRegion *region);
+};
+
+#endif // HISTORYSWAP_H
@@ -2,485 +2,326 @@
  * @file
  *
  * @brief Handles the manipulating of the image.  The image is allowed to
- * dynamically update, so the unModifiedImage is used to update the image until
+ * dynamically update, so the committed image is used to update the image until
  * a commit() occurs.  If a revert() occurs,  (i.e. the cancel buton is pressed)
- * reset the instance to the unModifiedImage.
+ * reset the instance to the committed image.
+ *
+ * The committed image is kept as tiles (see tiledimage.h).  A commit only
+ * replaces the tiles that changed since the last one, and the versions kept
+ * for undo share all other tiles with it.  Cuts and pastes paint into the
+ * current image in place and mark just their area as changed.
+ *
+ * The effects read the committed image in Format_ARGB32 so they can read and
+ * write whole rows (see scanline.h) instead of single pixels.  The rows are
+ * split into bands that run on all cores (see bandscheduler.h).  Posterized
+ * images are committed as Format_Indexed8, which takes a quarter of the
+ * memory; the effects then work from a Format_ARGB32 copy made on demand.
+ *
+ * The effects themselves are in effects.cpp; Image runs them on the calling
+ * thread, while dialogs render their previews on a PreviewWorker.  Effects
+ * write into images from a ScratchPool, so a live preview reuses the same few
+ * buffers instead of allocating a new image on every tick.
+ *
+ * The pixels live in a QImage (current).  Effects hand their result to
+ * setImage() and commit() shares it, so nothing is converted between QImage
+ * and QPixmap on the way.  The view makes its own pixmap tiles from
+ * toImage(), for the parts changed() reports that it actually shows.
  *****************************************************************************/
 
 #include "image.h"
-
-
+#include "effects.h"
+#include "scanline.h"
+#include <QPainter>
 
 /**************************************************************************//**
- * @brief Constructor.  The only thing it does is initiaze unModifiedImage.
+ * @brief Constructor.  The image is null until something is loaded.
  *****************************************************************************/
 Image::Image()
 {
-    unModifiedImage = NULL;
 }
 
 /**************************************************************************//**
- * @brief Loads in a pixmap from a given filename.  The pixmap cache is cleared
- * everytime prior to a file load.  (This forces a similar filename to load
- * from disk, rather than use a stored cached pixmap.  This is used because the
- * way the revert() is handled)
+ * @brief Destructor.
+ *****************************************************************************/
+Image::~Image()
+{
+}
+
+/**************************************************************************//**
+ * @brief Loads in an image from a given filename.  The image is read straight
+ * into the QImage the effects work on; nothing is converted to a pixmap until
+ * the view paints it.
  *
  * @param[in] fileName - Name of the file.
- * @param[in] format - Format to load the pixmap as
- * @param[in] flags - Special flags for converting pixmaps
+ * @param[in] format - Format of the file, NULL to guess it from the file
  *****************************************************************************/
-bool Image::load( const QString & fileName, const char * format, Qt::ImageConversionFlags flags )
+bool Image::load( const QString & fileName, const char * format )
 {
-    //Reset the pixmapCache before loading a file
-    //Whenever a file is loaded into a QPixmap, the filepath, and modified date are used as
-    //a key to the pixmap.  If the file is loaded again, it just uses the cached pixmap
-    //In our case, we don't want to load the saved pixmap, we want to reset the pixmap each
-    //time (used to revert)
-    QPixmapCache::clear();
+    QImage loaded;
+    bool returnValue = loaded.load(fileName, format);
 
-    bool returnValue =QPixmap::load(fileName, format, flags);
+    //The decoded image is freed before the tiles are copied, so at most two
+    //full copies exist at once (see StripStream for files larger than that)
+    loaded = Scanline::stored(loaded);
+    setLoaded(loaded);
 
-    //Delete our object before setting to a new object
-    if(NULL == unModifiedImage){ delete unModifiedImage; }
+    return returnValue;
+}
+
+/**************************************************************************//**
+ * @brief Takes an image decoded from a file as the document, uncommitted
+ * changes and all being dropped.
+ *
+ * @param[in] loaded - The image, Format_ARGB32 or Format_Indexed8
+ *****************************************************************************/
+void Image::setLoaded(const QImage &loaded)
+{
+    setImage(loaded);
 
     //Store the original image (until a commit() occurs)
-    unModifiedImage = new QImage(this->toImage());
+    committed = TiledImage(current);
+    committedCache = current;
+    dirty = QRect();
+    normalizedSource = QImage();
+    proxy = QImage();
+}
 
-    return returnValue;
+/**************************************************************************//**
+ * @brief Saves the current image to a file.
+ *
+ * @param[in] fileName - Name of the file.
+ * @param[in] format - Format of the file, NULL to pick it from the suffix
+ * @param[in] quality - Compression quality, [0,100] or -1 for the default
+ *****************************************************************************/
+bool Image::save( const QString & fileName, const char * format, int quality ) const
+{
+    return current.save(fileName, format, quality);
 }
 
 /**************************************************************************//**
- * @brief Converts the unModifiedImage to a gray image using 30% red 59% green
- * and 11% blue.  The image is then saved as the current object.
+ * @brief Converts the image to gray using 30% red 59% green and 11% blue.
+ * See Effects::grayscale().
  *****************************************************************************/
 void Image::grayscale()
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::grayscale -> Null reference";
         return;
     }
 
-    int gray = 0;
-    int nrows = image->width(), ncols = image->height();
-
-    for( int r=0; r < nrows; r++)
-        for( int c = 0; c < ncols; c++)
-        {
-            //get overall monochrome intesity value by using
-            //the grayscale method that takes into account human
-            //eye sensitivity to light.
-            int blue = qBlue(image->pixel(r,c)) * 0.11 + 0.5;
-            int green = qGreen(image->pixel(r,c)) * 0.59 + 0.5;
-            int red = qRed(image->pixel(r,c)) * 0.3 + 0.5;
-            gray = red + blue + green;
-            QRgb rgbValue = qRgb(gray, gray, gray);
-            image->setPixel(r,c, rgbValue);
-        }
-
-    //Set the current instance equal to the grayscale image
-    this->convertFromImage(*image);
+    setResult(Effects::grayscale(source(), scratch));
 }
 
 /**************************************************************************//**
- * @brief Converts the unModifiedImage to a sharpened image.  The result is
- * stored into the current object.
+ * @brief Sharpens the image.  See Effects::sharpen().
  *****************************************************************************/
 void Image::sharpen()
 {
-    QImage *temp = new QImage(*unModifiedImage);//Copy of the original image
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull() || temp->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::sharpen -> Null reference";
         return;
     }
 
-    //For every pixel in the image, apply the following mask:
-    //  0  -1   0
-    // -1   5  -1
-    //  0  -1   0
-    //"temp" is used since it's an uneditted copy
-    //of the original image
-    for (int r = 1; r < image->width() - 1; r++)
-        for(int c = 1; c < image->height() - 1; c++)
-        {
-            QRgb pixel = temp->pixel(r,c); //The item being looked at
-            int red = qRed(pixel) * 5;
-            int blue = qBlue(pixel) * 5;
-            int green = qGreen(pixel) * 5;
-
-            pixel = temp->pixel(r, c-1); //Item to the left of [r][c]
-            red -= qRed(pixel);
-            blue -= qBlue(pixel);
-            green -= qGreen(pixel);
-
-            pixel = temp->pixel(r-1, c); //Item above [r][c]
-            red -= qRed(pixel);
-            blue -= qBlue(pixel);
-            green -= qGreen(pixel);
-
-            pixel = temp->pixel(r+1, c);  //Item below [r][c]
-            red -= qRed(pixel);
-            blue -= qBlue(pixel);
-            green -= qGreen(pixel);
-
-            pixel = temp->pixel(r, c+1);  //Item to the right of [r][c]
-            red -= qRed(pixel);
-            blue -= qBlue(pixel);
-            green -= qGreen(pixel);
-
-            //Verify rgb is within 0 to 255
-            red = (red < 0) ? 0 : (red > 255) ? 255 : red;
-            green = (green < 0) ? 0 : (green > 255) ? 255 : green;
-            blue = (blue < 0) ? 0 : (blue > 255) ? 255 : blue;
-
-            image->setPixel(r, c, qRgb(red, green, blue));
-        }
-
-    //Set the current instance equal to the modified image
-    this->convertFromImage(*image);
+    setResult(Effects::sharpen(source(), scratch));
 }
 
-
-
 /**************************************************************************//**
- * @brief The unModifiedImage is softened and then stored as the current object
- * instance.
+ * @brief Softens the image by averaging every 3x3 neighbourhood.  See
+ * Effects::soften().
  *****************************************************************************/
 void Image::soften()
 {
-    QImage *temp = new QImage(*unModifiedImage); //Copy of original image
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull() || temp->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::soften -> Null reference";
         return;
     }
 
-    //Author: John M. Weiss, Ph.D.
-    //Class:  CSC421/521 GUI-OOP, Fall 2013.
-    //Posted September 23, 2013.
-    for ( int x = 1; x < image->width() - 1; x++ )
-    {
-        for ( int y = 1; y < image->height() - 1; y++ )
-        {
-            int r = 0, g = 0, b = 0;
-            for ( int m = -1; m <= 1; m++ )
-            {
-                for ( int n = -1; n <= 1; n++ )
-                {
-                    QRgb p = temp->pixel( x + m, y + n );
-                    r += qRed( p );
-                    g += qGreen( p );
-                    b += qBlue( p );
-                }
-            }
-            image->setPixel( x, y, qRgb( r / 9, g / 9, b / 9 ) );
-        }
-    }
-
-    //Sets the current instance equal to the modified image
-    this->convertFromImage(*image);
+    setResult(Effects::soften(source(), scratch));
 }
 
 /**************************************************************************//**
- * @brief The unModifiedImage is negated and then stored as the current object
- * instance.
+ * @brief Negates the image.  See Effects::negative().
  *****************************************************************************/
 void Image::negative()
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::negative -> Null reference";
         return;
     }
 
-    //Negate the image
-    image->invertPixels();
-
-    //Set the current instance to the negated image
-    this->convertFromImage(*image);
+    setResult(Effects::negative(source(), scratch));
 }
 
 /**************************************************************************//**
- * @brief The following function is a placeholder.  It is not implemented.
+ * @brief Removes speckles, pixels that differ from the median of their
+ * neighbourhood by more than threshold.  See Effects::despeckle().
+ *
+ * @param[in] threshold - Largest difference from the median that is kept
+ * @param[in] radius - Neighbourhood is (2*radius+1) pixels square
  *****************************************************************************/
-void Image::despeckle(int threshold = 32)
+void Image::despeckle(int threshold, int radius)
 {
-    qDebug() << "Image::despeckle -> Not Implemented";
+    if(committed.isNull())
+    {
+        qDebug() << "Image::despeckle -> Null reference";
+        return;
+    }
+
+    setResult(Effects::despeckle(source(), scratch, threshold, radius));
 }
 
 /**************************************************************************//**
- * @brief The following function is a placeholder.  It is not implemented.
+ * @brief Posterizes the image to levels values per channel.  See
+ * Effects::posterize().
+ *
+ * @param[in] levels - Values per channel, [2,256]
  *****************************************************************************/
-void Image::posterize()
+void Image::posterize(int levels)
 {
-    qDebug() << "Image::posterize -> Not Implemented";
+    if(committed.isNull())
+    {
+        qDebug() << "Image::posterize -> Null reference";
+        return;
+    }
+
+    setResult(Effects::posterize(source(), scratch, levels));
 }
 
 /**************************************************************************//**
- * @brief Finds the edges of the unModifiedImage and sets the current instance
- * as the result.
+ * @brief Posterizes the image to a palette of colors colours chosen to fit
+ * it.  See Effects::posterizePalette().
+ *
+ * @param[in] colors - Number of colours, [2,256]
  *****************************************************************************/
-void Image::edge()
+void Image::posterizePalette(int colors)
 {
-    QImage *temp = new QImage(*unModifiedImage); //Copy of original image
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull() || temp->isNull())
+    if(committed.isNull())
     {
-        qDebug() << "Image::edge -> Null reference";
+        qDebug() << "Image::posterizePalette -> Null reference";
         return;
     }
 
-    //Author: John M. Weiss, Ph.D.
-    //Class:  CSC421/521 GUI-OOP, Fall 2013.
-    //Posted September 25, 2013.
-    for ( int x = 1; x < temp->width() - 1; x++ )
+    setResult(Effects::posterizePalette(source(), scratch, colors));
+}
+
+/**************************************************************************//**
+ * @brief Finds the edges of the image.  See Effects::edge().
+ *****************************************************************************/
+void Image::edge()
+{
+    if(committed.isNull())
     {
-        for ( int y = 1; y < temp->height() - 1; y++ )
-        {
-            // pseudo-Prewitt edge magnitude
-            int Gx = qGray( temp->pixel( x, y + 1 ) ) - qGray( temp->pixel( x, y - 1 ) );
-            int Gy = qGray( temp->pixel( x + 1, y ) ) - qGray( temp->pixel( x - 1, y ) );
-            int e = 3 * sqrt( double(Gx * Gx + Gy * Gy) );
-            if ( e > 255 ) e = 255;
-            image->setPixel( x, y, qRgb( e, e, e ) );
-        }
+        qDebug() << "Image::edge -> Null reference";
+        return;
     }
 
-    //Sets the current image instance to the edged image
-    this->convertFromImage(*image);
+    setResult(Effects::edge(source(), scratch));
 }
 
 /**************************************************************************//**
- * @brief The unModifiedImage is embossed.  The result is stored in the current
- * instance;
+ * @brief Embosses the image.  See Effects::emboss().
  *****************************************************************************/
 void Image::emboss()
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::emboss -> Null reference";
         return;
     }
 
-    // 0  0  0
-    // 0  1  0
-    // 0  0 -1
-    //Performs the above filter on all the RGB, then averages the RGB into
-    //a grayscale using 30% Red, 59% Green, 11% Blue
-    for ( int x = 0; x < image->width()-1; x++ )
-    {
-        for ( int y = 0; y < image->height()-1; y++ )
-        {
-            QRgb pixel = image->pixel( x, y );
-            QRgb lowerPixel = image->pixel(x+1, y+1);
-
-            int r = abs(qRed(pixel) - qRed(lowerPixel));
-            int g = abs(qGreen(pixel) - qGreen(lowerPixel));
-            int b = abs(qBlue(pixel) - qBlue(lowerPixel));
-            int avg = r*0.3 + g*0.59 + b*0.11;
-            image->setPixel( x, y, qRgb( avg, avg, avg ) );
-        }
-    }
-
-    //Set the current instance to the embossed image
-    this->convertFromImage(*image);
+    setResult(Effects::emboss(source(), scratch));
 }
 
 /**************************************************************************//**
- * @brief Performs the gamma function to the image.
- *
- *          (R/255)^(gamma) * 255 + 0.5
- *          (G/255)^(gamma) * 255 + 0.5
- *          (B/255)^(gamma) * 255 + 0.5
- *
- *  0.5 is rounding
+ * @brief Performs the gamma function to the image.  See Effects::gamma().
  *
  * @param[in] gammaValue - Power to raise to
  *****************************************************************************/
 void Image::gamma(double gammaValue)
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::gamma -> Null reference";
         return;
     }
 
-    //Gamma of the image (as stated by function header)
-    for ( int x = 0; x < image->width(); x++ )
-    {
-        for ( int y = 0; y < image->height(); y++ )
-        {
-            QRgb p = image->pixel( x, y );
-            int r = pow( qRed( p ) / 255.0, gammaValue ) * 255 + 0.5;
-            int g = pow( qGreen( p ) / 255.0, gammaValue ) * 255 + 0.5;
-            int b = pow( qBlue( p ) / 255.0, gammaValue ) * 255 + 0.5;
-            image->setPixel( x, y, qRgb( r, g, b ) );
-        }
-    }
-
-    //Sets the current instance to the gamma image
-    this->convertFromImage(*image);
+    setResult(Effects::gamma(source(), scratch, gammaValue));
 }
 
-
 /**************************************************************************//**
- * @brief Brightens (or darkens) based on the brightnessLevel
+ * @brief Brightens (or darkens) based on the brightnessLevel.  See
+ * Effects::brightness().
  *
- * @param[in] brightnessLevel - Number of pixels to add to each pixel
+ * @param[in] brightnessLevel - Number of levels to add to each channel
  *****************************************************************************/
 void Image::brightness(int brightnessLevel)
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::brightness -> Null reference";
         return;
     }
 
-    int nrows = image->width(), ncols = image->height(), r, c,
-    lut[256];
-
-    //Create a Look up table for brightnesses
-    for(int i = 0; i < 256; i++ )
-    {
-        if( (i + brightnessLevel) > 255 )
-            lut[i] = 255;
-        else if(i + brightnessLevel < 0)
-            lut[i] = 0;
-        else
-            lut[i] = i + brightnessLevel;
-    }
-
-    //Set the RGB values based on the look up table
-    for( r = 0; r < nrows; r++ )
-        for( c = 0; c < ncols; c++ )
-        {
-            QRgb pixel = image->pixel(r,c);
-            int red = lut[qRed(pixel)];
-            int green = lut[qGreen(pixel)];
-            int blue = lut[qBlue(pixel)];
-            image->setPixel(r, c, qRgb(red, green, blue));
-        }
-
-    //Sets the current instance to the brightened image
-    this->convertFromImage(*image);
+    setResult(Effects::brightness(source(), scratch, brightnessLevel));
 }
 
-
 /**************************************************************************//**
- * @brief Sets pixels black or white.  If the pixel is less than the threshold,
- * the pixel is set black, otherwise it's set white.
+ * @brief Sets pixels black or white against the threshold.  See
+ * Effects::binaryThreshold().
  *
  * @param[in] threshold - The intensity level to check against
  *****************************************************************************/
 void Image::binaryThreshold(int threshold)
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::binaryThreshold -> Null reference";
         return;
     }
 
-    //Avoid corrupted input
-    if(threshold < 0 || threshold > 255)
-    {
-        qDebug() << "Image::binaryThreshold -> Invalid parameter, expecting a value [0,255] instead got " << threshold;
-    }
-
-    int lut[256] = {0};
-
-    //Create a simple lookup table
-    for( int i = threshold; i < 256; i++ )
-        lut[i] = 255;
-
-    //Compair 30% Red 59% Green, 11% Blue value against the threshold
-    //Set the value based on the lookup table
-    for( int r=0; r < image->width(); r++)
-        for( int c = 0; c < image->height(); c++)
-        {
-            QRgb pixel = image->pixel(r, c);
-            int pixelValue = lut[(int)(qRed(pixel) * 0.3 +
-                                       qGreen(pixel) * 0.59 +
-                                       qBlue(pixel) * 0.11)];
-            image->setPixel(r, c, qRgb( pixelValue, pixelValue, pixelValue));
-        }
-
-    //Set the current instance to the binary threshold image
-    this->convertFromImage(*image);
+    setResult(Effects::binaryThreshold(source(), scratch, threshold));
 }
 
 /**************************************************************************//**
- * @brief Contrasts the image.  This function works semi-well.  It individually
- * changes the RGB values, which it should change the intensity, but it gets
- * the point across.  The contrast is changed by specifying a lower and upper
- * bound.  The image then maps the pixels to values within that range.
+ * @brief Contrasts the image.  Nothing changes if lower >= upper.  See
+ * Effects::contrast().
  *
  * @param[in] lower - Lowerbound of the intensity
  * @param[in] upper - Upperbound of the intensity
  *****************************************************************************/
 void Image::contrast(int lower, int upper)
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::contrast -> Null reference";
         return;
     }
 
-    if(lower >= upper)
-    {
-        qDebug() << "Image::contrast -> lower >= upper, aborting to prevent divide by 0";
-        return;
-    }
-
-    for(int r = 0; r < int(image->width()); r++)
-           for(int c = 0; c < int(image->height()); c++)
-           {
-               QRgb pixel = image->pixel(r, c);
-               int red = qRed(pixel), green = qGreen(pixel), blue = qBlue(pixel);
-
-               //Perform the contrast operation/formula
-               red = (red - lower) * 256.0 / (upper - lower) + 0.5;
-               green = (green - lower) * 256.0 / (upper - lower) + 0.5;
-               blue = (blue - lower) * 256.0 / (upper - lower) + 0.5;
-
-               //Handle values < 0 or > 255
-               red = (red < lower) ? 0 : (red > upper) ? 255 : red;
-               green = (green < lower) ? 0 : (green > upper) ? 255 : green;
-               blue = (blue < lower) ? 0 : (blue > upper) ? 255 : blue;
-
-               image->setPixel(r, c, qRgb(red, green, blue));
-           }
-
-    //Set the current instance to the contrasted image
-    this->convertFromImage(*image);
+    setResult(Effects::contrast(source(), scratch, lower, upper));
 }
 
-
 /**************************************************************************//**
- * @brief The following function is a placeholder.  It is not implemented.
+ * @brief Applies brightness, contrast and gamma (in that order) in a single
+ * pass.  See Effects::balance().
+ *
+ * @param[in] brightness - Number of levels to add to each channel
+ * @param[in] contrastLower - Lowerbound of the intensity
+ * @param[in] contrastUpper - Upperbound of the intensity
+ * @param[in] gamma - Power to raise to
  *****************************************************************************/
 void Image::balance(int brightness, int contrastLower, int contrastUpper, double gamma)
 {
-    qDebug() << "Image::balance -> Not Implemented";
+    if(committed.isNull())
+    {
+        qDebug() << "Image::balance -> Null reference";
+        return;
+    }
+
+    setResult(Effects::balance(source(), scratch, brightness, contrastLower, contrastUpper, gamma));
 }
 
 
@@ -492,17 +333,14 @@ void Image::balance(int brightness, int contrastLower, int contrastUpper, double
  *****************************************************************************/
 void Image::imgResize(int width, int height)
 {
-    QImage *image = new QImage(*unModifiedImage);
-
-    if(image->isNull())
+    if(committed.isNull())
     {
         qDebug() << "Image::imgResize -> Null reference";
         return;
     }
 
     //Set the current instance to the resized image
-    image = new QImage(image->scaled(width, height));
-    this->convertFromImage(*image);
+    setImage(committedImage().scaled(width, height));
 }
 
 
@@ -512,9 +350,17 @@ void Image::imgResize(int width, int height)
  *****************************************************************************/
 void Image::commit()
 {
-    if (NULL != unModifiedImage)
-        delete unModifiedImage;
-    unModifiedImage = new QImage(this->toImage());
+    current = Scanline::stored(current);
+
+    //Only the tiles that changed are copied, the current image is shared
+    committed.update(current, dirty);
+    committedCache = current;
+    dirty = QRect();
+    normalizedSource = QImage();
+    proxy = QImage();
+
+    //Previews are over, let go of their buffers
+    scratch.clear();
 }
 
 
@@ -523,6 +369,153 @@ void Image::commit()
  *****************************************************************************/
 void Image::revert()
 {
-    this->convertFromImage(*unModifiedImage);
+    setImage(committedImage());
+    committedCache = current;
+    dirty = QRect();
+    scratch.clear();
+}
+
+/**************************************************************************//**
+ * @brief Makes a version of the image kept earlier (see committedTiles()) the
+ * committed and current image, e.g. to undo.
+ *
+ * @param[in] tiles - The version to go back to
+ *****************************************************************************/
+void Image::restore(const TiledImage &tiles)
+{
+    committed = tiles;
+    setImage(committed.toImage());
+    committedCache = current;
+    dirty = QRect();
+    normalizedSource = QImage();
+    proxy = QImage();
+    scratch.clear();
+}
+
+/**************************************************************************//**
+ * @brief Paints into the current image in place.  Only area is marked as
+ * changed, so the next commit() copies just the tiles under it.
+ *
+ * @param[in] area - Part of the image paint draws on
+ * @param[in] paint - Draws with the painter it is given
+ *****************************************************************************/
+void Image::paintRegion(const QRect &area, const std::function<void (QPainter &painter)> &paint)
+{
+    if(current.isNull())
+    {
+        qDebug() << "Image::paintRegion -> Null reference";
+        return;
+    }
+
+    //The committed image is no longer needed in one piece.  Letting go of it
+    //keeps the painter from copying the whole current image it shares.
+    committedCache = QImage();
+    if(current.format() != QImage::Format_ARGB32)
+    {
+        current = Scanline::normalized(current);
+        dirty = current.rect();
+    }
+
+    QPainter painter(&current);
+    paint(painter);
+    painter.end();
+
+    dirty |= area & current.rect();
+    emit changed(area & current.rect());
+}
+
+/**************************************************************************//**
+ * @brief Replaces the current image.  Nothing is converted to a pixmap here,
+ * so an effect that is previewed many times in a row only pays for the tiles
+ * the view actually repaints.
+ *
+ * @param[in] image - The new image, in any format
+ *****************************************************************************/
+void Image::setImage(const QImage &image)
+{
+    //The image being replaced is usually the previous preview tick, which
+    //the next tick can write into
+    QImage previous = current;
+    current = image;
+    scratch.recycle(previous);
+
+    dirty = current.rect();
+    emit changed(current.rect());
+}
+
+/**************************************************************************//**
+ * @brief Shows the result of an effect.  A null result means the effect
+ * rejected its parameters, and the current image is kept.
+ *****************************************************************************/
+void Image::setResult(const QImage &result)
+{
+    if(!result.isNull())
+        setImage(result);
+}
+
+/**************************************************************************//**
+ * @brief Returns the image as of the last commit().  Posterized images are
+ * Format_Indexed8, everything else is Format_ARGB32.  After a paintRegion()
+ * the image is put together from its tiles, which makes a copy.
+ *****************************************************************************/
+QImage Image::committedImage() const
+{
+    return committedCache.isNull() ? committed.toImage() : committedCache;
+}
+
+/**************************************************************************//**
+ * @brief Returns what the effects read: the image as of the last commit(), in
+ * Format_ARGB32.  The image is shared, so a preview can render from it on
+ * another thread.  Null if nothing is loaded.
+ *****************************************************************************/
+QImage Image::effectSource()
+{
+    if(committed.isNull())
+        return QImage();
+
+    return source();
 }
 
+/**************************************************************************//**
+ * @brief Returns effectSource() scaled down to size.  The scaled copy is kept,
+ * so a dialog only pays for it on its first tick, and until the zoom changes.
+ *
+ * @param[in] size - Size of the proxy, effectSource() itself if this is its
+ * size
+ *****************************************************************************/
+QImage Image::proxySource(const QSize &size)
+{
+    QImage full = effectSource();
+    if(full.isNull() || size == full.size())
+        return full;
+
+    if(proxy.size() != size)
+        proxy = Scanline::normalized(full.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+    return proxy;
+}
+
+/**************************************************************************//**
+ * @brief Returns the memory held by the scratch images of this document (see
+ * scratchpool.h).
+ *****************************************************************************/
+qint64 Image::scratchBytes() const
+{
+    return scratch.bytesInFlight();
+}
+
+/**************************************************************************//**
+ * @brief Returns the committed image in Format_ARGB32.  If it is stored in
+ * another format, or only as tiles, the copy is made once and kept until the
+ * next commit().
+ *****************************************************************************/
+const QImage &Image::source()
+{
+    if(committedCache.format() == QImage::Format_ARGB32)
+        return committedCache;
+
+    if(normalizedSource.isNull())
+        normalizedSource = Scanline::normalized(committedImage());
+
+    return normalizedSource;
+}
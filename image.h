@@ -1,27 +1,40 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <QImage>
 #include <QPixmap>
 #include <QDebug>
-#include <QPixmapCache>
 #include <QObject>
 #include <math.h>
+#include "scratchpool.h"
+#include "tiledimage.h"
+#include <functional>
 
-class Image :public QObject, public QPixmap
+class QPainter;
+
+class Image : public QObject
 {
     Q_OBJECT
 public:
     Image();
+    ~Image();
+
     //Load in the image
-    bool load( const QString & fileName, const char * format = 0, Qt::ImageConversionFlags flags = Qt::AutoColor );
+    bool load( const QString & fileName, const char * format = 0 );
+
+    //Replaces the document with an image decoded elsewhere, e.g. by an
+    //ImageDecoder.  Same as load() from then on.
+    void setLoaded(const QImage &loaded);
+    bool save( const QString & fileName, const char * format = 0, int quality = -1 ) const;
 
     //Image effects
     void grayscale();
     void sharpen();
     void soften();
     void negative();
-    void despeckle(int threshold);
-    void posterize();
+    void despeckle(int threshold, int radius = 1);
+    void posterize(int levels);
+    void posterizePalette(int colors);
     void edge();
     void emboss();
     void gamma(double gammaValue);
@@ -31,14 +44,73 @@ public:
     void imgResize(int width, int height);
     void balance(int brightness, int contrastLower, int contrastUpper, double gamma);
 
+    //Replaces the current image, keeping its format until commit()
+    void setImage(const QImage &image);
+
+    //The current image, including changes that are not committed yet
+    const QImage &toImage() const { return current; }
+
+    //Paints into part of the current image, without copying the rest
+    void paintRegion(const QRect &area, const std::function<void (QPainter &painter)> &paint);
+
+    //The image as of the last commit(), in the format it is stored in
+    QImage committedImage() const;
+    QSize committedSize() const { return committed.size(); }
+
+    //The image as of the last commit(), sharing its tiles with the copy kept
+    const TiledImage &committedTiles() const { return committed; }
+    void restore(const TiledImage &tiles);
+
+    //Memory used by the images the effects write into
+    qint64 scratchBytes() const;
+
+    //What the effects read and write into, for rendering a preview elsewhere
+    QImage effectSource();
+
+    //effectSource() scaled down to size, for previews at the view resolution
+    QImage proxySource(const QSize &size);
+    ScratchPool &scratchPool() { return scratch; }
+
+    bool isNull() const { return current.isNull(); }
+    QSize size() const { return current.size(); }
+    QRect rect() const { return current.rect(); }
+
 public slots:
     void commit();  //Commits the image change
-    void revert();  //Reverts the current image back to unModifiedImage
+    void revert();  //Reverts the current image back to the committed image
+
+signals:
+    void changed(const QRect &area);  //This part of the current image changed
 
 private:
+    //The committed image in Format_ARGB32, which is what the effects read
+    const QImage &source();
+
+    //Shows an effect result unless the effect rejected its parameters
+    void setResult(const QImage &result);
+
     //Stores the original image until commit() is called
     //Used to dynamically update the images
-    QImage *unModifiedImage;
+    TiledImage committed;
+
+    //The committed image in one piece, shared with current right after a
+    //commit().  Null once current has been painted on in place.
+    QImage committedCache;
+
+    //Part of current that may differ from committed
+    QRect dirty;
+
+    //The canonical pixels of the document
+    QImage current;
+
+    //Format_ARGB32 copy of the committed image, if committedCache isn't one
+    QImage normalizedSource;
+
+    //Last proxySource(), kept until the next commit()
+    QImage proxy;
+
+    //Images the effects write into, reused between preview ticks
+    ScratchPool scratch;
 };
 
 #endif// IMAGE_H
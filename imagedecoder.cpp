@@ -0,0 +1,88 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Decodes image files away from the GUI thread, for opening large
+ * files progressively.
+ *****************************************************************************/
+
+#include "imagedecoder.h"
+#include "scanline.h"
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QThreadPool>
+
+/**************************************************************************//**
+ * @brief Constructor.  The decode starts once the decoder is given to
+ * pool().
+ *
+ * @param[in] fileName - The file to decode
+ *****************************************************************************/
+ImageDecoder::ImageDecoder(const QString &fileName)
+    : fileName(fileName)
+{
+    setAutoDelete(true);
+}
+
+/**************************************************************************//**
+ * @brief Decodes the file and posts the result.  Runs on a pool thread.
+ *****************************************************************************/
+void ImageDecoder::run()
+{
+    QImageReader reader(fileName);
+    QImage image = reader.read();
+    QString error = image.isNull() ? reader.errorString() : QString();
+
+    //Converted here, so the GUI thread only has to tile it
+    image = Scanline::stored(image);
+
+    emit decoded(fileName, image, error);
+}
+
+/**************************************************************************//**
+ * @brief Returns whether a file should be opened progressively: it has more
+ * than ProgressivePixels pixels and its reader decodes a scaled size
+ * directly.  Other files are decoded at once, as a preview would take as
+ * long as the full image.
+ *
+ * @param[in] fileName - The file to open
+ *****************************************************************************/
+bool ImageDecoder::isProgressive(const QString &fileName)
+{
+    QImageReader reader(fileName);
+    QSize size = reader.size();
+
+    return size.isValid() &&
+           qint64(size.width()) * size.height() > ProgressivePixels &&
+           reader.supportsOption(QImageIOHandler::ScaledSize);
+}
+
+/**************************************************************************//**
+ * @brief Decodes a scaled down copy of the file, keeping its aspect ratio.
+ * A file that already fits bound is decoded at its own size.
+ *
+ * @param[in] fileName - The file to decode
+ * @param[in] bound - Largest size the copy may have, e.g. the viewport
+ *
+ * @returns The copy in the format Image stores it in, null if the file
+ * couldn't be read
+ *****************************************************************************/
+QImage ImageDecoder::preview(const QString &fileName, const QSize &bound)
+{
+    QImageReader reader(fileName);
+    QSize size = reader.size();
+
+    if(size.isValid() && (size.width() > bound.width() || size.height() > bound.height()))
+        reader.setScaledSize(size.scaled(bound, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)));
+
+    return Scanline::stored(reader.read());
+}
+
+/**************************************************************************//**
+ * @brief Returns the pool the decoders run on.  It is separate from the
+ * pool of the BandScheduler, so a decode never holds up an effect.
+ *****************************************************************************/
+QThreadPool *ImageDecoder::pool()
+{
+    static QThreadPool decoders;
+    return &decoders;
+}
@@ -0,0 +1,60 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ImageDecoder class.
+ *****************************************************************************/
+
+#ifndef IMAGEDECODER_H
+#define IMAGEDECODER_H
+
+#include <QImage>
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+
+class QThreadPool;
+
+/**************************************************************************//**
+ * @brief Decodes an image file at full resolution on a worker thread.
+ *
+ * The decoder runs on pool() and posts the result with decoded(), already
+ * in the format Image stores it in.  It deletes itself when it is done;
+ * whoever it was connected to may go away before that, which only
+ * disconnects the signal.
+ *
+ * preview() is the fast part of a progressive open: a decode sized to the
+ * view, which the JPEG reader does with DCT scaling instead of decoding
+ * every pixel and scaling down.
+ *****************************************************************************/
+class ImageDecoder : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    explicit ImageDecoder(const QString &fileName);
+
+    void run();
+
+    //Whether fileName is large enough, and its format able, to be shown
+    //from preview() first
+    static bool isProgressive(const QString &fileName);
+
+    //The image scaled down to fit bound, decoded at that size if the format
+    //can do it
+    static QImage preview(const QString &fileName, const QSize &bound);
+
+    //Threads the full decodes run on
+    static QThreadPool *pool();
+
+    //Images with more pixels than this are opened progressively
+    static const int ProgressivePixels = 4 * 1024 * 1024;
+
+signals:
+    //image is null if the file couldn't be read, error says why
+    void decoded(const QString &fileName, const QImage &image, const QString &error);
+
+private:
+    QString fileName;
+};
+
+#endif // IMAGEDECODER_H
@@ -0,0 +1,146 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Graphics item that paints an Image, turning the parts of it in view
+ * into pixmap tiles only when the scene repaints them.
+ *****************************************************************************/
+
+#include "imageitem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+/**************************************************************************//**
+ * @brief Constructor.  The item follows every change to the image.
+ *
+ * @param[in] image - Image to show, must outlive the item
+ * @param[in] parent - Parent item
+ *****************************************************************************/
+ImageItem::ImageItem(const Image *image, QGraphicsItem *parent)
+    : QGraphicsObject(parent), image(image), imageSize(image->size())
+{
+    connect(image, SIGNAL(changed(QRect)), this, SLOT(imageChanged(QRect)));
+
+    //paint() only draws the exposed tiles, or part of a pyramid level
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+/**************************************************************************//**
+ * @brief Returns the area of the image, in item coordinates.
+ *****************************************************************************/
+QRectF ImageItem::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), imageSize);
+}
+
+/**************************************************************************//**
+ * @brief Paints the image and the preview frames over it.  This is where the
+ * exposed tiles that changed get converted to pixmaps, or where the pyramid
+ * level the view is zoomed out to catches up with the image.
+ *****************************************************************************/
+void ImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    //A frame over the whole image hides it
+    bool covered = false;
+    for(int i = 0; i < previews.size(); i++)
+        covered = covered || previews[i].first == boundingRect().toRect();
+
+    qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()) *
+                  painter->device()->devicePixelRatio();
+    int level = ImagePyramid::levelFor(scale, image->size());
+
+    if(!covered && !image->isNull() && 0 == level)
+    {
+        tiles.draw(painter, option->exposedRect & boundingRect(), image->toImage());
+    }
+    else if(!covered && !image->isNull())
+    {
+        //A pixel of the level covers 2^level pixels of the image each way
+        const QPixmap &pixmap = pyramid.pixmap(level, image->toImage());
+        QRectF exposed = option->exposedRect & boundingRect();
+        qreal factor = 1 << level;
+        QRectF source(exposed.topLeft() / factor, exposed.size() / factor);
+
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawPixmap(exposed, pixmap, source);
+        painter->restore();
+    }
+
+    if(!previews.isEmpty())
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+
+    for(int i = 0; i < previews.size(); i++)
+        painter->drawPixmap(previews[i].first, previews[i].second, previews[i].second.rect());
+}
+
+/**************************************************************************//**
+ * @brief Draws a preview frame over an area of the image.  The frame is
+ * stretched over the area, so a frame rendered at the resolution of the view
+ * looks the same as a full size one.  Frames under the new one are dropped.
+ *
+ * @param[in] area - Part of the image the frame shows, in image pixels
+ * @param[in] frame - The preview, any size
+ *****************************************************************************/
+void ImageItem::addPreview(const QRect &area, const QImage &frame)
+{
+    for(int i = previews.size() - 1; i >= 0; i--)
+    {
+        if(area.contains(previews[i].first))
+            previews.removeAt(i);
+    }
+
+    previews.append(qMakePair(area, QPixmap::fromImage(frame)));
+    update(area);
+}
+
+/**************************************************************************//**
+ * @brief Goes back to showing the image.
+ *****************************************************************************/
+void ImageItem::clearPreview()
+{
+    if(previews.isEmpty())
+        return;
+
+    previews.clear();
+    update();
+}
+
+/**************************************************************************//**
+ * @brief Stands in for an image that is not loaded yet: the item takes the
+ * size the image will have and shows a scaled down decode of it over that
+ * area.  It goes when the image arrives and commits, like any preview.
+ *
+ * @param[in] size - Size of the image being loaded
+ * @param[in] frame - Scaled down copy of it
+ *****************************************************************************/
+void ImageItem::setPlaceholder(const QSize &size, const QImage &frame)
+{
+    prepareGeometryChange();
+    imageSize = size;
+    addPreview(QRect(QPoint(0, 0), size), frame);
+}
+
+/**************************************************************************//**
+ * @brief Schedules a repaint of the part of the image that changed, drops
+ * the tiles under it and marks it stale in the pyramid.  The scene is told first if the size
+ * changed, so it can update its index.
+ *
+ * @param[in] area - Part of the image that changed
+ *****************************************************************************/
+void ImageItem::imageChanged(const QRect &area)
+{
+    tiles.invalidate(image->size(), area);
+    pyramid.invalidate(image->size(), area);
+
+    if(image->size() != imageSize)
+    {
+        prepareGeometryChange();
+        imageSize = image->size();
+        update();
+        return;
+    }
+
+    update(area);
+}
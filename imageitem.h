@@ -0,0 +1,65 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ImageItem class.
+ *****************************************************************************/
+
+#ifndef IMAGEITEM_H
+#define IMAGEITEM_H
+
+#include <QGraphicsObject>
+#include <QList>
+#include <QPair>
+#include "image.h"
+#include "imagepyramid.h"
+#include "pixmaptiles.h"
+
+/**************************************************************************//**
+ * @brief Shows an Image in a QGraphicsScene.
+ *
+ * Unlike QGraphicsPixmapItem it does not hold one pixmap of the whole image.
+ * It keeps PixmapTiles instead: when the image changes only the tiles under
+ * the change are dropped and the item is scheduled for a repaint of that
+ * area, and a tile is only made again when it is painted.  Tiles out of view
+ * cost nothing until the view is scrolled to them.
+ *
+ * Zoomed out to half size or less, it draws from an ImagePyramid level
+ * instead, the one closest to the scale of the view, and only the part of
+ * it that is exposed.  A repaint then scales down by 2 at most, and the
+ * image itself doesn't have to be a pixmap at all.  Changes to the image
+ * only redo the pyramid where they happened.
+ *
+ * While an effect dialog is open the item draws preview frames over the
+ * image.  A frame covers the whole image or a part of it, and may have a
+ * lower resolution than the image (see MdiChild::updatePreview()); it is
+ * stretched over its area.
+ *****************************************************************************/
+class ImageItem : public QGraphicsObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImageItem(const Image *image, QGraphicsItem *parent = NULL);
+
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
+    //Shows frame over area of the image until clearPreview()
+    void addPreview(const QRect &area, const QImage &frame);
+    void clearPreview();
+
+    //Shows frame stretched to size while the image is still being loaded
+    void setPlaceholder(const QSize &size, const QImage &frame);
+
+public slots:
+    void imageChanged(const QRect &area);
+
+private:
+    const Image *image;
+    QSize imageSize;  //Size of the image as of the last imageChanged()
+    QList<QPair<QRect, QPixmap> > previews;  //Frames drawn over the image
+    PixmapTiles tiles;                       //For drawing it at full size
+    ImagePyramid pyramid;                    //For drawing it zoomed out
+};
+
+#endif // IMAGEITEM_H
@@ -0,0 +1,188 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Mipmaps of the image a view shows zoomed out, made when they are
+ * first drawn and redone only where the image changed.
+ *****************************************************************************/
+
+#include "imagepyramid.h"
+#include "bandscheduler.h"
+#include "scanline.h"
+#include <QPainter>
+
+/**************************************************************************//**
+ * @brief Constructor.  No level is made until pixmap() asks for it.
+ *****************************************************************************/
+ImagePyramid::ImagePyramid()
+{
+}
+
+/**************************************************************************//**
+ * @brief Marks part of the image changed.  Pixel (x, y) of the image is
+ * under pixel (x >> k, y >> k) of level k, so that is what goes stale.
+ *
+ * @param[in] size - Size of the image now
+ * @param[in] area - Part of the image that changed
+ *****************************************************************************/
+void ImagePyramid::invalidate(const QSize &size, const QRect &area)
+{
+    if(size != imageSize)
+    {
+        imageSize = size;
+        levels.clear();
+        return;
+    }
+
+    QRect changed = area & QRect(QPoint(0, 0), size);
+    if(changed.isEmpty())
+        return;
+
+    for(int k = 1; k <= levels.size(); k++)
+    {
+        QRect stale(QPoint(changed.left() >> k, changed.top() >> k),
+                    QPoint(changed.right() >> k, changed.bottom() >> k));
+        levels[k - 1].stale += stale;
+    }
+}
+
+/**************************************************************************//**
+ * @brief Returns the level to draw the image from at a scale.  Below that
+ * level drawing would scale down by more than 2, which is where smooth
+ * scaling starts dropping pixels and costs more than the level does.
+ *
+ * @param[in] scale - Screen pixels per image pixel
+ * @param[in] size - Size of the image
+ *****************************************************************************/
+int ImagePyramid::levelFor(qreal scale, const QSize &size)
+{
+    int level = 0;
+    while(scale * (2 << level) <= 1.0)
+    {
+        //The next level would be smaller than the minimum
+        if((size.width() >> (level + 1)) < MinimumSize ||
+           (size.height() >> (level + 1)) < MinimumSize)
+            break;
+
+        level++;
+    }
+
+    return level;
+}
+
+/**************************************************************************//**
+ * @brief Returns a level as a pixmap.  The levels under it are made or
+ * brought up to date first, the lowest one from source.
+ *
+ * @param[in] level - Level to return, 1 or more
+ * @param[in] source - The image, as it was when invalidate() was last called
+ *****************************************************************************/
+const QPixmap &ImagePyramid::pixmap(int level, const QImage &source)
+{
+    if(source.size() != imageSize)
+        invalidate(source.size(), source.rect());
+
+    //Every level starts out stale as a whole
+    while(levels.size() < level)
+    {
+        QSize below = levels.isEmpty() ? imageSize : levels.last().image.size();
+
+        Level next;
+        next.image = QImage((below.width() + 1) / 2, (below.height() + 1) / 2, QImage::Format_ARGB32);
+        next.stale = next.image.rect();
+        levels.append(next);
+    }
+
+    for(int k = 1; k <= level; k++)
+        update(k, source);
+
+    return levels[level - 1].pixmap;
+}
+
+/**************************************************************************//**
+ * @brief Redoes the stale pixels of a level from the level below it, and
+ * copies them into its pixmap.  Only a new level converts the whole image
+ * to a pixmap.
+ *
+ * @param[in] level - Level to update, the ones below are up to date
+ * @param[in] source - The image, for level 1
+ *****************************************************************************/
+void ImagePyramid::update(int level, const QImage &source)
+{
+    Level &current = levels[level - 1];
+    if(current.stale.isEmpty())
+        return;
+
+    //Only a palette image is converted here, the rest is Format_ARGB32
+    QImage below = (1 == level) ? Scanline::normalized(source) : levels[level - 2].image;
+    foreach(const QRect &rect, current.stale.rects())
+        downsample(below, current.image, rect);
+
+    if(current.pixmap.size() != current.image.size())
+    {
+        current.pixmap = QPixmap::fromImage(current.image);
+    }
+    else
+    {
+        QPainter painter(&current.pixmap);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        foreach(const QRect &rect, current.stale.rects())
+            painter.drawImage(rect, current.image, rect);
+    }
+
+    current.stale = QRegion();
+}
+
+/**************************************************************************//**
+ * @brief Averages 2x2 pixels of one level into a pixel of the next.  The
+ * colours are weighted by alpha, so transparent pixels don't darken their
+ * neighbours.  A level with an odd size repeats its last row or column.
+ *
+ * @param[in] from - The level below, Format_ARGB32
+ * @param[in,out] to - The level to write, Format_ARGB32
+ * @param[in] area - Pixels of to to write
+ *****************************************************************************/
+void ImagePyramid::downsample(const QImage &from, QImage &to, const QRect &area)
+{
+    const QRect rect = area & to.rect();
+    if(rect.isEmpty())
+        return;
+
+    const int lastX = from.width() - 1;
+    const int lastY = from.height() - 1;
+
+    //Detach here, before any band runs, so the threads never do
+    uchar *outBits = to.bits();
+    const int outStride = to.bytesPerLine();
+
+    BandScheduler::run(rect.height(), 0, [&](const Band &band) {
+        for(int y = rect.top() + band.first; y < rect.top() + band.last; y++)
+        {
+            const QRgb *top = Scanline::constRow(from, qMin(2 * y, lastY));
+            const QRgb *bottom = Scanline::constRow(from, qMin(2 * y + 1, lastY));
+            QRgb *out = reinterpret_cast<QRgb *>(outBits + size_t(y) * outStride);
+
+            for(int x = rect.left(); x <= rect.right(); x++)
+            {
+                const int left = qMin(2 * x, lastX);
+                const int right = qMin(2 * x + 1, lastX);
+                const QRgb pixels[4] = { top[left], top[right], bottom[left], bottom[right] };
+
+                int alpha = 0, red = 0, green = 0, blue = 0;
+                for(int i = 0; i < 4; i++)
+                {
+                    const int a = qAlpha(pixels[i]);
+                    alpha += a;
+                    red += qRed(pixels[i]) * a;
+                    green += qGreen(pixels[i]) * a;
+                    blue += qBlue(pixels[i]) * a;
+                }
+
+                if(0 == alpha)
+                    out[x] = qRgba(0, 0, 0, 0);
+                else
+                    out[x] = qRgba((red + alpha / 2) / alpha, (green + alpha / 2) / alpha,
+                                   (blue + alpha / 2) / alpha, (alpha + 2) / 4);
+            }
+        }
+    });
+}
@@ -0,0 +1,64 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ImagePyramid class.
+ *****************************************************************************/
+
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <QImage>
+#include <QPixmap>
+#include <QRegion>
+#include <QVector>
+
+/**************************************************************************//**
+ * @brief Power-of-two mipmaps of an image, for drawing it zoomed out.
+ *
+ * Level k is the image scaled down by 2^k, each pixel the average of the
+ * 2x2 pixels of level k - 1 under it.  Level 0 is the image itself and is
+ * not kept here.  A level is only made when it is first drawn, from the
+ * level below it.
+ *
+ * invalidate() takes the area of the image that changed and marks the
+ * pixels of every level it maps to as stale; pixmap() redoes just those,
+ * level by level, and copies them into the pixmap of the level.  An edit
+ * zoomed out therefore costs about its own area, not the image.
+ *****************************************************************************/
+class ImagePyramid
+{
+public:
+    ImagePyramid();
+
+    //Marks area of an image of size size changed.  A new size drops every
+    //level.
+    void invalidate(const QSize &size, const QRect &area);
+
+    //The level to draw an image of size size from at scale: the smallest
+    //one that is still at least as large as the image on screen, 0 for the
+    //image itself
+    static int levelFor(qreal scale, const QSize &size);
+
+    //Level level (1 or more) as a pixmap, brought up to date from source,
+    //the image as it is now
+    const QPixmap &pixmap(int level, const QImage &source);
+
+    //Levels are not made smaller than this on both sides
+    static const int MinimumSize = 32;
+
+private:
+    struct Level
+    {
+        QImage image;   //Format_ARGB32
+        QPixmap pixmap; //What the view draws, a copy of image
+        QRegion stale;  //Pixels image and pixmap still have to redo
+    };
+
+    void update(int level, const QImage &source);
+    static void downsample(const QImage &from, QImage &to, const QRect &area);
+
+    QSize imageSize;
+    QVector<Level> levels;  //levels[k - 1] is level k
+};
+
+#endif // IMAGEPYRAMID_H
@@ -0,0 +1,103 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Saves images away from the GUI thread, replacing files atomically.
+ *****************************************************************************/
+
+#include "imagesaver.h"
+#include "pngwriter.h"
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QThreadPool>
+
+/**************************************************************************//**
+ * @brief Constructor.  The save starts once the saver is given to pool().
+ *
+ * @param[in] fileName - The file to write
+ * @param[in] image - Snapshot of the document to write into it
+ * @param[in] done - Released after saved() is emitted, may be NULL
+ *****************************************************************************/
+ImageSaver::ImageSaver(const QString &fileName, const QImage &image, QSemaphore *done)
+    : fileName(fileName), image(image), done(done)
+{
+    setAutoDelete(true);
+}
+
+/**************************************************************************//**
+ * @brief Writes the file and posts the result.  Runs on a pool thread.
+ *****************************************************************************/
+void ImageSaver::run()
+{
+    QString error;
+    write(fileName, image, QByteArray(), &error);
+
+    //The snapshot isn't needed anymore, don't hold it until the delete
+    image = QImage();
+
+    emit saved(fileName, error);
+
+    //Only now is the result posted for whoever waits on done
+    if(done)
+        done->release();
+}
+
+/**************************************************************************//**
+ * @brief Encodes an image into a temporary file and renames it over the
+ * target.  Safe to call from any thread.
+ *
+ * @param[in] fileName - The file to write
+ * @param[in] image - The image
+ * @param[in] format - Format to write, empty to pick it from the suffix
+ * @param[out] error - Why the file couldn't be written, may be NULL
+ *
+ * @returns true if the file was replaced
+ *****************************************************************************/
+bool ImageSaver::write(const QString &fileName, const QImage &image,
+                       const QByteArray &format, QString *error)
+{
+    const QByteArray type = format.isEmpty() ? QFileInfo(fileName).suffix().toLower().toLatin1()
+                                             : format.toLower();
+
+    //PngWriter deflates on all cores; palette images are left to Qt, which
+    //keeps them indexed
+    if(type == "png" && image.depth() == 32)
+        return PngWriter::write(fileName, image, error);
+
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        if(error)
+            *error = file.errorString();
+        return false;
+    }
+
+    //A writer on a device can't see the file name, so it's given the format
+    QImageWriter writer(&file, type);
+    if(!writer.write(image))
+    {
+        if(error)
+            *error = writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+
+    if(!file.commit())
+    {
+        if(error)
+            *error = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Returns the pool the savers run on.  Saving all documents encodes
+ * as many files at once as it has threads.
+ *****************************************************************************/
+QThreadPool *ImageSaver::pool()
+{
+    static QThreadPool savers;
+    return &savers;
+}
@@ -0,0 +1,60 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ImageSaver class.
+ *****************************************************************************/
+
+#ifndef IMAGESAVER_H
+#define IMAGESAVER_H
+
+#include <QImage>
+#include <QObject>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QString>
+
+class QThreadPool;
+
+/**************************************************************************//**
+ * @brief Encodes and writes an image file on a worker thread.
+ *
+ * The saver is given a snapshot of the image, so the document can be edited
+ * while it encodes; QImage copies on write, so taking the snapshot costs
+ * nothing until the document changes.  It runs on pool(), posts the result
+ * with saved() and deletes itself.  A semaphore handed in lets the owner
+ * wait for its own save without waiting for the rest of the pool.
+ *
+ * write() goes through a QSaveFile: the image is written to a temporary
+ * file next to the target, which is renamed over it only once everything
+ * was written.  A failed or interrupted save leaves the old file intact.
+ * PNG files are encoded by PngWriter, which deflates on all cores.
+ *****************************************************************************/
+class ImageSaver : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    //done, if given, is released once saved() has been emitted
+    ImageSaver(const QString &fileName, const QImage &image, QSemaphore *done = NULL);
+
+    void run();
+
+    //Writes image to fileName atomically, in the format its suffix names
+    //unless format is given
+    static bool write(const QString &fileName, const QImage &image,
+                      const QByteArray &format = QByteArray(), QString *error = NULL);
+
+    //Threads the saves run on, one file each
+    static QThreadPool *pool();
+
+signals:
+    //error is empty if the file was written
+    void saved(const QString &fileName, const QString &error);
+
+private:
+    QString fileName;
+    QImage image;
+    QSemaphore *done;
+};
+
+#endif // IMAGESAVER_H
@@ -81,7 +81,13 @@ Help: About
  * @par Usage
    @verbatim
 $ PhotoEdit
+$ PhotoEdit --batch -o <directory> [-p <pipeline>] [-e <effect>]... [-j <jobs>] [--memory <MB>] [--format <format>] [--png-level <level>] <inputs...>
    @endverbatim
+ * The second form runs without a window: every input file (or every image in
+ * an input directory) gets the effects in the order given, e.g.
+ * -e sharpen -e "gamma(1.8)" -e "resize(800, 600)", and is written to the
+ * output directory.  -p runs a macro saved from the Macro menu first.  See
+ * BatchProcessor and Pipeline.
  *
  * @par Compiling Instructions
  *     Files Needed: dialog.h, image.h, mainwindow.h, mdichild.h, dialog.cpp, image.cpp, main.cpp, mainwindow.cpp, mdichild.cpp
@@ -161,13 +167,24 @@ $ ./PhotoEdit
 #include <QApplication>
 
 #include "mainwindow.h"
+#include "batchprocessor.h"
 
 int main(int argc, char *argv[])
 {
+    //Headless, so no windows and no QApplication
+    if(BatchProcessor::isBatch(argc, argv))
+    {
+        QCoreApplication app(argc, argv);
+        return BatchProcessor::run(app.arguments());
+    }
+
     Q_INIT_RESOURCE(PhotoEdit);
 
     QApplication app(argc, argv);
     MainWindow mainWin;
     mainWin.show();
+
+    //Files given on the command line open like a multi-select in File Open
+    mainWin.openFiles(app.arguments().mid(1));
     return app.exec();
 }
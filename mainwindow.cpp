@@ -54,6 +54,11 @@
 #include "mainwindow.h"
 #include "mdichild.h"
 #include "dialog.h"
+#include "bandscheduler.h"
+#include "undohistory.h"
+#include "pngwriter.h"
+#include "decodequeue.h"
+#include "imagedecoder.h"
 
 
 MainWindow::MainWindow()
@@ -68,6 +73,11 @@ MainWindow::MainWindow()
     windowMapper = new QSignalMapper(this);
     connect(windowMapper, SIGNAL(mapped(QWidget*)),this, SLOT(setActiveSubWindow(QWidget*)));
 
+    decodeQueue = new DecodeQueue(this);
+    connect(decodeQueue, SIGNAL(decoded(QString,QImage,QString)), this, SLOT(showDecoded(QString,QImage,QString)));
+    connect(decodeQueue, SIGNAL(progress(int,int)), this, SLOT(showOpenProgress(int,int)));
+    setAcceptDrops(true);
+
     createActions();
     createMenus();
     createToolBars();
@@ -89,6 +99,43 @@ MainWindow::MainWindow()
  *****************************************************************************/
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    //Several modified documents are asked about once and saved in parallel,
+    //instead of one prompt and one save after the other
+    QList<MdiChild *> modified;
+    foreach (QMdiSubWindow *window, mdiArea->subWindowList()) {
+        MdiChild *child = qobject_cast<MdiChild *>(window->widget());
+        if (child->isModified())
+            modified.append(child);
+    }
+
+    if (modified.size() > 1) {
+        QMessageBox::StandardButton ret;
+        ret = QMessageBox::warning(this, tr("MDI"),
+                     tr("%1 documents have been modified.\n"
+                        "Do you want to save your changes?").arg(modified.size()),
+                     QMessageBox::SaveAll | QMessageBox::Discard | QMessageBox::Cancel);
+        if (ret == QMessageBox::Cancel) {
+            event->ignore();
+            return;
+        }
+        else if (ret == QMessageBox::SaveAll) {
+            //The windows must see their saves finished, or each would ask
+            //again as it closes
+            saveAll();
+            foreach (MdiChild *child, modified) {
+                if (!child->waitForSave()) {
+                    event->ignore();
+                    return;
+                }
+            }
+        }
+        else {
+            foreach (MdiChild *child, modified)
+                child->setModified(false);
+        }
+    }
+
+    //Each window waits for its save before it closes
     mdiArea->closeAllSubWindows();
     if (mdiArea->currentSubWindow()) {
         event->ignore();
@@ -107,6 +154,7 @@ void MainWindow::updateMenus()
 {
 
     bool hasMdiChild = (activeMdiChild() != 0);
+    bool canEdit = hasMdiChild && !activeMdiChild()->isLoading();  //Not while opening
     if(hasMdiChild)
     {
         connect(activeMdiChild(), SIGNAL(areaSelectedChanged()), this, SLOT(updateClipboardItems()));
@@ -114,9 +162,11 @@ void MainWindow::updateMenus()
         undoAct->setEnabled(activeMdiChild()->undoEnabled());
         redoAct->setEnabled(activeMdiChild()->redoEnabled());
     }
-    saveAct->setEnabled(hasMdiChild);
-    saveAsAct->setEnabled(hasMdiChild);
-    revertAct->setEnabled(hasMdiChild);
+    saveAct->setEnabled(canEdit);
+    saveAsAct->setEnabled(canEdit);
+    saveAllAct->setEnabled(hasMdiChild);
+    revertAct->setEnabled(canEdit);
+    journalAct->setEnabled(canEdit);
     closeAct->setEnabled(hasMdiChild);
     closeAllAct->setEnabled(hasMdiChild);
     tileAct->setEnabled(hasMdiChild);
@@ -134,11 +184,12 @@ void MainWindow::updateClipboardItems()
 {
     //qDebug() << "MainWindow::updateClipboardItems updated";
     bool hasMdiChild  = (activeMdiChild() != 0);
+    bool canEdit = hasMdiChild && !activeMdiChild()->isLoading();  //Not while opening
 #ifndef QT_NO_CLIPBOARD
-    copyAct->setEnabled(hasMdiChild && activeMdiChild()->isAreaSelected());
-    cutAct->setEnabled(hasMdiChild && activeMdiChild()->isAreaSelected());
-    pasteAct->setEnabled(hasMdiChild && !QApplication::clipboard()->image().isNull());
-    cropAct->setEnabled(hasMdiChild && activeMdiChild()->isAreaSelected());
+    copyAct->setEnabled(canEdit && activeMdiChild()->isAreaSelected());
+    cutAct->setEnabled(canEdit && activeMdiChild()->isAreaSelected());
+    pasteAct->setEnabled(canEdit && !QApplication::clipboard()->image().isNull());
+    cropAct->setEnabled(canEdit && activeMdiChild()->isAreaSelected());
 #endif
 }
 
@@ -155,21 +206,22 @@ void MainWindow::updateUndoRedo()
 void MainWindow::updateImageMenu()
 {
     bool hasMdiChild = (activeMdiChild() != 0);
+    bool canEdit = hasMdiChild && !activeMdiChild()->isLoading();  //Not while opening
 
     imageMenu->addAction(cropAct);
     //cropAct->setEnabled(hasMdiChild);
 
     imageMenu->addAction(imgResizeAct);
-    imgResizeAct->setEnabled(hasMdiChild);
+    imgResizeAct->setEnabled(canEdit);
 
     imageMenu->addAction(rotateAct);
-    rotateAct->setEnabled(hasMdiChild);
+    rotateAct->setEnabled(canEdit);
 
     imageMenu->addAction(balanceAct);
-    balanceAct->setEnabled(hasMdiChild);
+    balanceAct->setEnabled(canEdit);
 
     imageMenu->addAction(propertiesAct);
-    propertiesAct->setEnabled(hasMdiChild);
+    propertiesAct->setEnabled(canEdit);
 
 }
 
@@ -179,45 +231,61 @@ void MainWindow::updateImageMenu()
 void MainWindow::updateEffectsMenu()
 {
     bool hasMdiChild = (activeMdiChild() != 0);
+    bool canEdit = hasMdiChild && !activeMdiChild()->isLoading();  //Not while opening
 
     effectsMenu->addAction(grayScaleAct);
-    grayScaleAct->setEnabled(hasMdiChild);
+    grayScaleAct->setEnabled(canEdit);
 
     effectsMenu->addAction(sharpenAct);
-    sharpenAct->setEnabled(hasMdiChild);
+    sharpenAct->setEnabled(canEdit);
 
     effectsMenu->addAction(softenAct);
-    softenAct->setEnabled(hasMdiChild);
+    softenAct->setEnabled(canEdit);
 
     effectsMenu->addAction(negativeAct);
-    negativeAct->setEnabled(hasMdiChild);
+    negativeAct->setEnabled(canEdit);
 
     effectsMenu->addAction(despeckleAct);
-    despeckleAct->setEnabled(hasMdiChild);
+    despeckleAct->setEnabled(canEdit);
 
     effectsMenu->addAction(posterizeAct);
-    posterizeAct->setEnabled(hasMdiChild);
+    posterizeAct->setEnabled(canEdit);
+
+    effectsMenu->addAction(posterizePaletteAct);
+    posterizePaletteAct->setEnabled(canEdit);
 
     effectsMenu->addAction(edgeAct);
-    edgeAct->setEnabled(hasMdiChild);
+    edgeAct->setEnabled(canEdit);
 
     effectsMenu->addAction(embossAct);
-    embossAct->setEnabled(hasMdiChild);
+    embossAct->setEnabled(canEdit);
 
     effectsMenu->addAction(gammaAct);
-    gammaAct->setEnabled(hasMdiChild);
+    gammaAct->setEnabled(canEdit);
 
     effectsMenu->addAction(brightnessAct);
-    brightnessAct->setEnabled(hasMdiChild);
+    brightnessAct->setEnabled(canEdit);
 
     effectsMenu->addAction(binaryThresholdAct);
-    binaryThresholdAct->setEnabled(hasMdiChild);
+    binaryThresholdAct->setEnabled(canEdit);
 
     effectsMenu->addAction(contrastAct);
-    contrastAct->setEnabled(hasMdiChild);
+    contrastAct->setEnabled(canEdit);
 
 }
 
+/**************************************************************************//**
+ * @brief Enables the macro actions that have something to work on.
+ *****************************************************************************/
+void MainWindow::updateMacroMenu()
+{
+    bool hasMdiChild = (activeMdiChild() != 0);
+    bool canEdit = hasMdiChild && !activeMdiChild()->isLoading();  //Not while opening
+
+    runMacroAct->setEnabled(canEdit && !macro.isEmpty() && !recordMacroAct->isChecked());
+    saveMacroAct->setEnabled(!macro.isEmpty());
+}
+
 /**************************************************************************//**
  * @brief Creates/Updates menu that is used for manipulating windows.
  *****************************************************************************/
@@ -277,6 +345,9 @@ MdiChild *MainWindow::createMdiChild()
             copyAct, SLOT(setEnabled(bool)));
 #endif
     connect(child, SIGNAL(zoomChanged()), this, SLOT(handleZoomChanged()));
+    connect(child, SIGNAL(operationCommitted(QString)), this, SLOT(recordOperation(QString)));
+    connect(child, SIGNAL(loadingFinished()), this, SLOT(updateMenus()));
+    connect(child, SIGNAL(saveFinished(QString,bool)), this, SLOT(showSaved(QString,bool)));
 
     return child;
 }
@@ -308,6 +379,22 @@ void MainWindow::createActions()
     saveAsAct->setStatusTip(tr("Save the document under a new name"));
     connect(saveAsAct, SIGNAL(triggered()), this, SLOT(saveAs()));
 
+    saveAllAct = new QAction(tr("Save A&ll"), this);
+    saveAllAct->setStatusTip(tr("Save all modified documents"));
+    connect(saveAllAct, SIGNAL(triggered()), this, SLOT(saveAll()));
+
+    threadsAct = new QAction(tr("Effect &Threads..."), this);
+    threadsAct->setStatusTip(tr("Set how many cores the image effects use"));
+    connect(threadsAct, SIGNAL(triggered()), this, SLOT(threadsDialog()));
+
+    pngLevelAct = new QAction(tr("&PNG Compression..."), this);
+    pngLevelAct->setStatusTip(tr("Trade saving speed for the size of PNG files"));
+    connect(pngLevelAct, SIGNAL(triggered()), this, SLOT(pngLevelDialog()));
+
+    historyAct = new QAction(tr("Undo &History Memory..."), this);
+    historyAct->setStatusTip(tr("Set how much memory each document may use to undo changes"));
+    connect(historyAct, SIGNAL(triggered()), this, SLOT(historyDialog()));
+
     exitAct = new QAction(tr("E&xit"), this);
     exitAct->setShortcuts(QKeySequence::Quit);
     exitAct->setStatusTip(tr("Exit the application"));
@@ -346,6 +433,10 @@ void MainWindow::createActions()
     connect(redoAct, SIGNAL(triggered()), this, SLOT(redo()));
     redoAct->setEnabled(false); //Initial creation
 
+    journalAct = new QAction(tr("Show &History..."), this);
+    journalAct->setStatusTip(tr("List the operations the current window can undo and redo"));
+    connect(journalAct, SIGNAL(triggered()), this, SLOT(journal()));
+
     revertAct = new QAction(tr("Revert"), this);
     revertAct->setStatusTip(tr("Undo all changes"));
     connect(revertAct, SIGNAL(triggered()), this, SLOT(revert()));
@@ -414,8 +505,8 @@ void MainWindow::createActions()
     rotateAct->setStatusTip(tr(""));
     connect(rotateAct, SIGNAL(triggered()), this, SLOT(rotateDialog()));
 
-    balanceAct = new QAction(tr("Balance (Not Implemented)"), this);
-    balanceAct->setStatusTip(tr(""));
+    balanceAct = new QAction(tr("Balance"), this);
+    balanceAct->setStatusTip(tr("Adjust brightness, contrast and gamma together"));
     connect(balanceAct, SIGNAL(triggered()), this, SLOT(balanceDialog()));
 
     propertiesAct = new QAction(tr("Properties"), this);
@@ -441,13 +532,17 @@ void MainWindow::createActions()
     negativeAct->setStatusTip(tr(""));
     connect(negativeAct, SIGNAL(triggered()), this, SLOT(negative()));
 
-    despeckleAct = new QAction(tr("Despeckle (Not Implemented)"), this);
+    despeckleAct = new QAction(tr("Despeckle"), this);
     despeckleAct->setStatusTip(tr(""));
     connect(despeckleAct, SIGNAL(triggered()), this, SLOT(despeckleDialog()));
 
-    posterizeAct = new QAction(tr("Posterize (Not Implemented)"), this);
-    posterizeAct->setStatusTip(tr(""));
-    connect(posterizeAct, SIGNAL(triggered()), this, SLOT(posterize()));
+    posterizeAct = new QAction(tr("Posterize"), this);
+    posterizeAct->setStatusTip(tr("Round every channel to a few levels"));
+    connect(posterizeAct, SIGNAL(triggered()), this, SLOT(posterizeDialog()));
+
+    posterizePaletteAct = new QAction(tr("Posterize (Adaptive Palette)"), this);
+    posterizePaletteAct->setStatusTip(tr("Reduce the image to a palette that fits it"));
+    connect(posterizePaletteAct, SIGNAL(triggered()), this, SLOT(posterizePaletteDialog()));
 
     edgeAct = new QAction(tr("Edge"), this);
     edgeAct->setStatusTip(tr(""));
@@ -472,6 +567,26 @@ void MainWindow::createActions()
     contrastAct = new QAction(tr("Contrast"), this);
     contrastAct->setStatusTip(tr(""));
     connect(contrastAct, SIGNAL(triggered()), this, SLOT(contrastDialog()));
+
+
+
+    //================Macro Actions================
+    recordMacroAct = new QAction(tr("&Record"), this);
+    recordMacroAct->setCheckable(true);
+    recordMacroAct->setStatusTip(tr("Record the effects applied from now on as a macro"));
+    connect(recordMacroAct, SIGNAL(toggled(bool)), this, SLOT(recordMacro(bool)));
+
+    runMacroAct = new QAction(tr("R&un"), this);
+    runMacroAct->setStatusTip(tr("Apply the macro to the current image"));
+    connect(runMacroAct, SIGNAL(triggered()), this, SLOT(runMacro()));
+
+    saveMacroAct = new QAction(tr("&Save..."), this);
+    saveMacroAct->setStatusTip(tr("Save the macro, e.g. for PhotoEdit --batch -p"));
+    connect(saveMacroAct, SIGNAL(triggered()), this, SLOT(saveMacro()));
+
+    loadMacroAct = new QAction(tr("&Load..."), this);
+    loadMacroAct->setStatusTip(tr("Load a saved macro"));
+    connect(loadMacroAct, SIGNAL(triggered()), this, SLOT(loadMacro()));
 }
 
 
@@ -487,7 +602,11 @@ void MainWindow::createMenus()
     fileMenu->addAction(openAct);
     fileMenu->addAction(saveAct);
     fileMenu->addAction(saveAsAct);
+    fileMenu->addAction(saveAllAct);
     fileMenu->addSeparator();
+    fileMenu->addAction(threadsAct);
+    fileMenu->addAction(historyAct);
+    fileMenu->addAction(pngLevelAct);
     QAction *action = fileMenu->addAction(tr("Switch layout direction"));
     connect(action, SIGNAL(triggered()), this, SLOT(switchLayoutDirection()));
     fileMenu->addAction(exitAct);
@@ -504,6 +623,7 @@ void MainWindow::createMenus()
     editMenu->addAction(revertAct);
     editMenu->addAction(undoAct);
     editMenu->addAction(redoAct);
+    editMenu->addAction(journalAct);
 
     //========Image Menu========
     imageMenu = menuBar()->addMenu(tr("Image"));
@@ -515,6 +635,16 @@ void MainWindow::createMenus()
     updateEffectsMenu();
     connect(effectsMenu, SIGNAL(aboutToShow()), this, SLOT(updateEffectsMenu()));
 
+    //========Macro Menu========
+    macroMenu = menuBar()->addMenu(tr("&Macro"));
+    macroMenu->addAction(recordMacroAct);
+    macroMenu->addAction(runMacroAct);
+    macroMenu->addSeparator();
+    macroMenu->addAction(saveMacroAct);
+    macroMenu->addAction(loadMacroAct);
+    updateMacroMenu();
+    connect(macroMenu, SIGNAL(aboutToShow()), this, SLOT(updateMacroMenu()));
+
     //========Window Menu========
     windowMenu = menuBar()->addMenu(tr("&Window"));
     updateWindowMenu();
@@ -564,6 +694,13 @@ void MainWindow::createToolBars()
 void MainWindow::createStatusBar()
 {
     statusBar()->showMessage(tr("Ready"));
+
+    //Shown while the decode queue opens files
+    openProgress = new QProgressBar;
+    openProgress->setFormat(tr("Opening %v of %m"));
+    openProgress->setMaximumWidth(200);
+    openProgress->hide();
+    statusBar()->addPermanentWidget(openProgress);
 }
 
 /**************************************************************************//**
@@ -578,6 +715,12 @@ void MainWindow::readSettings()
     QSize size = settings.value("size", QSize(400, 400)).toSize();
     move(pos);
     resize(size);
+
+    //0 -> one thread per core
+    BandScheduler::setThreadCount(settings.value("threads", 0).toInt());
+    UndoHistory::setBudget(settings.value("historyBudget", UndoHistory::budget()).toLongLong());
+    UndoHistory::setSwapThreshold(settings.value("historySwapThreshold", UndoHistory::swapThreshold()).toLongLong());
+    PngWriter::setDefaultLevel(settings.value("pngLevel", PngWriter::defaultLevel()).toInt());
 }
 
 /**************************************************************************//**
@@ -590,6 +733,10 @@ void MainWindow::writeSettings()
     QSettings settings("QtProject", "MDI Example");
     settings.setValue("pos", pos());
     settings.setValue("size", size());
+    settings.setValue("threads", BandScheduler::configuredThreadCount());
+    settings.setValue("historyBudget", UndoHistory::budget());
+    settings.setValue("historySwapThreshold", UndoHistory::swapThreshold());
+    settings.setValue("pngLevel", PngWriter::defaultLevel());
 }
 
 /**************************************************************************//**
@@ -669,37 +816,171 @@ void MainWindow::open()
 {
     QString caption = "Photo Edit - Select Image";
     QString defaultDir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
-    QString fileName = QFileDialog::getOpenFileName(this, caption, defaultDir, "images (*.png *.bmp *.jpg);;all (*)");
-    if (!fileName.isEmpty()) {
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, caption, defaultDir, "images (*.png *.bmp *.jpg);;all (*)");
+    openFiles(fileNames);
+}
+
+/**************************************************************************//**
+ * @brief Opens files picked in the open dialog, given on the command line or
+ * dropped on the window.  A file that is already open is brought to the
+ * front.  Large files that can be opened progressively get their window at
+ * once; the rest go to the decode queue and get theirs when decoded, so
+ * the window stays responsive however many are opened.
+ *
+ * @param[in] fileNames - The files to open
+ *****************************************************************************/
+void MainWindow::openFiles(const QStringList &fileNames)
+{
+    QStringList queued;
+    foreach (const QString &name, fileNames) {
+        //Canonical, so findMdiChild() recognizes the file later
+        QString fileName = QFileInfo(name).canonicalFilePath();
+        if (fileName.isEmpty()) {
+            statusBar()->showMessage(tr("Cannot find %1").arg(name), 2000);
+            continue;
+        }
+
         QMdiSubWindow *existing = findMdiChild(fileName);
         if (existing) {
             mdiArea->setActiveSubWindow(existing);
-            return;
+            continue;
         }
 
-        MdiChild *child = createMdiChild();
-        if (child->loadFile(fileName)) {
-            statusBar()->showMessage(tr("File loaded"), 2000);
-            child->show();
+        if (ImageDecoder::isProgressive(fileName)) {
+            MdiChild *child = createMdiChild();
+            if (child->loadFile(fileName)) {
+                statusBar()->showMessage(tr("File loaded"), 2000);
+                child->show();
+            }
+            else {
+                child->close();
+            }
+            continue;
         }
-        else {
-            child->close();
+
+        queued.append(fileName);
+    }
+
+    if (!queued.isEmpty())
+        decodeQueue->enqueue(queued);
+}
+
+/**************************************************************************//**
+ * @brief Gives a file decoded by the queue its window.  Failures only go to
+ * the status bar, so a bad file among many doesn't stop the others with a
+ * message box.
+ *
+ * @param[in] fileName - The file that was decoded
+ * @param[in] image - The image, null if it couldn't be decoded
+ * @param[in] error - Why it couldn't
+ *****************************************************************************/
+void MainWindow::showDecoded(const QString &fileName, const QImage &image, const QString &error)
+{
+    if (image.isNull()) {
+        statusBar()->showMessage(tr("Cannot load %1: %2").arg(fileName).arg(error), 5000);
+        return;
+    }
+
+    //Opened again while it was decoding
+    if (findMdiChild(fileName))
+        return;
+
+    MdiChild *child = createMdiChild();
+    child->loadImage(fileName, image);
+    child->show();
+}
+
+/**************************************************************************//**
+ * @brief Shows how many of the queued files are open, in the status bar.
+ *
+ * @param[in] done - Files handed out by the decode queue
+ * @param[in] total - Files queued in this run
+ *****************************************************************************/
+void MainWindow::showOpenProgress(int done, int total)
+{
+    if (done >= total) {
+        openProgress->hide();
+        statusBar()->showMessage(tr("Files loaded"), 2000);
+        return;
+    }
+
+    openProgress->setRange(0, total);
+    openProgress->setValue(done);
+    openProgress->show();
+}
+
+/**************************************************************************//**
+ * @brief Accepts drags of local files, to open them.
+ *****************************************************************************/
+void MainWindow::dragEnterEvent(QDragEnterEvent *event)
+{
+    foreach (const QUrl &url, event->mimeData()->urls()) {
+        if (url.isLocalFile()) {
+            event->acceptProposedAction();
+            return;
         }
     }
 }
 
+/**************************************************************************//**
+ * @brief Opens the local files dropped on the window.
+ *****************************************************************************/
+void MainWindow::dropEvent(QDropEvent *event)
+{
+    QStringList fileNames;
+    foreach (const QUrl &url, event->mimeData()->urls()) {
+        if (url.isLocalFile())
+            fileNames.append(url.toLocalFile());
+    }
+
+    if (!fileNames.isEmpty()) {
+        event->acceptProposedAction();
+        openFiles(fileNames);
+    }
+}
+
 void MainWindow::save()
 {
     if (activeMdiChild() && activeMdiChild()->save()) {
-        statusBar()->showMessage(tr("File saved"), 2000);
+        statusBar()->showMessage(tr("Saving..."));
     }
 }
 
 void MainWindow::saveAs()
 {
     if (activeMdiChild() && activeMdiChild()->saveAs()) {
-        statusBar()->showMessage(tr("File saved"), 2000);
+        statusBar()->showMessage(tr("Saving..."));
+    }
+}
+
+/**************************************************************************//**
+ * @brief Saves every modified document.  Each is encoded on its own
+ * ImageSaver thread, so they are written concurrently.
+ *****************************************************************************/
+void MainWindow::saveAll()
+{
+    int count = 0;
+    foreach (QMdiSubWindow *window, mdiArea->subWindowList()) {
+        MdiChild *child = qobject_cast<MdiChild *>(window->widget());
+        if (child->isModified() && !child->isLoading() && child->save())
+            count++;
     }
+
+    if (count > 0)
+        statusBar()->showMessage(tr("Saving %1 files...").arg(count));
+}
+
+/**************************************************************************//**
+ * @brief Reports a finished background save in the status bar.  A failed
+ * one was already reported by its window.
+ *
+ * @param[in] fileName - The file written
+ * @param[in] saved - Whether it was
+ *****************************************************************************/
+void MainWindow::showSaved(const QString &fileName, bool saved)
+{
+    if (saved)
+        statusBar()->showMessage(tr("Saved %1").arg(QFileInfo(fileName).fileName()), 2000);
 }
 
 //------------------------------------------------------------------------------
@@ -805,14 +1086,11 @@ void MainWindow::balance(const std::vector<double> &dialogValues)
 {
     if (activeMdiChild())
     {
-        //activeMdiChild()->brightness(dialogValues[0]);
-        //activeMdiChild()->contrast(dialogValues[1], dialogValues[2]);
-        //activeMdiChild()->gamma(dialogValues[3]);
-        //activeMdiChild()->balance(dialogValues[0],
-        //                          dialogValues[1],
-        //                          dialogValues[2],
-        //                          dialogValues[3]);
-        //activeMdiChild()->commitImageChanges();
+        //assumes dialogValues is valid and has 4 values
+        activeMdiChild()->balance(dialogValues[0],
+                                  dialogValues[1],
+                                  dialogValues[2],
+                                  dialogValues[3]);
         statusBar()->showMessage(tr("Image Balanced"), 2000);
     }
 }
@@ -830,13 +1108,120 @@ void MainWindow::properties()
         theProperties += QString("Width: %1\n").arg(width);
         theProperties += QString("Height: %1\n").arg(height);
         theProperties += QString("File Type: %1\n").arg(fileType);
-        theProperties += QString("File Name: \"%1\"").arg(filePath);
+        theProperties += QString("File Name: \"%1\"\n").arg(filePath);
+        theProperties += QString("Effect Buffers: %1 MB\n").arg(activeMdiChild()->scratchBytes() / 1048576.0, 0, 'f', 1);
+        theProperties += QString("Undo History: %1 MB\n").arg(activeMdiChild()->historyBytes() / 1048576.0, 0, 'f', 1);
+
+        qint64 packedBytes = activeMdiChild()->historyPackedBytes();
+        qint64 rawBytes = activeMdiChild()->historyPackedRawBytes();
+        theProperties += QString("Packed Keyframes: %1 MB of %2 MB (%3:1)\n")
+                         .arg(packedBytes / 1048576.0, 0, 'f', 1)
+                         .arg(rawBytes / 1048576.0, 0, 'f', 1)
+                         .arg(packedBytes > 0 ? double(rawBytes) / packedBytes : 1.0, 0, 'f', 1);
+        theProperties += QString("Swapped to Disk: %1 MB\n").arg(activeMdiChild()->historySwappedBytes() / 1048576.0, 0, 'f', 1);
+        theProperties += QString("Keyframe Restore: %1 ms last, %2 ms average")
+                         .arg(activeMdiChild()->lastUnpackTime())
+                         .arg(activeMdiChild()->averageUnpackTime());
 
         QMessageBox::about(this, "Properties", theProperties);
     }
 
 }
 
+/**************************************************************************//**
+ * @brief Shows the undo journal of the current window: every operation with
+ * its parameters, which of them are keyframes, and how long the last undo or
+ * redo took to replay.
+ *****************************************************************************/
+void MainWindow::journal()
+{
+    if (activeMdiChild())
+    {
+        QString theJournal = activeMdiChild()->historyJournal().join("\n");
+        theJournal += QString("\n\nLast undo/redo: %1 operations replayed in %2 ms")
+                      .arg(activeMdiChild()->lastReplayCount())
+                      .arg(activeMdiChild()->lastReplayTime());
+
+        QMessageBox::about(this, "History", theJournal);
+    }
+}
+
+//------------------------------------------------------------------------------
+//                  Macro
+//------------------------------------------------------------------------------
+/**************************************************************************//**
+ * @brief Starts or stops recording.  A new recording replaces the macro.
+ *
+ * @param[in] recording - true when recording starts
+ *****************************************************************************/
+void MainWindow::recordMacro(bool recording)
+{
+    if(recording)
+    {
+        macro.clear();
+        statusBar()->showMessage(tr("Recording macro"));
+    }
+    else
+    {
+        statusBar()->showMessage(tr("Macro of %1 operations recorded").arg(macro.size()), 2000);
+    }
+}
+
+/**************************************************************************//**
+ * @brief Appends an operation committed in any window to the macro while it
+ * is recorded.  Operations that depend on the document, like opening it or
+ * pasting into it, are left out.
+ *
+ * @param[in] name - The operation as the undo journal names it
+ *****************************************************************************/
+void MainWindow::recordOperation(const QString &name)
+{
+    if(!recordMacroAct->isChecked())
+        return;
+
+    QString error;
+    if(macro.append(name, &error))
+        statusBar()->showMessage(tr("Recorded %1").arg(name));
+    else
+        statusBar()->showMessage(tr("Not recorded: %1").arg(error), 2000);
+}
+
+void MainWindow::runMacro()
+{
+    if (activeMdiChild())
+    {
+        if(activeMdiChild()->applyPipeline(macro))
+            statusBar()->showMessage(tr("Macro applied"), 2000);
+        else
+            QMessageBox::warning(this, tr("Run Macro"), tr("An operation of the macro rejected its parameters."));
+    }
+}
+
+void MainWindow::saveMacro()
+{
+    QString defaultDir = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save Macro"), defaultDir, "pipelines (*.json);;all (*)");
+    if (!fileName.isEmpty()) {
+        if(macro.save(fileName))
+            statusBar()->showMessage(tr("Macro saved"), 2000);
+        else
+            QMessageBox::warning(this, tr("Save Macro"), tr("Cannot write %1").arg(fileName));
+    }
+}
+
+void MainWindow::loadMacro()
+{
+    QString defaultDir = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Load Macro"), defaultDir, "pipelines (*.json);;all (*)");
+    if (!fileName.isEmpty()) {
+        QString error;
+        if(macro.load(fileName, &error))
+            statusBar()->showMessage(tr("Macro of %1 operations loaded").arg(macro.size()), 2000);
+        else
+            QMessageBox::warning(this, tr("Load Macro"), error);
+    }
+}
+
 //------------------------------------------------------------------------------
 //                  Dialogs
 //------------------------------------------------------------------------------
@@ -860,9 +1245,11 @@ void MainWindow::despeckleDialog()
     if(activeMdiChild())
     {
         int baseValue = 32, min = 0, max = 255;
+        int radius = 1, radiusMin = 1, radiusMax = 10;
 
-        dialog *despeckle_dialog = new dialog(tr("Despeckle (Not Implemented)"));
+        dialog *despeckle_dialog = new dialog(tr("Despeckle"));
         despeckle_dialog->addChild(tr("Threshold:"), baseValue, min, max);
+        despeckle_dialog->addChild(tr("Radius:"), radius, radiusMin, radiusMax);
 
         connect(despeckle_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(despeckle(std::vector<double>)));
         connect(despeckle_dialog, SIGNAL(cancelled()), activeMdiChild(), SLOT(revertImageChanges()));
@@ -870,6 +1257,36 @@ void MainWindow::despeckleDialog()
     }
 }
 
+void MainWindow::posterizeDialog()
+{
+    if(activeMdiChild())
+    {
+        int baseValue = 4, min = 2, max = 16;
+
+        dialog *posterize_dialog = new dialog(tr("Posterize"));
+        posterize_dialog->addChild(tr("Levels:"), baseValue, min, max);
+
+        connect(posterize_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(posterize(std::vector<double>)));
+        connect(posterize_dialog, SIGNAL(cancelled()), activeMdiChild(), SLOT(revertImageChanges()));
+        connect(posterize_dialog, SIGNAL(accepted()), activeMdiChild(), SLOT(commitImageChanges()));
+    }
+}
+
+void MainWindow::posterizePaletteDialog()
+{
+    if(activeMdiChild())
+    {
+        int baseValue = 16, min = 2, max = 256;
+
+        dialog *palette_dialog = new dialog(tr("Posterize (Adaptive Palette)"));
+        palette_dialog->addChild(tr("Colors:"), baseValue, min, max);
+
+        connect(palette_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(posterizePalette(std::vector<double>)));
+        connect(palette_dialog, SIGNAL(cancelled()), activeMdiChild(), SLOT(revertImageChanges()));
+        connect(palette_dialog, SIGNAL(accepted()), activeMdiChild(), SLOT(commitImageChanges()));
+    }
+}
+
 void MainWindow::gammaDialog()
 {
     if(activeMdiChild())
@@ -910,7 +1327,7 @@ void MainWindow::balanceDialog()
         int contrastUpper = 255;
         double gamma = 1, gammaMin = 0, gammaMax = 5;
 
-        dialog *binaryThreshold_dialog = new dialog(tr("Balance (Not Implemented)"));
+        dialog *binaryThreshold_dialog = new dialog(tr("Balance"));
         binaryThreshold_dialog->addChild(tr("Brightness:"), brightness, brightnessMin, brightnessMax);
         binaryThreshold_dialog->addChild(tr("Contrast Lower:"), contrastLower, contrastMin, contrastMax);
         binaryThreshold_dialog->addChild(tr("Contrast Upper:"), contrastUpper, contrastMin, contrastMax);
@@ -973,6 +1390,46 @@ void MainWindow::resizeDialog()
     }
 }
 
+void MainWindow::threadsDialog()
+{
+    //Cancel goes back to the setting as it was, which may be one per core
+    previousThreadCount = BandScheduler::configuredThreadCount();
+    int threads = BandScheduler::threadCount();
+    int min = 1, max = qMax(QThread::idealThreadCount() * 2, threads);
+
+    dialog *threads_dialog = new dialog(tr("Effect Threads"));
+    threads_dialog->addChild(tr("Threads:"), threads, min, max);
+
+    connect(threads_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(setThreadCount(std::vector<double>)));
+    connect(threads_dialog, SIGNAL(cancelled()), this, SLOT(revertThreadCount()));
+}
+
+void MainWindow::historyDialog()
+{
+    previousHistoryBudget = UndoHistory::budget();
+    previousSwapThreshold = UndoHistory::swapThreshold();
+    int megabytes = previousHistoryBudget / 1048576;
+    int inMemory = previousSwapThreshold / 1048576;
+
+    dialog *history_dialog = new dialog(tr("Undo History Memory"));
+    history_dialog->addChild(tr("MB per document:"), megabytes, 16, qMax(65536, megabytes));
+    history_dialog->addChild(tr("MB in memory, all documents:"), inMemory, 16, qMax(65536, inMemory));
+
+    connect(history_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(setHistoryBudget(std::vector<double>)));
+    connect(history_dialog, SIGNAL(cancelled()), this, SLOT(revertHistoryBudget()));
+}
+
+void MainWindow::pngLevelDialog()
+{
+    previousPngLevel = PngWriter::defaultLevel();
+
+    dialog *png_dialog = new dialog(tr("PNG Compression"));
+    png_dialog->addChild(tr("Level (1 fastest, 9 smallest):"), previousPngLevel, 0, 9);
+
+    connect(png_dialog, SIGNAL(valueChanged(std::vector<double>)), this, SLOT(setPngLevel(std::vector<double>)));
+    connect(png_dialog, SIGNAL(cancelled()), this, SLOT(revertPngLevel()));
+}
+
 //------------------------------------------------------------------------------
 //                  Effects
 //------------------------------------------------------------------------------
@@ -1018,17 +1475,32 @@ void MainWindow::negative()
 
 void MainWindow::despeckle(const std::vector<double> &dialogValues)
 {
-    //assumes dialogValues is valid and only has 1 value
+    //assumes dialogValues is valid and has 2 values
     if (activeMdiChild())
     {
-        activeMdiChild()->despeckle(dialogValues[0]);
+        activeMdiChild()->despeckle(dialogValues[0], dialogValues[1]);
         statusBar()->showMessage(tr("Image Despeckled"), 2000);
     }
 }
 
-void MainWindow::posterize()
+void MainWindow::posterize(const std::vector<double> &dialogValues)
 {
+    //assumes dialogValues is valid and only has 1 value
+    if (activeMdiChild())
+    {
+        activeMdiChild()->posterize(dialogValues[0]);
+        statusBar()->showMessage(tr("Image Posterized"), 2000);
+    }
+}
 
+void MainWindow::posterizePalette(const std::vector<double> &dialogValues)
+{
+    //assumes dialogValues is valid and only has 1 value
+    if (activeMdiChild())
+    {
+        activeMdiChild()->posterizePalette(dialogValues[0]);
+        statusBar()->showMessage(tr("Image Posterized"), 2000);
+    }
 }
 
 void MainWindow::edge()
@@ -1090,6 +1562,48 @@ void MainWindow::contrast(const std::vector<double> &dialogValues)
     }
 }
 
+//------------------------------------------------------------------------------
+//                  Settings
+//------------------------------------------------------------------------------
+void MainWindow::setThreadCount(const std::vector<double> &dialogValues)
+{
+    //assumes dialogValues is valid and only has 1 value
+    BandScheduler::setThreadCount(dialogValues[0]);
+    statusBar()->showMessage(tr("Effects use %1 threads").arg(BandScheduler::threadCount()), 2000);
+}
+
+void MainWindow::revertThreadCount()
+{
+    BandScheduler::setThreadCount(previousThreadCount);
+}
+
+void MainWindow::setHistoryBudget(const std::vector<double> &dialogValues)
+{
+    //assumes dialogValues is valid and has 2 values
+    UndoHistory::setBudget(qint64(dialogValues[0]) * 1048576);
+    UndoHistory::setSwapThreshold(qint64(dialogValues[1]) * 1048576);
+    statusBar()->showMessage(tr("Undo history limited to %1 MB per document, %2 MB in memory")
+                             .arg(dialogValues[0]).arg(dialogValues[1]), 2000);
+}
+
+void MainWindow::revertHistoryBudget()
+{
+    UndoHistory::setBudget(previousHistoryBudget);
+    UndoHistory::setSwapThreshold(previousSwapThreshold);
+}
+
+void MainWindow::setPngLevel(const std::vector<double> &dialogValues)
+{
+    //assumes dialogValues is valid and only has 1 value
+    PngWriter::setDefaultLevel(dialogValues[0]);
+    statusBar()->showMessage(tr("PNG files are saved at level %1").arg(PngWriter::defaultLevel()), 2000);
+}
+
+void MainWindow::revertPngLevel()
+{
+    PngWriter::setDefaultLevel(previousPngLevel);
+}
+
 //------------------------------------------------------------------------------
 //                  Window
 //------------------------------------------------------------------------------
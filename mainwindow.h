@@ -54,13 +54,16 @@
 #include <QMainWindow>
 #include <QComboBox>
 #include <QStringList>
+#include "pipeline.h"
 
 class MdiChild;
+class DecodeQueue;
 QT_BEGIN_NAMESPACE
 class QAction;
 class QMenu;
 class QMdiArea;
 class QMdiSubWindow;
+class QProgressBar;
 class QSignalMapper;
 QT_END_NAMESPACE
 
@@ -71,8 +74,13 @@ class MainWindow : public QMainWindow
 public:
     MainWindow();
 
+    //Opens the files, decoding them in parallel
+    void openFiles(const QStringList &fileNames);
+
 protected:
     void closeEvent(QCloseEvent *event);
+    void dragEnterEvent(QDragEnterEvent *event);
+    void dropEvent(QDropEvent *event);
 
 private slots:
     //New, Open, Save, Exit
@@ -80,6 +88,10 @@ private slots:
     void open();
     void save();
     void saveAs();
+    void saveAll();
+    void showSaved(const QString &fileName, bool saved);
+    void showDecoded(const QString &fileName, const QImage &image, const QString &error);
+    void showOpenProgress(int done, int total);
 
     //Copy, Cut, Paste
 #ifndef QT_NO_CLIPBOARD
@@ -99,16 +111,29 @@ private slots:
     void rotate(const std::vector<double> &dialogValues);
     void balance(const std::vector<double> &dialogValues);
     void properties();
+    void journal();
+
+    //Macro
+    void recordMacro(bool recording);
+    void recordOperation(const QString &name);
+    void runMacro();
+    void saveMacro();
+    void loadMacro();
 
     //Dialogs
     void brightnessDialog();
     void despeckleDialog();
+    void posterizeDialog();
+    void posterizePaletteDialog();
     void gammaDialog();
     void binaryThresholdDialog();
     void balanceDialog();
     void rotateDialog();
     void contrastDialog();
     void resizeDialog();
+    void threadsDialog();
+    void historyDialog();
+    void pngLevelDialog();
 
     //Effects
     void grayScale();
@@ -116,7 +141,8 @@ private slots:
     void soften();
     void negative();
     void despeckle(const std::vector<double> &dialogValues);
-    void posterize();
+    void posterize(const std::vector<double> &dialogValues);
+    void posterizePalette(const std::vector<double> &dialogValues);
     void edge();
     void emboss();
     void gamma(const std::vector<double> &dialogValues);
@@ -124,6 +150,13 @@ private slots:
     void binaryThreshold(const std::vector<double> &dialogValues);
     void contrast(const std::vector<double> &dialogValues);
 
+    //Settings
+    void setThreadCount(const std::vector<double> &dialogValues);
+    void revertThreadCount();
+    void setHistoryBudget(const std::vector<double> &dialogValues);
+    void revertHistoryBudget();
+    void setPngLevel(const std::vector<double> &dialogValues);
+    void revertPngLevel();
 
     //About
     void about();
@@ -133,6 +166,7 @@ private slots:
     void updateClipboardItems();
     void updateImageMenu();
     void updateEffectsMenu();
+    void updateMacroMenu();
     void updateWindowMenu();
     MdiChild *createMdiChild();
     void switchLayoutDirection();
@@ -162,12 +196,15 @@ private:
     //========MDI========
     QMdiArea *mdiArea;
     QSignalMapper *windowMapper;
+    DecodeQueue *decodeQueue;     //Decodes the files being opened
+    QProgressBar *openProgress;   //How many of them are open
 
     //========Menus========
     QMenu *fileMenu;
     QMenu *editMenu;
     QMenu *imageMenu;
     QMenu *effectsMenu;
+    QMenu *macroMenu;
     QMenu *windowMenu;
     QMenu *helpMenu;
 
@@ -182,6 +219,10 @@ private:
     QAction *openAct;
     QAction *saveAct;
     QAction *saveAsAct;
+    QAction *saveAllAct;
+    QAction *threadsAct;
+    QAction *historyAct;
+    QAction *pngLevelAct;
     QAction *exitAct;
 
     //Copy, Cut, Paste
@@ -194,6 +235,7 @@ private:
     //Undo, Redo, Revert
     QAction *undoAct;
     QAction *redoAct;
+    QAction *journalAct;
     QAction *revertAct;
 
     //Windowing
@@ -221,6 +263,7 @@ private:
     QAction *negativeAct;
     QAction *despeckleAct;
     QAction *posterizeAct;
+    QAction *posterizePaletteAct;
     QAction *edgeAct;
     QAction *embossAct;
     QAction *gammaAct;
@@ -228,10 +271,27 @@ private:
     QAction *binaryThresholdAct;
     QAction *contrastAct;
 
+    //Macro
+    QAction *recordMacroAct;
+    QAction *runMacroAct;
+    QAction *saveMacroAct;
+    QAction *loadMacroAct;
+
     //About
     QAction *aboutAct;
 
+    //Operations recorded, or loaded, to run on other documents
+    Pipeline macro;
+
+    //Thread count before the threads dialog opened (restored on Cancel)
+    int previousThreadCount;
+
+    //Undo history budget before its dialog opened (restored on Cancel)
+    qint64 previousHistoryBudget;
+    qint64 previousSwapThreshold;
 
+    //PNG compression level before its dialog opened (restored on Cancel)
+    int previousPngLevel;
 };
 
 #endif
@@ -50,6 +50,12 @@
 #include <QPainter>
 
 #include "mdichild.h"
+#include "effects.h"
+#include "scanline.h"
+#include "imagedecoder.h"
+#include "imagesaver.h"
+
+using namespace std::placeholders;
 
 MdiChild::MdiChild()
 {
@@ -57,6 +63,11 @@ MdiChild::MdiChild()
     this->setAlignment(Qt::AlignCenter);
     isUntitled = true;
     modified = false;
+    loading = false;
+    saving = false;
+    saveFailed = false;
+    edits = 0;
+    savingEdits = 0;
     zoomable = true;
     areaSelected = false;
 
@@ -68,12 +79,19 @@ MdiChild::MdiChild()
 
     setDragMode(NoDrag);
 
-    undoStack = new std::deque<QImage>(0);
-    redoStack = new std::deque<QImage>(0);
+
+    imageItem = NULL;
+    previewHalo = 0;
+    previewScalable = true;
+    previewComplete = false;
+    previewWorker = new PreviewWorker(&image.scratchPool());
+    connect(previewWorker, SIGNAL(frameReady(QImage,int)), this, SLOT(showFrame(QImage,int)));
 }
 
 MdiChild::~MdiChild()
 {
+    //Stop rendering before the image it renders into goes away
+    delete previewWorker;
     delete rubberBand;
 }
 
@@ -89,15 +107,17 @@ void MdiChild::newFile()
 
     isUntitled = true;
     curFile = tr("img%1.png").arg(sequenceNumber++);
-    QImage temp(200, 200, QImage::Format_RGB32);
-    image.convertFromImage(temp);
-    image.fill(QColor(255, 255, 255, 255));
+    QImage temp(200, 200, QImage::Format_ARGB32);
+    temp.fill(QColor(255, 255, 255, 255));
+    image.setImage(temp);
 
+    record(QString("new(%1, %2)").arg(temp.width()).arg(temp.height()));
     commitImageChanges();
 
     QGraphicsScene *scene = new QGraphicsScene;
     scene->setBackgroundBrush(QBrush(QColor(0,0,0,48)));
-    pixmap = scene->addPixmap(image);
+    imageItem = new ImageItem(&image);
+    scene->addItem(imageItem);
     this->setScene(scene);
 
     setCurrentFile(curFile);
@@ -116,18 +136,46 @@ void MdiChild::newFile()
  *****************************************************************************/
 bool MdiChild::loadFile(const QString &fileName)
 {
-    if (!fileName.isEmpty()) {
+    if (!fileName.isEmpty() && ImageDecoder::isProgressive(fileName)) {
+        //Show a decode sized to the view now, the full image when it's ready
+        QSize bound = viewport()->size().expandedTo(QSize(PreviewMinimum, PreviewMinimum));
+        QImage firstFrame = ImageDecoder::preview(fileName, bound);
+        QSize fullSize = QImageReader(fileName).size();
+        if (firstFrame.isNull()) {
+            QMessageBox::information(this, tr("Image Viewer"), tr("Cannot load %1").arg(fileName));
+            return false;
+        }
+
+        QGraphicsScene *scene = new QGraphicsScene;
+        scene->setBackgroundBrush(QBrush(QColor(0,0,0,48)));
+        imageItem = new ImageItem(&image);
+        imageItem->setPlaceholder(fullSize, firstFrame);
+        scene->addItem(imageItem);
+        this->setScene(scene);
+
+        setCurrentFile(fileName);
+
+        loading = true;
+        ImageDecoder *decoder = new ImageDecoder(fileName);
+        connect(decoder, SIGNAL(decoded(QString,QImage,QString)),
+                this, SLOT(finishLoading(QString,QImage,QString)));
+        ImageDecoder::pool()->start(decoder);
+        return true;
+    }
+    else if (!fileName.isEmpty()) {
         image.load(fileName);
         if (image.isNull()) {
             QMessageBox::information(this, tr("Image Viewer"), tr("Cannot load %1").arg(fileName));
             return false;
         }
 
+        record(QString("open(%1)").arg(strippedName(fileName)));
         this->commitImageChanges();
 
         QGraphicsScene *scene = new QGraphicsScene;
         scene->setBackgroundBrush(QBrush(QColor(0,0,0,48)));
-        pixmap = scene->addPixmap(image);
+        imageItem = new ImageItem(&image);
+        scene->addItem(imageItem);
         this->setScene(scene);
 
         setCurrentFile(fileName);
@@ -138,14 +186,68 @@ bool MdiChild::loadFile(const QString &fileName)
         qDebug() << "in load";
         bool retVal;
         retVal = image.load(currentFile());
+        record(QString("open(%1)").arg(userFriendlyCurrentFile()));
         commitImageChanges();
-        pixmap->setPixmap(image);
         qDebug() << "retval:" << retVal;
         return retVal;
     }
     return false;
 }
 
+/**************************************************************************//**
+ * @brief Shows an image that was already decoded, e.g. by the DecodeQueue
+ * of the main window, as the file it was read from.
+ *
+ * @param[in] fileName - The file the image was read from
+ * @param[in] loaded - The image, in the format ImageDecoder gives it
+ *
+ * @returns false if the image is null
+ *****************************************************************************/
+bool MdiChild::loadImage(const QString &fileName, const QImage &loaded)
+{
+    if (loaded.isNull())
+        return false;
+
+    image.setLoaded(loaded);
+    record(QString("open(%1)").arg(strippedName(fileName)));
+    commitImageChanges();
+
+    QGraphicsScene *scene = new QGraphicsScene;
+    scene->setBackgroundBrush(QBrush(QColor(0,0,0,48)));
+    imageItem = new ImageItem(&image);
+    scene->addItem(imageItem);
+    this->setScene(scene);
+
+    setCurrentFile(fileName);
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Swaps the full resolution image in for the preview of a progressive
+ * open, and makes the document editable.
+ *
+ * @param[in] fileName - The file that was decoded
+ * @param[in] loaded - The image, null if it couldn't be decoded
+ * @param[in] error - Why it couldn't
+ *****************************************************************************/
+void MdiChild::finishLoading(const QString &fileName, const QImage &loaded, const QString &error)
+{
+    loading = false;
+
+    if (loaded.isNull()) {
+        QMessageBox::information(this, tr("Image Viewer"), tr("Cannot load %1: %2").arg(fileName).arg(error));
+        close();
+        return;
+    }
+
+    image.setLoaded(loaded);
+    record(QString("open(%1)").arg(strippedName(fileName)));
+    commitImageChanges();
+    scene()->setSceneRect(imageItem->boundingRect());
+
+    emit loadingFinished();
+}
+
 /**************************************************************************//**
  * @brief Saves the current image.
  *
@@ -184,23 +286,74 @@ bool MdiChild::saveAs()
 
 
 /**************************************************************************//**
- * @brief Saves the current pixmap.
+ * @brief Starts saving the current image on an ImageSaver thread.
+ * saveFinished() tells when it's written.
  *
  * @param[in] fileName - The name of the file to save.
  *
- * @returns false - Unsuccessful save.
- * @returns true - Successful save.
+ * @returns false - The previous save failed.
+ * @returns true - The save was started.
  *****************************************************************************/
 bool MdiChild::saveFile(const QString &fileName)
 {
-    if (!image.save(fileName)){
-        QMessageBox::warning(this, tr("Photo Edit"), tr("Cannot write file %1").arg(fileName));
+    //One save at a time, so an older snapshot can't be renamed in last
+    if (!waitForSave())
         return false;
-    }
-    setModified(false);
+
+    //The saver encodes a snapshot, editing goes on meanwhile
+    saving = true;
+    saveFailed = false;
+    savingEdits = edits;
+    ImageSaver *saver = new ImageSaver(fileName, image.toImage(), &saveDone);
+    connect(saver, SIGNAL(saved(QString,QString)), this, SLOT(finishSaving(QString,QString)));
+    ImageSaver::pool()->start(saver);
     return true;
 }
 
+/**************************************************************************//**
+ * @brief Takes the result of a background save.  The document is only
+ * marked unmodified if it wasn't edited while the snapshot was saved.
+ *
+ * @param[in] fileName - The file that was written
+ * @param[in] error - Why it couldn't be, empty if it was
+ *****************************************************************************/
+void MdiChild::finishSaving(const QString &fileName, const QString &error)
+{
+    //The saver releases right after posting this, so this hardly waits
+    saveDone.acquire();
+    saving = false;
+
+    if (!error.isEmpty()) {
+        saveFailed = true;
+        QMessageBox::warning(this, tr("Photo Edit"), tr("Cannot write file %1: %2").arg(fileName).arg(error));
+        emit saveFinished(fileName, false);
+        return;
+    }
+
+    if (edits == savingEdits)
+        setModified(false);
+    emit saveFinished(fileName, true);
+}
+
+/**************************************************************************//**
+ * @brief Blocks until the background save of this document is done.  Saves
+ * of other documents go on; only this one's saver is waited for.
+ *
+ * @returns false if the save in progress failed, true if it succeeded or
+ * none was running
+ *****************************************************************************/
+bool MdiChild::waitForSave()
+{
+    if (!saving)
+        return true;
+
+    //finishSaving() takes the semaphore back when the result is delivered
+    saveDone.acquire();
+    saveDone.release();
+    QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    return !saveFailed;
+}
+
 /**************************************************************************//**
  * @brief Returns the stripped name of the file, used for display purposes.
  * @returns The stripped name of the file.
@@ -217,7 +370,8 @@ QString MdiChild::userFriendlyCurrentFile()
  *****************************************************************************/
 void MdiChild::closeEvent(QCloseEvent *event)
 {
-    if (maybeSave()) {
+    //A save started here or before must be on disk before the window goes
+    if (maybeSave() && waitForSave()) {
         event->accept();
     } else {
         event->ignore();
@@ -281,6 +435,8 @@ QString MdiChild::strippedName(const QString &fullFileName)
 void MdiChild::setModified(bool changed)
 {
     modified = changed;
+    if (changed)
+        edits++;
 }
 
 /**************************************************************************//**
@@ -346,8 +502,9 @@ void MdiChild::setPasteRepositioning(bool value)
  *****************************************************************************/
 void MdiChild::grayScale()
 {
+    previewWorker->cancel();
     image.grayscale();
-    pixmap->setPixmap(image);
+    record("grayscale()", effectReplay(Effects::grayscale));
     setModified();
 }
 
@@ -356,122 +513,371 @@ void MdiChild::grayScale()
  *****************************************************************************/
 void MdiChild::sharpen()
 {
+    previewWorker->cancel();
     image.sharpen();
-    pixmap->setPixmap(image);
+    record("sharpen()", effectReplay(Effects::sharpen));
     setModified();
 }
 
 void MdiChild::soften()
 {
+    previewWorker->cancel();
     image.soften();
-    pixmap->setPixmap(image);
+    record("soften()", effectReplay(Effects::soften));
     setModified();
 }
 
 void MdiChild::negative()
 {
+    previewWorker->cancel();
     image.negative();
-    pixmap->setPixmap(image);
+    record("negative()", effectReplay(Effects::negative));
     setModified();
 }
 
 
-void MdiChild::despeckle(int threshold)
+void MdiChild::despeckle(int threshold, int radius)
+{
+    PreviewWorker::Render render = std::bind(Effects::despeckle, _1, _2, threshold, radius);
+    preview(render, radius, false);
+    record(QString("despeckle(%1, %2)").arg(threshold).arg(radius), effectReplay(render));
+    setModified();
+}
+
+void MdiChild::posterize(int levels)
 {
-    image.despeckle(threshold);
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::posterize, _1, _2, levels);
+    preview(render);
+    record(QString("posterize(%1)").arg(levels), effectReplay(render));
     setModified();
 }
 
-void MdiChild::posterize()
+void MdiChild::posterizePalette(int colors)
 {
-    image.posterize();
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::posterizePalette, _1, _2, colors);
+    preview(render, WholeImage);
+    record(QString("posterizePalette(%1)").arg(colors), effectReplay(render));
     setModified();
 }
 
 void MdiChild::edge()
 {
+    previewWorker->cancel();
     image.edge();
-    pixmap->setPixmap(image);
+    record("edge()", effectReplay(Effects::edge));
     setModified();
 }
 
 
 void MdiChild::emboss()
 {
+    previewWorker->cancel();
     image.emboss();
-    pixmap->setPixmap(image);
+    record("emboss()", effectReplay(Effects::emboss));
     setModified();
 }
 
 void MdiChild::gamma(double gammaValue)
 {
-    image.gamma(gammaValue);
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::gamma, _1, _2, gammaValue);
+    preview(render);
+    record(QString("gamma(%1)").arg(gammaValue), effectReplay(render));
     setModified();
 }
 
 void MdiChild::brightness(int brightnessLevel)
 {
-    image.brightness(brightnessLevel);
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::brightness, _1, _2, brightnessLevel);
+    preview(render);
+    record(QString("brightness(%1)").arg(brightnessLevel), effectReplay(render));
     setModified();
 }
 
 void MdiChild::binaryThreshold(int threshold)
 {
-    image.binaryThreshold(threshold);
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::binaryThreshold, _1, _2, threshold);
+    preview(render);
+    record(QString("binaryThreshold(%1)").arg(threshold), effectReplay(render));
     setModified();
 }
 
 void MdiChild::contrast(int lower, int upper)
 {
-    image.contrast(lower, upper);
-    pixmap->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::contrast, _1, _2, lower, upper);
+    preview(render);
+    record(QString("contrast(%1, %2)").arg(lower).arg(upper), effectReplay(render));
     setModified();
 }
-/*
+
 void MdiChild::balance(int brightness, int contrastLower, int contrastUpper, double gamma)
 {
-    //image.brightness(brightness);
-    //image.contrast(contrastLower, contrastUpper);
-    //image.gamma(gamma);
-    image.balance(brightness, contrastLower, contrastUpper, gamma);
-    imageLabel->setPixmap(image);
+    PreviewWorker::Render render = std::bind(Effects::balance, _1, _2, brightness, contrastLower, contrastUpper, gamma);
+    preview(render);
+    record(QString("balance(%1, %2, %3, %4)").arg(brightness).arg(contrastLower).arg(contrastUpper).arg(gamma), effectReplay(render));
     setModified();
 }
-*/
+
+/**************************************************************************//**
+ * @brief Starts the preview of a dialog effect with new parameters.  The
+ * dialogs call this on every value change; the worker drops the requests it
+ * can't keep up with, and showFrame() puts the newest frame on screen.
+ *
+ * @param[in] render - The effect with its parameters bound
+ * @param[in] halo - Pixels around a pixel the effect reads, or WholeImage if
+ * every output pixel depends on the whole image
+ * @param[in] scalable - false for effects whose look depends on the scale,
+ * like a despeckle radius given in pixels
+ *****************************************************************************/
+void MdiChild::preview(const PreviewWorker::Render &render, int halo, bool scalable)
+{
+    previewRender = render;
+    previewHalo = halo;
+    previewScalable = scalable;
+    previewDone = QRegion();
+    previewProxySize = QSize();
+    previewComplete = false;
+
+    updatePreview();
+}
+
+/**************************************************************************//**
+ * @brief Asks the preview worker for the part of the preview that is missing.
+ *
+ * Zoomed out, the frame is rendered from a proxy of the image at the
+ * resolution it is shown at.  Zoomed in, only the tiles in and around the
+ * viewport are rendered, and the ones scrolled into view later are added as
+ * they show up.  Either way a tick costs about the same for any image size;
+ * the full size result is rendered on commit.
+ *****************************************************************************/
+void MdiChild::updatePreview()
+{
+    if(!previewRender || previewComplete)
+        return;
+
+    QSize full = image.committedSize();
+    QSize size = previewScalable ? previewSize() : full;
+    if(size != full)
+    {
+        //Scrolling doesn't change what a proxy covers
+        if(size == previewProxySize)
+            return;
+
+        QImage proxy = image.proxySource(size);
+        if(proxy.isNull())
+            return;
+
+        previewProxySize = size;
+        previewRect = QRect(QPoint(0, 0), full);
+        previewWorker->request(proxy, previewRender);
+        return;
+    }
+
+    QRect area = previewArea();
+    QRegion missing = QRegion(area) - previewDone;
+    if(missing.isEmpty())
+        return;
+
+    QImage source = image.effectSource();
+    if(source.isNull())
+        return;
+
+    previewRect = missing.boundingRect();
+    if(previewRect == source.rect())
+    {
+        previewWorker->request(source, previewRender);
+        return;
+    }
+
+    //Render the rectangle plus the pixels the effect reads around it
+    QRect rect = previewRect;
+    QRect read = rect.adjusted(-previewHalo, -previewHalo, previewHalo, previewHalo) & source.rect();
+    PreviewWorker::Render render = previewRender;
+    previewWorker->request(source, [render, rect, read](const QImage &whole, ScratchPool &scratch) {
+        QImage part = render(whole.copy(read), scratch);
+        if(part.isNull())
+            return part;
+
+        QImage frame = part.copy(rect.translated(-read.topLeft()));
+        scratch.recycle(part);
+        return frame;
+    });
+}
+
+/**************************************************************************//**
+ * @brief Returns the size of the image as the view shows it, which is as
+ * large as a preview frame needs to be.  Zoomed in (or nearly so) this is
+ * the image itself.
+ *****************************************************************************/
+QSize MdiChild::previewSize()
+{
+    QSize full = image.committedSize();
+    qreal zoom = transform().m11() * devicePixelRatio();
+
+    //Scaling a proxy to save a few pixels is not worth it
+    if(zoom >= 0.75)
+        return full;
+
+    return QSize(qMax(qCeil(full.width() * zoom), 1), qMax(qCeil(full.height() * zoom), 1));
+}
+
+/**************************************************************************//**
+ * @brief Returns the tiles of the image a preview has to cover: the ones in
+ * the viewport and a tile around it, so a short scroll finds them done.  The
+ * whole image for effects that can't be rendered in pieces.
+ *****************************************************************************/
+QRect MdiChild::previewArea()
+{
+    QRect bounds(QPoint(0, 0), image.committedSize());
+    if(previewHalo == WholeImage)
+        return bounds;
+
+    QRect visible = mapToScene(viewport()->rect()).boundingRect().toAlignedRect();
+    visible.adjust(-PreviewTile, -PreviewTile, PreviewTile, PreviewTile);
+    visible &= bounds;
+    if(visible.isEmpty())
+        return visible;
+
+    //Snap to the tile grid so the rendered pieces line up
+    int left = visible.left() / PreviewTile * PreviewTile;
+    int top = visible.top() / PreviewTile * PreviewTile;
+    int right = (visible.right() / PreviewTile + 1) * PreviewTile;
+    int bottom = (visible.bottom() / PreviewTile + 1) * PreviewTile;
+
+    return QRect(QPoint(left, top), QPoint(right - 1, bottom - 1)) & bounds;
+}
+
+/**************************************************************************//**
+ * @brief Shows a frame finished by the preview worker, unless a newer request
+ * or a cancel came in since it was asked for.  A full size frame becomes the
+ * image; a proxy or a part of the image is only drawn over it.
+ *
+ * @param[in] frame - The rendered preview
+ * @param[in] generation - Request the frame belongs to
+ *****************************************************************************/
+void MdiChild::showFrame(const QImage &frame, int generation)
+{
+    if(generation != previewWorker->generation())
+        return;
+
+    if(frame.size() == image.committedSize())
+    {
+        imageItem->clearPreview();
+        image.setImage(frame);
+        previewComplete = true;
+        return;
+    }
+
+    //A proxy covers everything, but at the wrong resolution to scroll into
+    if(frame.size() == previewRect.size())
+        previewDone += previewRect;
+
+    //The item keeps a pixmap of it, the pool can forget the frame
+    imageItem->addPreview(previewRect, frame);
+    QImage shown = frame;
+    image.scratchPool().recycle(shown);
+}
 
 /**************************************************************************//**
  * @brief Resizies image, the scene holding hte image and the modified flag.
  *****************************************************************************/
 void MdiChild::imgResize(int width, int height)
 {
+    previewWorker->cancel();
     image.imgResize(width, height);
-    //image.convertFromImage(image.scaled(width, height).toImage());
-    pixmap->setPixmap(image);
-    scene()->setSceneRect(pixmap->boundingRect());
+    record(QString("resize(%1, %2)").arg(width).arg(height), [width, height](const QImage &state) {
+        return state.scaled(width, height);
+    });
+    scene()->setSceneRect(imageItem->boundingRect());
+    setModified();
+}
+
+/**************************************************************************//**
+ * @brief Applies every operation of a pipeline and commits the result.  The
+ * history journals it as one operation that replays the whole pipeline.
+ *
+ * @param[in] pipeline - The operations, e.g. a recorded macro
+ *
+ * @returns false if an operation rejected its parameters; the image is
+ * unchanged then
+ *****************************************************************************/
+bool MdiChild::applyPipeline(const Pipeline &pipeline)
+{
+    previewWorker->cancel();
+
+    QImage result = pipeline.apply(image.effectSource(), image.scratchPool());
+    if(result.isNull())
+    {
+        qDebug() << "MdiChild::applyPipeline -> An operation rejected its parameters";
+        return false;
+    }
+
+    image.setImage(result);
+    record(pipeline.text(), [pipeline](const QImage &state) {
+        ScratchPool scratch;
+        return pipeline.apply(state, scratch);
+    });
+    scene()->setSceneRect(imageItem->boundingRect());
     setModified();
+    commitImageChanges();
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Sets the operation the next commit journals.  A change that is
+ * committed without one, or with one that can't be replayed, is kept as a
+ * keyframe (see undohistory.h).
+ *
+ * @param[in] name - The operation and its parameters, e.g. "gamma(1.8)"
+ * @param[in] replay - Redoes the operation on the committed image, or none
+ *****************************************************************************/
+void MdiChild::record(const QString &name, const UndoHistory::Replay &replay)
+{
+    pendingOperation.name = name;
+    pendingOperation.replay = replay;
+}
+
+/**************************************************************************//**
+ * @brief Returns a replay of an effect with its parameters bound.  It renders
+ * into a pool of its own, so an undo never takes images from the pool the
+ * preview worker uses.
+ *
+ * @param[in] render - The effect, as the preview worker takes it
+ *****************************************************************************/
+UndoHistory::Replay MdiChild::effectReplay(const PreviewWorker::Render &render)
+{
+    return [render](const QImage &state) {
+        ScratchPool scratch;
+        return render(Scanline::normalized(state), scratch);
+    };
 }
 
 /**************************************************************************//**
  * @brief Chanes the actual instance of the image (image.commit()).
- * Clears the redoStack and pushes the newest version of the image to the
- * undoStack so that the change can be undone.
+ * Records the change in the history so that it can be undone.  The history
+ * journals the operation recorded for it (see undohistory.h).
  *****************************************************************************/
 void MdiChild::commitImageChanges()
 {
-    image.commit();
-    redoStack->clear();
-    undoStack->push_front(image.toImage());
-    //prevent the stack from storing 'too much'
-    if(undoStack->size() > 12)
+    //Previews of a zoomed out or in view only made a proxy or the visible
+    //tiles, the full size result is rendered now
+    if(previewRender && !previewComplete)
     {
-        qDebug() << "MdiChild -> undoStack getting too large, popping off oldest value";
-        undoStack->pop_back();
+        previewRect = QRect(QPoint(0, 0), image.committedSize());
+        previewWorker->request(image.effectSource(), previewRender);
     }
+    previewRender = PreviewWorker::Render();
+
+    //The frame of the last value must be on screen before it is committed
+    previewWorker->finish();
+    QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    if(NULL != imageItem)
+        imageItem->clearPreview();
+
+    image.commit();
+    history.commit(image.committedTiles(), pendingOperation);
+    if(!pendingOperation.name.isEmpty())
+        emit operationCommitted(pendingOperation.name);
+    pendingOperation = UndoHistory::Operation();
 
     //scene()->setSceneRect(image.rect());
     emit undoRedoUpdated();
@@ -483,6 +889,11 @@ void MdiChild::commitImageChanges()
  *****************************************************************************/
 void MdiChild::revertImageChanges()
 {
+    previewWorker->cancel();
+    previewRender = PreviewWorker::Render();
+    pendingOperation = UndoHistory::Operation();
+    if(NULL != imageItem)
+        imageItem->clearPreview();
     image.revert();
     emit undoRedoUpdated();
 }
@@ -495,8 +906,8 @@ void MdiChild::resetRotation()
 void MdiChild::undo()
 {
     qDebug() << "Entered MdiChild::undo()";
-    qDebug() << undoStack->size();
-    if(undoStack->size() > 1)
+    qDebug() << history.undoCount();
+    if(history.canUndo())
     {
         if(pasteRepositioning)
         {
@@ -504,13 +915,10 @@ void MdiChild::undo()
         }
         else
         {
-            qDebug() << "Popping off undoStack";
-            undoStack->pop_front();
-            redoStack->push_front(image.toImage());
-            image.convertFromImage(undoStack->front());
-            image.commit();
-            pixmap->setPixmap(image);
-            scene()->setSceneRect(pixmap->boundingRect());
+            qDebug() << "Stepping back in the history";
+            previewWorker->cancel();
+            image.restore(history.undo());
+            scene()->setSceneRect(imageItem->boundingRect());
         }
     }
     emit undoRedoUpdated();
@@ -519,15 +927,12 @@ void MdiChild::undo()
 void MdiChild::redo()
 {
         //qDebug() << "Entered MdiChild::redo()";
-    if(!redoStack->empty())
+    if(history.canRedo())
     {
-        //qDebug() << "Popping off redoStack";
-        undoStack->push_front(image.toImage());
-        image.convertFromImage(redoStack->front());
-        image.commit();
-        redoStack->pop_front();
-        pixmap->setPixmap(image);
-        scene()->setSceneRect(pixmap->boundingRect());
+        //qDebug() << "Stepping forward in the history";
+        previewWorker->cancel();
+        image.restore(history.redo());
+        scene()->setSceneRect(imageItem->boundingRect());
         emit undoRedoUpdated();
     }
 }
@@ -543,7 +948,7 @@ void MdiChild::copy()
 {
     if(areaSelected)
     {
-        QImage copyImage = image.copy(QRect(origin - this->mapFromScene(0,0), endPoint - this->mapFromScene(0,0))).toImage();
+        QImage copyImage = image.toImage().copy(QRect(origin - this->mapFromScene(0,0), endPoint - this->mapFromScene(0,0)));
         clipBoard->setImage(copyImage);
     }
 
@@ -552,7 +957,7 @@ void MdiChild::copy()
 
 /**************************************************************************//**
  * @brief Sets the image in the currently selected area as the clipboard image
- * and replaces that area in the pixmap with white.
+ * and replaces that area in the image with white.
  *****************************************************************************/
 void MdiChild::cut()
 {
@@ -560,15 +965,24 @@ void MdiChild::cut()
 
     if(areaSelected)
     {
-        QImage copyImage = image.copy(cutRect).toImage();
+        QImage copyImage = image.toImage().copy(cutRect);
         clipBoard->setImage(copyImage);
     }
 
-    QPainter painter(&image);
-
-    painter.fillRect(cutRect, QBrush(QColor(255,255,255,255)));
-
-    pixmap->setPixmap(image);
+    //Only the tiles under the cut are copied on commit
+    std::function<void(QPainter&)> fill = [cutRect](QPainter &painter) {
+        painter.fillRect(cutRect, QBrush(QColor(255,255,255,255)));
+    };
+    image.paintRegion(cutRect, fill);
+    record(QString("cut(%1, %2, %3, %4)").arg(cutRect.x()).arg(cutRect.y())
+           .arg(cutRect.width()).arg(cutRect.height()), [fill](const QImage &state) {
+        QImage result = Scanline::normalized(state);
+        {
+            QPainter painter(&result);
+            fill(painter);
+        }
+        return result;
+    });
 }
 
 /**************************************************************************//**
@@ -580,12 +994,11 @@ void MdiChild::paste()
 {
     if(!pasteRepositioning)
     {
-        Image * clipImage = new Image();
-        clipImage->convertFromImage(clipBoard->image());
+        QPixmap clipPixmap = QPixmap::fromImage(clipBoard->image());
 
-        if(!clipImage->isNull())
+        if(!clipPixmap.isNull())
         {
-            pasteItem = scene()->addPixmap(*clipImage);
+            pasteItem = scene()->addPixmap(clipPixmap);
             pasteItem->setFlag(QGraphicsItem::ItemIsMovable);
             setModified();
             setPasteRepositioning(true);
@@ -594,7 +1007,7 @@ void MdiChild::paste()
 }
 
 /**************************************************************************//**
- * @brief Paints the pasteItem image onto the main pixmap and removes the
+ * @brief Paints the pasteItem image onto the main image and removes the
  * item that can be moved around. Also resets the proper booleans to allow
  * for the next selection.
  *****************************************************************************/
@@ -605,14 +1018,24 @@ void MdiChild::finalizePaste()
 
     QRect pasteRect = QRect(pasteOrigin, pasteSize);
 
-    QPainter painter(&image);
+    QPixmap pastePixmap = pasteItem->pixmap();
+    std::function<void(QPainter&)> draw = [pasteRect, pastePixmap](QPainter &painter) {
+        painter.drawTiledPixmap(pasteRect, pastePixmap, QPoint(0,0));
+    };
+    image.paintRegion(pasteRect, draw);
 
-    painter.drawTiledPixmap(pasteRect, pasteItem->pixmap(), QPoint(0,0));
+    //The journal keeps the pasted pixmap to replay it
+    record(QString("paste(%1, %2)").arg(pasteRect.x()).arg(pasteRect.y()), [draw](const QImage &state) {
+        QImage result = Scanline::normalized(state);
+        {
+            QPainter painter(&result);
+            draw(painter);
+        }
+        return result;
+    });
 
     scene()->removeItem(pasteItem);
 
-    pixmap->setPixmap(image);
-
     commitImageChanges();
 
     pasteItemMoving = false;
@@ -626,9 +1049,13 @@ void MdiChild::crop()
 {
     if(areaSelected)
     {
-        image.convertFromImage(image.copy(QRect(origin - this->mapFromScene(0,0), endPoint - this->mapFromScene(0,0))).toImage());
-        pixmap->setPixmap(image);
-        scene()->setSceneRect(pixmap->boundingRect());
+        QRect cropRect(origin - this->mapFromScene(0,0), endPoint - this->mapFromScene(0,0));
+        image.setImage(image.toImage().copy(cropRect));
+        record(QString("crop(%1, %2, %3, %4)").arg(cropRect.x()).arg(cropRect.y())
+               .arg(cropRect.width()).arg(cropRect.height()), [cropRect](const QImage &state) {
+            return state.copy(cropRect);
+        });
+        scene()->setSceneRect(imageItem->boundingRect());
         setModified();
     }
 
@@ -637,19 +1064,12 @@ void MdiChild::crop()
 
 bool MdiChild::undoEnabled()
 {
-    if(undoStack->size() > 1)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return history.canUndo();
 }
 
 bool MdiChild::redoEnabled()
 {
-    return !redoStack->empty();
+    return history.canRedo();
 }
 
 
@@ -676,6 +1096,7 @@ void MdiChild::wheelEvent(QWheelEvent* event) {
             // Zooming out
             scale(1.0 / scaleFactor, 1.0 / scaleFactor);
         }
+        updatePreview();
 
         emit zoomChanged();
         // Don't call superclass handler here
@@ -806,4 +1227,15 @@ void MdiChild::resizeEvent(QResizeEvent *event)
         fitInView(scene()->itemsBoundingRect());
     }
     QGraphicsView::resizeEvent(event);
+    updatePreview();
+}
+
+/**************************************************************************//**
+ * @brief Re-implementing scrolling so a preview fills in the tiles that come
+ * into view.
+ *****************************************************************************/
+void MdiChild::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    updatePreview();
 }
@@ -58,10 +58,15 @@
 #include <QGraphicsView>
 #include <QResizeEvent>
 #include <QRubberBand>
-#include <deque>
 #include <QGraphicsPixmapItem>
 #include <QRectF>
+#include <QRegion>
+#include <QSemaphore>
 #include "image.h"
+#include "imageitem.h"
+#include "previewworker.h"
+#include "undohistory.h"
+#include "pipeline.h"
 
 class MdiChild : public QGraphicsView
 {
@@ -73,9 +78,11 @@ public:
 
     void newFile();
     bool loadFile(const QString &fileName = "");
+    bool loadImage(const QString &fileName, const QImage &loaded);
     bool save();
     bool saveAs();
     bool saveFile(const QString &fileName);
+    bool waitForSave();
     QString userFriendlyCurrentFile();
     QString currentFile() { return curFile; }
     void setModified(bool changed = true);
@@ -83,6 +90,18 @@ public:
     void setZoomable(bool canZoom = true);
     bool isZoomable();
     bool isAreaSelected();
+    bool isLoading() { return loading; }  //Still decoding at full resolution
+    bool isSaving() { return saving; }    //Still encoding a snapshot
+    qint64 scratchBytes() { return image.scratchBytes(); }
+    qint64 historyBytes() { return history.byteCount(); }
+    QStringList historyJournal() { return history.journal(); }
+    int lastReplayCount() { return history.lastReplayCount(); }
+    qint64 lastReplayTime() { return history.lastReplayTime(); }
+    qint64 historyPackedBytes() { return history.packedBytes(); }
+    qint64 historyPackedRawBytes() { return history.packedRawBytes(); }
+    qint64 historySwappedBytes() { return history.swappedBytes(); }
+    qint64 lastUnpackTime() { return history.lastUnpackTime(); }
+    qint64 averageUnpackTime() { return history.averageUnpackTime(); }
 
 
     //Image Effects
@@ -90,8 +109,9 @@ public:
     void sharpen();
     void soften();
     void negative();
-    void despeckle(int threshold);
-    void posterize();
+    void despeckle(int threshold, int radius);
+    void posterize(int levels);
+    void posterizePalette(int colors);
     void edge();
     void emboss();
     void gamma(double gammaValue);
@@ -105,7 +125,10 @@ public:
     void paste();
     void crop();
 
-    //void balance(int brightness, int contrastLower, int contrastUpper, double gamma);
+    void balance(int brightness, int contrastLower, int contrastUpper, double gamma);
+
+    //Applies and commits a recorded macro as one undoable change
+    bool applyPipeline(const Pipeline &pipeline);
 
 
     void undo();
@@ -118,6 +141,11 @@ public slots:
     void revertImageChanges();
     void resetRotation();
 
+private slots:
+    void showFrame(const QImage &frame, int generation);
+    void finishLoading(const QString &fileName, const QImage &loaded, const QString &error);
+    void finishSaving(const QString &fileName, const QString &error);
+
 
 protected:
     void closeEvent(QCloseEvent *event);
@@ -126,6 +154,9 @@ signals:
     void zoomChanged();
     void areaSelectedChanged();
     void undoRedoUpdated();
+    void operationCommitted(const QString &name);  //As the journal names it
+    void loadingFinished();
+    void saveFinished(const QString &fileName, bool saved);
 
 private:
     bool maybeSave();
@@ -138,6 +169,7 @@ private:
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
+    void scrollContentsBy(int dx, int dy);
 
     //RubberBanding
     QPoint origin;
@@ -153,17 +185,50 @@ private:
     void setPasteRepositioning(bool value);
     void finalizePaste();
 
+    //Renders a dialog effect on the preview worker
+    void preview(const PreviewWorker::Render &render, int halo = 0, bool scalable = true);
+    void updatePreview();
+    QSize previewSize();
+    QRect previewArea();
+
     QString curFile;
     bool isUntitled;
     bool modified;
+    bool loading;
+    bool saving;
+    bool saveFailed;   //The last save couldn't write its file
+    int edits;         //Times the document was modified
+    int savingEdits;   //edits when the running save took its snapshot
+    QSemaphore saveDone;  //Released by the saver once its result is posted
 
     bool zoomable;
 
     Image image;
-    QGraphicsPixmapItem *pixmap;
+    ImageItem *imageItem;
+    PreviewWorker *previewWorker;
+    PreviewWorker::Render previewRender;  //Effect of the open dialog
+    int previewHalo;                      //Pixels it reads around a pixel
+    bool previewScalable;                 //Can be previewed from a proxy
+    bool previewComplete;                 //The image holds the full result
+    QRegion previewDone;                  //Tiles rendered with these values
+    QRect previewRect;                    //Area of the newest request
+    QSize previewProxySize;               //Size of the proxy last rendered
+
+    //Preview tiles are rendered in multiples of this many pixels
+    static const int PreviewTile = 256;
+
+    //Halo of an effect whose pixels depend on the whole image
+    static const int WholeImage = -1;
+
+    //Smallest size the first decode of a progressive open is made for
+    static const int PreviewMinimum = 512;
     QGraphicsPixmapItem *pasteItem;
-    std::deque<QImage> *undoStack;
-    std::deque<QImage> *redoStack;
+    UndoHistory history;
+    UndoHistory::Operation pendingOperation;  //Journaled on the next commit
+
+    //Names the change the next commit records, and how to replay it
+    void record(const QString &name, const UndoHistory::Replay &replay = UndoHistory::Replay());
+    static UndoHistory::Replay effectReplay(const PreviewWorker::Render &render);
 
     void setAreaSelected(bool value);
 };
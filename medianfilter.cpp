@@ -0,0 +1,273 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Constant time median filter used by despeckle.  Every band of rows
+ * keeps its own set of histograms, so the bands run in parallel.
+ *****************************************************************************/
+
+#include "medianfilter.h"
+#include "scanline.h"
+#include "bandscheduler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+const int Coarse = 16;  //Coarse bins, each covering 16 fine bins
+const int Fine = 256;
+
+//Columns per strip.  Keeps the column histograms of a strip in the cache.
+const int StripWidth = 256;
+
+//Shifts that pull red, green and blue out of a QRgb
+const int channelShift[3] = { 16, 8, 0 };
+
+/**************************************************************************//**
+ * @brief The histograms of one colour channel.
+ *****************************************************************************/
+struct ChannelHistograms
+{
+    std::vector<quint16> columnFine;    //Strip columns * Fine
+    std::vector<quint16> columnCoarse;  //Strip columns * Coarse
+    quint16 kernelFine[Fine];
+    quint16 kernelCoarse[Coarse];
+    int lastUpdate[Coarse];  //Column the fine bins of each coarse bin match
+};
+
+/**************************************************************************//**
+ * @brief Works through one band of rows, one vertical strip of it at a time.
+ *****************************************************************************/
+class MedianBand
+{
+public:
+    MedianBand(const QImage &image, int radius)
+        : source(image), r(radius), diameter(2 * radius + 1),
+          rank(diameter * diameter / 2), width(image.width())
+    {
+    }
+
+    void run(const Band &band, uchar *outBits, int stride, int threshold)
+    {
+        for(int first = 0; first < width; first += StripWidth)
+            runStrip(band, first, qMin(first + StripWidth, width), outBits, stride, threshold);
+    }
+
+private:
+    //Filters columns [first,last) of the band
+    void runStrip(const Band &band, int first, int last, uchar *outBits, int stride, int threshold)
+    {
+        //The strip reads r columns past each side of it
+        columnBase = qMax(first - r, 0);
+        columnEnd = qMin(last + r, width);
+        stripFirst = first;
+
+        const int columns = columnEnd - columnBase;
+        for(int c = 0; c < 3; c++)
+        {
+            histograms[c].columnFine.assign(columns * Fine, 0);
+            histograms[c].columnCoarse.assign(columns * Coarse, 0);
+        }
+
+        //The column histograms start out covering the rows around band.first
+        for(int k = -r; k <= r; k++)
+            addRow(clampRow(band.first + k), 1);
+
+        for(int y = band.first; y < band.last; y++)
+        {
+            //Slide every column histogram down one row
+            if(y > band.first)
+            {
+                addRow(clampRow(y - r - 1), -1);
+                addRow(clampRow(y + r), 1);
+            }
+
+            startRow();
+
+            const QRgb *in = Scanline::constRow(source, y);
+            QRgb *out = reinterpret_cast<QRgb *>(outBits + size_t(y) * stride);
+
+            for(int x = first; x < last; x++)
+            {
+                if(x > first)
+                    slideRight(x);
+
+                int median[3], difference = 0;
+                for(int c = 0; c < 3; c++)
+                {
+                    median[c] = findMedian(histograms[c], x);
+                    int value = (in[x] >> channelShift[c]) & 0xff;
+                    difference = qMax(difference, abs(value - median[c]));
+                }
+
+                //Only speckles are replaced, the rest of the image is untouched
+                if(difference > threshold)
+                    out[x] = qRgba(median[0], median[1], median[2], qAlpha(in[x]));
+                else
+                    out[x] = in[x];
+            }
+        }
+    }
+
+    int clampRow(int y) const { return qBound(0, y, source.height() - 1); }
+
+    //Index into the column histograms of the strip
+    int clampColumn(int x) const { return qBound(0, x, width - 1) - columnBase; }
+
+    //Adds (delta 1) or removes (delta -1) a row from the column histograms
+    void addRow(int y, int delta)
+    {
+        const QRgb *in = Scanline::constRow(source, y);
+
+        for(int c = 0; c < 3; c++)
+        {
+            quint16 *fine = &histograms[c].columnFine[0];
+            quint16 *coarse = &histograms[c].columnCoarse[0];
+
+            for(int x = columnBase; x < columnEnd; x++)
+            {
+                int value = (in[x] >> channelShift[c]) & 0xff;
+                fine[(x - columnBase) * Fine + value] += delta;
+                coarse[(x - columnBase) * Coarse + (value >> 4)] += delta;
+            }
+        }
+    }
+
+    //Builds the coarse kernel histograms for the window at the strip's
+    //first column
+    void startRow()
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            ChannelHistograms &h = histograms[c];
+            std::fill(h.kernelCoarse, h.kernelCoarse + Coarse, 0);
+
+            for(int k = -r; k <= r; k++)
+            {
+                const quint16 *column = &h.columnCoarse[clampColumn(stripFirst + k) * Coarse];
+                for(int b = 0; b < Coarse; b++)
+                    h.kernelCoarse[b] += column[b];
+            }
+
+            //Far enough back that every fine bin gets rebuilt when first used
+            std::fill(h.lastUpdate, h.lastUpdate + Coarse, stripFirst - 2 * diameter - 1);
+        }
+    }
+
+    //Moves the coarse kernel histograms from column x-1 to column x
+    void slideRight(int x)
+    {
+        const int entering = clampColumn(x + r), leaving = clampColumn(x - r - 1);
+
+        for(int c = 0; c < 3; c++)
+        {
+            ChannelHistograms &h = histograms[c];
+            const quint16 *in = &h.columnCoarse[entering * Coarse];
+            const quint16 *out = &h.columnCoarse[leaving * Coarse];
+
+            for(int b = 0; b < Coarse; b++)
+                h.kernelCoarse[b] += in[b] - out[b];
+        }
+    }
+
+    //Brings the fine bins of one coarse bin up to date for column x
+    void updateFine(ChannelHistograms &h, int bin, int x)
+    {
+        quint16 *fine = &h.kernelFine[bin * Coarse];
+        const int offset = bin * Coarse;
+
+        if(x - h.lastUpdate[bin] > diameter)
+        {
+            //Nothing left to reuse, sum up the whole window
+            std::fill(fine, fine + Coarse, 0);
+            for(int k = -r; k <= r; k++)
+            {
+                const quint16 *column = &h.columnFine[clampColumn(x + k) * Fine + offset];
+                for(int v = 0; v < Coarse; v++)
+                    fine[v] += column[v];
+            }
+        }
+        else
+        {
+            //Catch up on the columns that entered and left since last time
+            for(int step = h.lastUpdate[bin] + 1; step <= x; step++)
+            {
+                const quint16 *in = &h.columnFine[clampColumn(step + r) * Fine + offset];
+                const quint16 *out = &h.columnFine[clampColumn(step - r - 1) * Fine + offset];
+                for(int v = 0; v < Coarse; v++)
+                    fine[v] += in[v] - out[v];
+            }
+        }
+
+        h.lastUpdate[bin] = x;
+    }
+
+    int findMedian(ChannelHistograms &h, int x)
+    {
+        //Find the coarse bin holding the median, then the fine bin inside it
+        int count = 0, bin = 0;
+        while(count + h.kernelCoarse[bin] <= rank)
+            count += h.kernelCoarse[bin++];
+
+        updateFine(h, bin, x);
+
+        const quint16 *fine = &h.kernelFine[bin * Coarse];
+        int value = 0;
+        while(count + fine[value] <= rank)
+            count += fine[value++];
+
+        return bin * Coarse + value;
+    }
+
+    const QImage &source;
+    const int r;
+    const int diameter;
+    const int rank;  //Index of the median in the sorted window
+    const int width;
+    int columnBase;  //First column that has a column histogram
+    int columnEnd;   //One past the last column that has one
+    int stripFirst;  //First column of the strip being filtered
+    ChannelHistograms histograms[3];
+};
+
+} // namespace
+
+
+/**************************************************************************//**
+ * @brief Constructor.
+ *
+ * @param[in] radius - Window is (2*radius+1) pixels square, [1,MaximumRadius]
+ *****************************************************************************/
+MedianFilter::MedianFilter(int radius)
+{
+    if(radius < 1 || radius > MaximumRadius)
+    {
+        qDebug() << "MedianFilter -> Invalid radius" << radius << ", expecting a value [1,"
+                 << MaximumRadius << "]";
+    }
+
+    filterRadius = qBound(1, radius, int(MaximumRadius));
+}
+
+/**************************************************************************//**
+ * @brief Replaces every pixel whose red, green or blue channel differs from
+ * the median of its neighbourhood by more than threshold with the median.
+ * Pixels past the border are treated as copies of the nearest edge pixel.
+ *
+ * @param[in] source - Format_ARGB32 image to read from
+ * @param[out] destination - Format_ARGB32 image of the same size
+ * @param[in] threshold - How far a channel may be from the median, [0,255]
+ *****************************************************************************/
+void MedianFilter::despeckle(const QImage &source, QImage &destination, int threshold) const
+{
+    //Detach before the bands start, so the threads never do
+    uchar *outBits = destination.bits();
+    const int stride = destination.bytesPerLine();
+    const int r = filterRadius;
+
+    BandScheduler::run(source.height(), r, [&](const Band &band) {
+        MedianBand median(source, r);
+        median.run(band, outBits, stride, threshold);
+    });
+}
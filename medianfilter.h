@@ -0,0 +1,40 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the MedianFilter class.
+ *****************************************************************************/
+
+#ifndef MEDIANFILTER_H
+#define MEDIANFILTER_H
+
+#include <QImage>
+
+/**************************************************************************//**
+ * @brief Median of a square (2*radius+1)^2 neighbourhood, computed in
+ * constant time per pixel no matter how large the radius is.
+ *
+ * Uses the sliding histograms of Perreault and Hebert ("Median Filtering in
+ * Constant Time", 2007): one histogram per column, updated as the window
+ * moves down a row, and one kernel histogram, updated by adding and removing
+ * whole column histograms as the window moves right.  Histograms have 16
+ * coarse bins over 256 fine bins, and the fine bins of the kernel are only
+ * brought up to date for the coarse bin the median falls in.
+ *****************************************************************************/
+class MedianFilter
+{
+public:
+    explicit MedianFilter(int radius);
+
+    int radius() const { return filterRadius; }
+
+    //Replaces pixels that differ from their local median by more than
+    //threshold with that median
+    void despeckle(const QImage &source, QImage &destination, int threshold) const;
+
+    static const int MaximumRadius = 50;
+
+private:
+    int filterRadius;
+};
+
+#endif // MEDIANFILTER_H
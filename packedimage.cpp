@@ -0,0 +1,130 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Compresses the tiles of a TiledImage, for the undo history entries
+ * that are rarely gone back to.
+ *****************************************************************************/
+
+#include "packedimage.h"
+#include <QHash>
+#include <string.h>
+
+/**************************************************************************//**
+ * @brief Constructor.  The image is null.
+ *****************************************************************************/
+PackedImage::PackedImage()
+{
+    imageFormat = QImage::Format_Invalid;
+}
+
+/**************************************************************************//**
+ * @brief Compresses each tile of image.  Only reads the tiles, which are
+ * never written to once they are in a TiledImage, so this may run on a
+ * worker thread while the GUI thread uses copies of the image.
+ *
+ * @param[in] image - The image to pack
+ *
+ * @returns The packed image, null if image is
+ *****************************************************************************/
+PackedImage PackedImage::pack(const TiledImage &image)
+{
+    PackedImage packed;
+    packed.imageSize = image.size();
+    packed.imageFormat = image.format();
+    packed.colorTable = image.colors();
+    packed.tiles.resize(image.tileCount());
+    packed.keys.resize(image.tileCount());
+    packed.rawSizes.resize(image.tileCount());
+
+    for(int i = 0; i < image.tileCount(); i++)
+    {
+        const QImage &tile = image.tile(i);
+        const int bytes = tile.byteCount();
+        packed.tiles[i] = qCompress(tile.constBits(), bytes, CompressionLevel);
+        packed.keys[i] = tile.cacheKey();
+        packed.rawSizes[i] = bytes;
+    }
+
+    return packed;
+}
+
+/**************************************************************************//**
+ * @brief Uncompresses the tiles into a new TiledImage.  The tiles are new
+ * images; they don't share anything with the image that was packed.
+ *****************************************************************************/
+TiledImage PackedImage::unpack() const
+{
+    TiledImage image(imageSize, imageFormat, colorTable);
+
+    for(int i = 0; i < tiles.size(); i++)
+    {
+        QImage tile(image.tileRect(i).size(), imageFormat);
+        if(imageFormat == QImage::Format_Indexed8)
+            tile.setColorTable(colorTable);
+
+        //Same size and format, so the same row padding as when packed
+        QByteArray pixels = qUncompress(tiles[i]);
+        memcpy(tile.bits(), pixels.constData(), qMin(pixels.size(), tile.byteCount()));
+        image.setTile(i, tile);
+    }
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Takes over the packed bytes of the tiles that other was packed from
+ * too, so the copies this image made of them can be freed.  Nothing is taken
+ * from a spilled image, since its tiles live only as long as its region.
+ *
+ * @param[in] other - Another packed image, e.g. an older version
+ *****************************************************************************/
+void PackedImage::shareTiles(const PackedImage &other)
+{
+    if(other.isSpilled() || isSpilled())
+        return;
+
+    QHash<qint64, int> otherTiles;
+    for(int i = 0; i < other.keys.size(); i++)
+        otherTiles.insert(other.keys[i], i);
+
+    for(int i = 0; i < keys.size(); i++)
+    {
+        QHash<qint64, int>::const_iterator found = otherTiles.constFind(keys[i]);
+        if(found != otherTiles.constEnd())
+            tiles[i] = other.tiles[found.value()];
+    }
+}
+
+/**************************************************************************//**
+ * @brief Writes the packed tiles to the swap file and reads them through its
+ * mapping from then on, which frees the memory they took.  Tiles shared with
+ * an image that stays in memory are written too, so the two no longer share
+ * them.
+ *
+ * @returns true if the tiles were moved, false if the swap file couldn't
+ * take them and they are still in memory
+ *****************************************************************************/
+bool PackedImage::spill()
+{
+    if(isSpilled() || isNull())
+        return isSpilled();
+
+    QByteArray data;
+    for(int i = 0; i < tiles.size(); i++)
+        data.append(tiles[i]);
+
+    QSharedPointer<SwapRegion> stored = HistorySwap::store(data);
+    if(stored.isNull())
+        return false;
+
+    const char *mapped = reinterpret_cast<const char *>(stored->data());
+    for(int i = 0; i < tiles.size(); i++)
+    {
+        const int size = tiles[i].size();
+        tiles[i] = QByteArray::fromRawData(mapped, size);
+        mapped += size;
+    }
+
+    region = stored;
+    return true;
+}
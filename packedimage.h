@@ -0,0 +1,67 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the PackedImage class.
+ *****************************************************************************/
+
+#ifndef PACKEDIMAGE_H
+#define PACKEDIMAGE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include <QSharedPointer>
+#include "tiledimage.h"
+#include "historyswap.h"
+
+/**************************************************************************//**
+ * @brief A TiledImage with every tile compressed on its own.
+ *
+ * Tiles are packed with a fast zlib level, since they are packed in the
+ * background and unpacked while the user waits for an undo.  Each packed
+ * tile remembers the cacheKey() of the tile it came from, so two images that
+ * shared a tile can share its packed bytes as well (see shareTiles()).
+ *
+ * spill() moves the packed tiles to the swap file (see HistorySwap).  They
+ * are read through the mapping from then on, so unpack() works the same.
+ *****************************************************************************/
+class PackedImage
+{
+public:
+    PackedImage();
+
+    //Compresses every tile of image.  Safe to call from any thread.
+    static PackedImage pack(const TiledImage &image);
+
+    //The tiles back as they were
+    TiledImage unpack() const;
+
+    bool isNull() const { return tiles.isEmpty(); }
+    int tileCount() const { return tiles.size(); }
+    const QByteArray &tile(int index) const { return tiles[index]; }
+    qint64 tileKey(int index) const { return keys[index]; }
+
+    //Bytes of the pixels of a tile once unpacked
+    int tileRawBytes(int index) const { return rawSizes[index]; }
+
+    //Uses the packed bytes of other for the tiles both were packed from
+    void shareTiles(const PackedImage &other);
+
+    //Moves the packed tiles out of memory, false if they had to stay
+    bool spill();
+    bool isSpilled() const { return !region.isNull(); }
+
+    //zlib level, 1 is the fastest
+    static const int CompressionLevel = 1;
+
+private:
+    QSize imageSize;
+    QImage::Format imageFormat;
+    QVector<QRgb> colorTable;
+    QVector<QByteArray> tiles;  //Row major, as in TiledImage
+    QVector<qint64> keys;       //cacheKey() of the tiles they were packed from
+    QVector<int> rawSizes;
+    QSharedPointer<SwapRegion> region;  //Holds the tiles once spilled
+};
+
+#endif // PACKEDIMAGE_H
@@ -0,0 +1,488 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Chains of effects that can be recorded, saved and applied to any
+ * image, in the editor or in batch.
+ *****************************************************************************/
+
+#include "pipeline.h"
+#include "effects.h"
+#include "medianfilter.h"
+#include "scanline.h"
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegExp>
+#include <QStringList>
+#include <QVector>
+#include <QDebug>
+#include <limits.h>
+
+using namespace std::placeholders;
+
+namespace
+{
+
+//Crops an image, for "crop(x, y, w, h)"
+QImage cropStep(const QImage &source, ScratchPool &, QRect area)
+{
+    return source.copy(area);
+}
+
+//Scales an image, for "resize(w, h)"
+QImage resizeStep(const QImage &source, ScratchPool &, int width, int height)
+{
+    return source.scaled(width, height);
+}
+
+//Values a parameter may take, those of its dialog
+struct Range
+{
+    double min;
+    double max;
+};
+
+//Parameters each effect takes
+QHash<QString, QVector<Range> > parameterRanges()
+{
+    const Range channel = { 0, 255 };
+    const Range size = { 1, INT_MAX };
+
+    QHash<QString, QVector<Range> > parameters;
+    parameters["grayscale"] = QVector<Range>();
+    parameters["sharpen"] = QVector<Range>();
+    parameters["soften"] = QVector<Range>();
+    parameters["negative"] = QVector<Range>();
+    parameters["edge"] = QVector<Range>();
+    parameters["emboss"] = QVector<Range>();
+    parameters["despeckle"] = QVector<Range>() << channel << Range{ 1, 10 };
+    parameters["posterize"] = QVector<Range>() << Range{ 2, 16 };
+    parameters["posterizePalette"] = QVector<Range>() << Range{ 2, 256 };
+    parameters["gamma"] = QVector<Range>() << Range{ 0, 5 };
+    parameters["brightness"] = QVector<Range>() << Range{ -255, 255 };
+    parameters["binaryThreshold"] = QVector<Range>() << channel;
+    parameters["contrast"] = QVector<Range>() << channel << channel;
+    parameters["balance"] = QVector<Range>() << Range{ -255, 255 } << channel << channel << Range{ 0, 5 };
+    parameters["resize"] = QVector<Range>() << size << size;
+    parameters["crop"] = QVector<Range>() << Range{ 0, INT_MAX } << Range{ 0, INT_MAX } << size << size;
+    return parameters;
+}
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Returns the operation the way the undo journal names it, e.g.
+ * "contrast(30, 200)" or "sharpen()".
+ *****************************************************************************/
+QString Pipeline::Operation::text() const
+{
+    QStringList values;
+    for(int i = 0; i < parameters.size(); i++)
+        values << QString::number(parameters[i]);
+
+    return QString("%1(%2)").arg(effect).arg(values.join(", "));
+}
+
+/**************************************************************************//**
+ * @brief Appends operations written as text.  Operations are separated by
+ * ';' or new lines; empty lines and lines starting with '#' are skipped.
+ *
+ * @param[in] text - e.g. "sharpen; gamma(1.8)", or an entry of the undo
+ * journal
+ * @param[out] error - Why the text was rejected
+ *
+ * @returns true if every operation was appended, false if none was
+ *****************************************************************************/
+bool Pipeline::append(const QString &text, QString *error)
+{
+    QList<Operation> parsed;
+    foreach(const QString &line, text.split('\n'))
+    {
+        if(line.trimmed().startsWith('#'))
+            continue;
+
+        foreach(const QString &part, line.split(';', QString::SkipEmptyParts))
+        {
+            if(part.trimmed().isEmpty())
+                continue;
+
+            Operation operation;
+            if(!parse(part, &operation, error))
+                return false;
+            parsed.append(operation);
+        }
+    }
+
+    operations.append(parsed);
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Returns the operations separated by "; ".  append() reads it back,
+ * and the undo journal names a pipeline applied at once with it.
+ *****************************************************************************/
+QString Pipeline::text() const
+{
+    QStringList texts;
+    for(int i = 0; i < operations.size(); i++)
+        texts << operations[i].text();
+
+    return texts.join("; ");
+}
+
+/**************************************************************************//**
+ * @brief Replaces the operations with those of a file.  A file starting
+ * with '{' is read as JSON (see save()), anything else as text with an
+ * operation per line.
+ *
+ * @param[in] fileName - The file to read
+ * @param[out] error - Why the file was rejected
+ *
+ * @returns true if the file was read, false if the pipeline is unchanged
+ *****************************************************************************/
+bool Pipeline::load(const QString &fileName, QString *error)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        *error = QString("cannot read %1").arg(fileName);
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    Pipeline loaded;
+
+    if(!data.trimmed().startsWith('{'))
+    {
+        if(!loaded.append(QString::fromUtf8(data), error))
+            return false;
+
+        operations = loaded.operations;
+        return true;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(data, &parseError);
+    if(document.isNull())
+    {
+        *error = QString("%1: %2").arg(fileName).arg(parseError.errorString());
+        return false;
+    }
+
+    QJsonArray entries = document.object().value("pipeline").toArray();
+    for(int i = 0; i < entries.size(); i++)
+    {
+        QJsonObject entry = entries[i].toObject();
+        QJsonArray values = entry.value("parameters").toArray();
+
+        Operation operation;
+        operation.effect = entry.value("effect").toString();
+        for(int j = 0; j < values.size(); j++)
+            operation.parameters.append(values[j].toDouble());
+
+        if(!check(operation, error))
+            return false;
+        loaded.operations.append(operation);
+    }
+
+    operations = loaded.operations;
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Writes the operations to a JSON file.
+ *
+ * @param[in] fileName - The file to write
+ *
+ * @returns true if the file was written
+ *****************************************************************************/
+bool Pipeline::save(const QString &fileName) const
+{
+    QJsonArray entries;
+    for(int i = 0; i < operations.size(); i++)
+    {
+        QJsonArray values;
+        for(int j = 0; j < operations[i].parameters.size(); j++)
+            values.append(operations[i].parameters[j]);
+
+        QJsonObject entry;
+        entry.insert("effect", operations[i].effect);
+        entry.insert("parameters", values);
+        entries.append(entry);
+    }
+
+    QJsonObject root;
+    root.insert("pipeline", entries);
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+       file.write(QJsonDocument(root).toJson()) < 0)
+    {
+        qDebug() << "Pipeline::save -> Cannot write" << fileName;
+        return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Applies the operations in order.  Each one reads the result of the
+ * one before, which goes back to the pool once it is replaced.  A run of two
+ * or more point operations is applied in a single pass by applyPoints().
+ *
+ * @param[in] image - The image to start from; it is not changed
+ * @param[in] scratch - Pool the operations write into
+ *
+ * @returns The result in the format it is stored in, or null if an
+ * operation rejected its parameters
+ *****************************************************************************/
+QImage Pipeline::apply(const QImage &image, ScratchPool &scratch) const
+{
+    QImage current = image;
+    bool owned = false;  //current is a result of ours, not the caller's image
+
+    int first = 0;
+    while(first < operations.size())
+    {
+        int last = first + 1;
+        if(isPointOperation(operations[first]))
+        {
+            while(last < operations.size() && isPointOperation(operations[last]))
+                last++;
+
+            //A posterize at the end keeps its indexed result, which takes a
+            //quarter of the memory in the history
+            if(last - first > 1 && operations[last - 1].effect == "posterize")
+                last--;
+        }
+
+        QImage source = Scanline::normalized(current);
+        QImage next;
+        if(last - first > 1)
+            next = applyPoints(first, last, source, scratch);
+        else
+            next = step(operations[first])(source, scratch);
+
+        source = QImage();
+        if(owned)
+            scratch.recycle(current);
+        if(next.isNull())
+            return next;
+
+        current = Scanline::stored(next);
+        owned = true;
+        first = last;
+    }
+
+    return Scanline::stored(current);
+}
+
+/**************************************************************************//**
+ * @brief Returns how far the operations reach beyond a pixel, added up over
+ * the pipeline: a strip of rows with this many more rows on either side
+ * gives the same rows as the whole image would.  Used by StripStream.
+ *
+ * @returns The rows, or WholeImage for a palette, resize or crop
+ *****************************************************************************/
+int Pipeline::halo() const
+{
+    int rows = 0;
+    for(int i = 0; i < operations.size(); i++)
+    {
+        const QString &name = operations[i].effect;
+        if(name == "posterizePalette" || name == "resize" || name == "crop")
+            return WholeImage;
+
+        //3x3 masks, and the median window of despeckle
+        if(name == "sharpen" || name == "soften" || name == "edge" || name == "emboss")
+            rows += 1;
+        else if(name == "despeckle")
+            rows += qBound(1, int(operations[i].parameters[1]), int(MedianFilter::MaximumRadius));
+    }
+
+    return rows;
+}
+
+/**************************************************************************//**
+ * @brief Makes the step of an operation.
+ *
+ * @param[in] operation - An operation that passed check()
+ *
+ * @returns The Effects kernel, or the crop or resize, with the parameters
+ * bound
+ *****************************************************************************/
+Pipeline::Step Pipeline::step(const Operation &operation)
+{
+    const QString &name = operation.effect;
+    const QVector<double> &v = operation.parameters;
+
+    if(name == "grayscale")
+        return Effects::grayscale;
+    if(name == "sharpen")
+        return Effects::sharpen;
+    if(name == "soften")
+        return Effects::soften;
+    if(name == "negative")
+        return Effects::negative;
+    if(name == "edge")
+        return Effects::edge;
+    if(name == "emboss")
+        return Effects::emboss;
+    if(name == "despeckle")
+        return std::bind(Effects::despeckle, _1, _2, int(v[0]), int(v[1]));
+    if(name == "posterize")
+        return std::bind(Effects::posterize, _1, _2, int(v[0]));
+    if(name == "posterizePalette")
+        return std::bind(Effects::posterizePalette, _1, _2, int(v[0]));
+    if(name == "gamma")
+        return std::bind(Effects::gamma, _1, _2, v[0]);
+    if(name == "brightness")
+        return std::bind(Effects::brightness, _1, _2, int(v[0]));
+    if(name == "binaryThreshold")
+        return std::bind(Effects::binaryThreshold, _1, _2, int(v[0]));
+    if(name == "contrast")
+        return std::bind(Effects::contrast, _1, _2, int(v[0]), int(v[1]));
+    if(name == "balance")
+        return std::bind(Effects::balance, _1, _2, int(v[0]), int(v[1]), int(v[2]), v[3]);
+    if(name == "resize")
+        return std::bind(resizeStep, _1, _2, int(v[0]), int(v[1]));
+
+    return std::bind(cropStep, _1, _2, QRect(int(v[0]), int(v[1]), int(v[2]), int(v[3])));
+}
+
+/**************************************************************************//**
+ * @brief Parses one operation, e.g. "contrast(30, 200)".  The parentheses
+ * may be left out of an effect without parameters.
+ *
+ * @param[in] text - The operation
+ * @param[out] operation - The parsed operation
+ * @param[out] error - Why the text was rejected
+ *****************************************************************************/
+bool Pipeline::parse(const QString &text, Operation *operation, QString *error)
+{
+    QRegExp syntax("\\s*(\\w+)\\s*(?:\\(([^)]*)\\))?\\s*");
+    if(!syntax.exactMatch(text))
+    {
+        *error = QString("\"%1\" is not an effect").arg(text.trimmed());
+        return false;
+    }
+
+    operation->effect = syntax.cap(1);
+    operation->parameters.clear();
+    foreach(const QString &value, syntax.cap(2).split(',', QString::SkipEmptyParts))
+    {
+        bool ok = false;
+        operation->parameters.append(value.trimmed().toDouble(&ok));
+        if(!ok)
+        {
+            *error = QString("\"%1\" is not a number in \"%2\"").arg(value.trimmed()).arg(text.trimmed());
+            return false;
+        }
+    }
+
+    return check(*operation, error);
+}
+
+/**************************************************************************//**
+ * @brief Checks that an operation names an effect, has as many parameters
+ * as it takes, and that each is in the range its dialog allows.  Pipelines
+ * from a file or the command line can't give an effect values the editor
+ * never would.
+ *
+ * @param[in] operation - The operation
+ * @param[out] error - Why the operation was rejected
+ *****************************************************************************/
+bool Pipeline::check(const Operation &operation, QString *error)
+{
+    static const QHash<QString, QVector<Range> > parameters = parameterRanges();
+
+    if(!parameters.contains(operation.effect))
+    {
+        *error = QString("unknown effect \"%1\"").arg(operation.effect);
+        return false;
+    }
+
+    const QVector<Range> ranges = parameters.value(operation.effect);
+    if(ranges.size() != operation.parameters.size())
+    {
+        *error = QString("%1 takes %2 parameters").arg(operation.effect).arg(ranges.size());
+        return false;
+    }
+
+    for(int i = 0; i < ranges.size(); i++)
+    {
+        const double value = operation.parameters[i];
+        if(!(value >= ranges[i].min && value <= ranges[i].max))
+        {
+            *error = QString("parameter %1 of %2 must be between %3 and %4, not %5")
+                     .arg(i + 1).arg(operation.effect).arg(ranges[i].min).arg(ranges[i].max).arg(value);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Returns whether an operation sends each channel value through the
+ * same table, independent of the other channels and of the neighbours.
+ *****************************************************************************/
+bool Pipeline::isPointOperation(const Operation &operation)
+{
+    const QString &name = operation.effect;
+    return name == "brightness" || name == "contrast" || name == "gamma" ||
+           name == "negative" || name == "posterize" || name == "balance";
+}
+
+/**************************************************************************//**
+ * @brief Applies a run of point operations in one pass.  Their tables are
+ * composed into one, so the pixels are read and written once however long
+ * the run is, and the result is the same as applying them one by one.
+ *
+ * @param[in] first - First operation of the run
+ * @param[in] last - One past the last operation of the run
+ * @param[in] source - Format_ARGB32 image
+ * @param[in] scratch - Pool the result is taken from
+ *
+ * @returns The result, or null if an operation rejected its parameters
+ *****************************************************************************/
+QImage Pipeline::applyPoints(int first, int last, const QImage &source, ScratchPool &scratch) const
+{
+    EffectTimer timer("Pipeline::applyPoints", source.size());
+
+    //The table of an operation is what its kernel does to a ramp of the 256
+    //gray levels.  The ramp is transparent, so it also shows whether the
+    //kernel makes the pixels opaque.
+    QImage ramp(256, 1, QImage::Format_ARGB32);
+    QRgb *levels = Scanline::row(ramp, 0);
+    for(int i = 0; i < 256; i++)
+        levels[i] = qRgba(i, i, i, 0);
+
+    int lut[256];
+    for(int i = 0; i < 256; i++)
+        lut[i] = i;
+    bool opaque = false;
+
+    ScratchPool rampScratch;
+    for(int i = first; i < last; i++)
+    {
+        QImage mapped = Scanline::normalized(step(operations[i])(ramp, rampScratch));
+        if(mapped.isNull())
+            return QImage();
+
+        const QRgb *table = Scanline::constRow(mapped, 0);
+        for(int j = 0; j < 256; j++)
+            lut[j] = qRed(table[lut[j]]);
+        opaque = opaque || qAlpha(table[0]) == 255;
+    }
+
+    QImage image = scratch.acquire(source.size(), QImage::Format_ARGB32);
+    const QRgb alpha = opaque ? 0xff000000 : 0;
+    Scanline::mapPixels(source, image, [&](QRgb pixel) {
+        return qRgba(lut[qRed(pixel)], lut[qGreen(pixel)], lut[qBlue(pixel)], qAlpha(pixel)) | alpha;
+    });
+
+    return image;
+}
@@ -0,0 +1,89 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the Pipeline class.
+ *****************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <functional>
+#include "scratchpool.h"
+
+/**************************************************************************//**
+ * @brief An ordered chain of effects with their parameters, e.g. a macro
+ * recorded in the editor or the effects of a batch run.
+ *
+ * Operations are written the way the undo journal names them: "sharpen",
+ * "gamma(1.8)" or "resize(800, 600)", one per line or separated by ';'.  A
+ * pipeline is saved as a small JSON file:
+ *
+ * @verbatim
+   { "pipeline": [ { "effect": "gamma", "parameters": [ 1.8 ] },
+                   { "effect": "sharpen", "parameters": [ ] } ] }
+   @endverbatim
+ *
+ * apply() runs the chain on an image.  Adjacent operations that map each
+ * channel value through a table (brightness, contrast, gamma, negative,
+ * posterize and balance) are fused into one table and one pass over the
+ * pixels.  Every other operation runs through its Effects kernel, which
+ * splits the rows into bands on the BandScheduler threads.
+ *****************************************************************************/
+class Pipeline
+{
+public:
+    //One effect with its parameters.  Takes a Format_ARGB32 image.
+    typedef std::function<QImage (const QImage &source, ScratchPool &scratch)> Step;
+
+    struct Operation
+    {
+        QString effect;
+        QVector<double> parameters;
+
+        //As the undo journal names it, e.g. "gamma(1.8)"
+        QString text() const;
+    };
+
+    bool isEmpty() const { return operations.isEmpty(); }
+    int size() const { return operations.size(); }
+    const Operation &operation(int i) const { return operations[i]; }
+    void clear() { operations.clear(); }
+
+    //Appends the operations in text.  Nothing is appended if any of them is
+    //wrong, in which case error says why.
+    bool append(const QString &text, QString *error);
+
+    //The operations separated by "; ", e.g. "sharpen(); gamma(1.8)"
+    QString text() const;
+
+    //JSON file, or a text file with an operation per line
+    bool load(const QString &fileName, QString *error);
+    bool save(const QString &fileName) const;
+
+    //Applies the operations in order.  image is Format_ARGB32 or
+    //Format_Indexed8; the result is in the format it is stored in, or null
+    //if an operation rejected its parameters.
+    QImage apply(const QImage &image, ScratchPool &scratch) const;
+
+    //Rows above and below a strip the operations read to get the rows of
+    //the strip right, or WholeImage if a result depends on the whole image
+    int halo() const;
+    static const int WholeImage = -1;
+
+    //The Effects kernel of one operation with its parameters bound
+    static Step step(const Operation &operation);
+
+private:
+    static bool parse(const QString &text, Operation *operation, QString *error);
+    static bool check(const Operation &operation, QString *error);
+    static bool isPointOperation(const Operation &operation);
+    QImage applyPoints(int first, int last, const QImage &source, ScratchPool &scratch) const;
+
+    QList<Operation> operations;
+};
+
+#endif // PIPELINE_H
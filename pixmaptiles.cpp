@@ -0,0 +1,101 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Pixmap tiles of the image a view shows, uploaded only when they
+ * changed and are in view.
+ *****************************************************************************/
+
+#include "pixmaptiles.h"
+#include <QPainter>
+
+/**************************************************************************//**
+ * @brief Constructor.  There are no tiles until the size is known.
+ *****************************************************************************/
+PixmapTiles::PixmapTiles()
+{
+    columns = 0;
+    rows = 0;
+}
+
+/**************************************************************************//**
+ * @brief Drops the tiles under part of the image, so draw() makes them again
+ * from the image as it is then.
+ *
+ * @param[in] size - Size of the image now
+ * @param[in] area - Part of the image that changed
+ *****************************************************************************/
+void PixmapTiles::invalidate(const QSize &size, const QRect &area)
+{
+    if(size != imageSize)
+    {
+        imageSize = size;
+        columns = (size.width() + TileSize - 1) / TileSize;
+        rows = (size.height() + TileSize - 1) / TileSize;
+        tiles = QVector<QPixmap>(columns * rows);
+        return;
+    }
+
+    QRect changed = area & QRect(QPoint(0, 0), size);
+    if(changed.isEmpty())
+        return;
+
+    for(int row = changed.top() / TileSize; row <= changed.bottom() / TileSize; row++)
+    {
+        for(int column = changed.left() / TileSize; column <= changed.right() / TileSize; column++)
+            tiles[row * columns + column] = QPixmap();
+    }
+}
+
+/**************************************************************************//**
+ * @brief Draws the tiles an exposed area of the item touches.  A tile that
+ * was dropped is made from the image first; 32 bit images are read in
+ * place, without copying the tile out of them.
+ *
+ * @param[in] painter - Painter of the item, in image coordinates
+ * @param[in] exposed - Part of the image to draw
+ * @param[in] source - The image, as it was when invalidate() was last called
+ *****************************************************************************/
+void PixmapTiles::draw(QPainter *painter, const QRectF &exposed, const QImage &source)
+{
+    if(source.size() != imageSize)
+        invalidate(source.size(), source.rect());
+
+    QRect area = exposed.toAlignedRect() & source.rect();
+    if(area.isEmpty())
+        return;
+
+    for(int row = area.top() / TileSize; row <= area.bottom() / TileSize; row++)
+    {
+        for(int column = area.left() / TileSize; column <= area.right() / TileSize; column++)
+        {
+            QRect rect = tileRect(column, row);
+            QPixmap &tile = tiles[row * columns + column];
+
+            if(tile.isNull())
+            {
+                if(source.depth() == 32)
+                {
+                    const uchar *bits = source.constScanLine(rect.y()) + rect.x() * 4;
+                    tile = QPixmap::fromImage(QImage(bits, rect.width(), rect.height(),
+                                                     source.bytesPerLine(), source.format()));
+                }
+                else
+                {
+                    tile = QPixmap::fromImage(source.copy(rect));
+                }
+            }
+
+            painter->drawPixmap(rect.topLeft(), tile);
+        }
+    }
+}
+
+/**************************************************************************//**
+ * @brief Returns the area of a tile in the image.  Tiles on the right and
+ * bottom edges are smaller when the size is not a multiple of TileSize.
+ *****************************************************************************/
+QRect PixmapTiles::tileRect(int column, int row) const
+{
+    QRect rect(column * TileSize, row * TileSize, TileSize, TileSize);
+    return rect & QRect(QPoint(0, 0), imageSize);
+}
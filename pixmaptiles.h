@@ -0,0 +1,50 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the PixmapTiles class.
+ *****************************************************************************/
+
+#ifndef PIXMAPTILES_H
+#define PIXMAPTILES_H
+
+#include <QImage>
+#include <QPixmap>
+#include <QRectF>
+#include <QVector>
+
+class QPainter;
+
+/**************************************************************************//**
+ * @brief The pixmap a view draws of an image, kept as TileSize x TileSize
+ * tiles that are made only when they are drawn.
+ *
+ * invalidate() drops the tiles under the area of the image that changed.
+ * draw() re-creates the dropped tiles that are exposed and draws them; the
+ * ones out of view stay dropped until they are scrolled in.  A cut, a paste
+ * or a preview of a part of the image therefore only uploads the tiles it
+ * touched, and panning a huge image only uploads what comes into view.
+ *****************************************************************************/
+class PixmapTiles
+{
+public:
+    PixmapTiles();
+
+    //Drops the tiles under area of an image of size size.  A new size
+    //drops every tile.
+    void invalidate(const QSize &size, const QRect &area);
+
+    //Draws the tiles under exposed, making the missing ones from source
+    void draw(QPainter *painter, const QRectF &exposed, const QImage &source);
+
+    static const int TileSize = 256;
+
+private:
+    QRect tileRect(int column, int row) const;
+
+    QSize imageSize;
+    int columns;
+    int rows;
+    QVector<QPixmap> tiles;  //Row major, null until drawn
+};
+
+#endif // PIXMAPTILES_H
@@ -0,0 +1,627 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Streams rows into a PNG file, for images too large to be encoded
+ * in one piece, and deflates them on all cores.
+ *****************************************************************************/
+
+#include "pngwriter.h"
+#include "bandscheduler.h"
+#include "scanline.h"
+#include <QAtomicInt>
+#include <QDebug>
+#include <QVector>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+
+const char Signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+
+//History deflate can refer back into, and so the dictionary of a block
+const int WindowSize = 1 << 15;
+
+//Z_DEFAULT_COMPRESSION unless set from the settings
+QAtomicInt pngLevel(6);
+
+//PNG stores numbers big endian
+void appendUint32(QByteArray &data, quint32 value)
+{
+    data.append(char(value >> 24));
+    data.append(char(value >> 16));
+    data.append(char(value >> 8));
+    data.append(char(value));
+}
+
+//Whichever of left, up and upper left is closest to left + up - upLeft
+inline int paeth(int left, int up, int upLeft)
+{
+    int estimate = left + up - upLeft;
+    int toLeft = abs(estimate - left);
+    int toUp = abs(estimate - up);
+    int toUpLeft = abs(estimate - upLeft);
+
+    if(toLeft <= toUp && toLeft <= toUpLeft)
+        return left;
+    if(toUp <= toUpLeft)
+        return up;
+    return upLeft;
+}
+
+//Bytes of a row as the file stores them, before filtering
+void unpackRow(const QImage &image, int y, int channels, uchar *raw)
+{
+    const QRgb *pixels = Scanline::constRow(image, y);
+    for(int x = 0; x < image.width(); x++)
+    {
+        uchar *channel = raw + x * channels;
+        channel[0] = qRed(pixels[x]);
+        channel[1] = qGreen(pixels[x]);
+        channel[2] = qBlue(pixels[x]);
+        if(4 == channels)
+            channel[3] = qAlpha(pixels[x]);
+    }
+}
+
+//One of the PNG filters: each byte minus its prediction from the bytes of
+//the same channel to the left, above and above left, after the filter type
+void applyFilter(int type, const uchar *raw, const uchar *up, int rowBytes, int channels, uchar *out)
+{
+    out[0] = type;
+    out++;
+    for(int i = 0; i < rowBytes; i++)
+    {
+        int left = (i >= channels) ? raw[i - channels] : 0;
+        int upLeft = (i >= channels) ? up[i - channels] : 0;
+
+        int prediction;
+        switch(type)
+        {
+        case 0:  prediction = 0; break;
+        case 1:  prediction = left; break;
+        case 2:  prediction = up[i]; break;
+        case 3:  prediction = (left + up[i]) / 2; break;
+        default: prediction = paeth(left, up[i], upLeft); break;
+        }
+        out[i] = raw[i] - prediction;
+    }
+}
+
+//Sum of the filtered bytes taken as signed, the estimate libpng uses
+int filterCost(const uchar *filtered, int rowBytes)
+{
+    int sum = 0;
+    for(int i = 1; i <= rowBytes; i++)
+        sum += abs(int(static_cast<signed char>(filtered[i])));
+    return sum;
+}
+
+//Paeth, or with adaptive filtering the filter with the lowest cost, which
+//is what libpng picks; trial has room for a filtered row
+void filterRow(const uchar *raw, const uchar *up, int rowBytes, int channels,
+               bool adaptive, uchar *out, uchar *trial)
+{
+    applyFilter(4, raw, up, rowBytes, channels, out);
+    if(!adaptive)
+        return;
+
+    int best = filterCost(out, rowBytes);
+    for(int type = 0; type < 4; type++)
+    {
+        applyFilter(type, raw, up, rowBytes, channels, trial);
+        int cost = filterCost(trial, rowBytes);
+        if(cost < best)
+        {
+            best = cost;
+            memcpy(out, trial, rowBytes + 1);
+        }
+    }
+}
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Constructor.  Nothing is written until open().
+ *****************************************************************************/
+PngWriter::PngWriter()
+{
+    isOpen = false;
+    level = defaultLevel();
+    channels = 3;
+    rowsWritten = 0;
+    adler = adler32(0, NULL, 0);
+    dotsPerMeterX = 0;
+    dotsPerMeterY = 0;
+}
+
+/**************************************************************************//**
+ * @brief Sets how hard the files opened after are compressed.
+ *
+ * @param[in] level - 0 stores, 1 is the fastest and 9 the smallest
+ *****************************************************************************/
+void PngWriter::setLevel(int level)
+{
+    this->level = qBound(0, level, 9);
+}
+
+/**************************************************************************//**
+ * @brief Sets the physical size of the pixels written to the files opened
+ * after.  Nothing is written unless both are positive.
+ *
+ * @param[in] dotsPerMeterX - Horizontal pixels per meter
+ * @param[in] dotsPerMeterY - Vertical pixels per meter
+ *****************************************************************************/
+void PngWriter::setResolution(int dotsPerMeterX, int dotsPerMeterY)
+{
+    this->dotsPerMeterX = dotsPerMeterX;
+    this->dotsPerMeterY = dotsPerMeterY;
+}
+
+/**************************************************************************//**
+ * @brief Adds a text chunk to the files opened after, e.g. what
+ * QImage::text() or QImageReader::text() returns for a key.
+ *
+ * @param[in] key - Keyword, Latin-1, 1 to 79 characters
+ * @param[in] value - The text
+ *****************************************************************************/
+void PngWriter::setText(const QString &key, const QString &value)
+{
+    texts.append(qMakePair(key, value));
+}
+
+/**************************************************************************//**
+ * @brief Creates the file and writes the signature, the IHDR chunk and the
+ * metadata.
+ *
+ * @param[in] fileName - The file to write
+ * @param[in] size - Size of the image
+ * @param[in] alpha - Whether to keep the alpha channel
+ *****************************************************************************/
+bool PngWriter::open(const QString &fileName, const QSize &size, bool alpha)
+{
+    error.clear();
+    imageSize = size;
+    channels = alpha ? 4 : 3;
+    rowsWritten = 0;
+
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        fail(QString("cannot write %1").arg(fileName));
+        return false;
+    }
+    isOpen = true;
+
+    QByteArray header;
+    appendUint32(header, size.width());
+    appendUint32(header, size.height());
+    header.append(char(8));              //Bits per channel
+    header.append(char(alpha ? 6 : 2));  //RGBA or RGB
+    header.append(char(0));              //Deflate
+    header.append(char(0));              //Adaptive filtering
+    header.append(char(0));              //Not interlaced
+
+    file.write(Signature, sizeof(Signature));
+    writeChunk("IHDR", header);
+    writeMetadata();
+
+    previous = QByteArray(size.width() * channels, 0);
+    pending.clear();
+    dictionary.clear();
+    compressed.clear();
+    adler = adler32(0, NULL, 0);
+
+    //zlib header: deflate with a 32 KB window, the level as a hint, and a
+    //check value making it a multiple of 31
+    int zlibHeader = 0x7800 | ((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6);
+    if(zlibHeader % 31)
+        zlibHeader += 31 - zlibHeader % 31;
+    compressed.append(char(zlibHeader >> 8));
+    compressed.append(char(zlibHeader));
+
+    return error.isEmpty();
+}
+
+/**************************************************************************//**
+ * @brief Filters rows and collects them for deflate.  Rows must be written
+ * top to bottom.  However many rows come in, they are taken a batch at a
+ * time and each full batch is compressed and written before the next one is
+ * filtered, so the writer never holds more than bufferBytes().
+ *
+ * @param[in] image - Format_ARGB32 image as wide as the file
+ * @param[in] first - First row of image to write
+ * @param[in] count - Number of rows to write
+ *****************************************************************************/
+bool PngWriter::writeRows(const QImage &image, int first, int count)
+{
+    if(!isOpen)
+        return false;
+
+    if(image.format() != QImage::Format_ARGB32 || image.width() != imageSize.width() ||
+       rowsWritten + count > imageSize.height())
+    {
+        fail("the rows don't fit the image");
+        return false;
+    }
+
+    const int stride = imageSize.width() * channels + 1;
+    while(count > 0 && error.isEmpty())
+    {
+        //As many rows as the batch has room for, at least one
+        const int rows = qBound(1, (BatchSize - pending.size()) / stride, count);
+        filterRows(image, first, rows);
+        first += rows;
+        count -= rows;
+
+        if(pending.size() + stride > BatchSize)
+        {
+            deflateBatch(false);
+            writeIdat(false);
+        }
+    }
+
+    return error.isEmpty();
+}
+
+/**************************************************************************//**
+ * @brief Returns the most memory a writer for an image of a width holds:
+ * a batch of filtered rows, its deflated blocks and the stream they are
+ * collected into, and the rows each BandScheduler thread filters in.
+ *
+ * @param[in] width - Width of the image
+ *****************************************************************************/
+qint64 PngWriter::bufferBytes(int width)
+{
+    const qint64 stride = qint64(width) * 4 + 1;
+    return 3 * qMax<qint64>(BatchSize, stride) + 3 * stride * BandScheduler::threadCount();
+}
+
+/**************************************************************************//**
+ * @brief Filters rows on the BandScheduler threads and appends them to the
+ * pending batch.
+ *
+ * @param[in] image - Format_ARGB32 image as wide as the file
+ * @param[in] first - First row of image to filter
+ * @param[in] count - Number of rows, that fit the batch
+ *****************************************************************************/
+void PngWriter::filterRows(const QImage &image, int first, int count)
+{
+    const int rowBytes = imageSize.width() * channels;
+    const int stride = rowBytes + 1;
+    const int offset = pending.size();
+    pending.resize(offset + count * stride);
+
+    uchar *out = reinterpret_cast<uchar *>(pending.data()) + offset;
+    const QByteArray above = previous;
+    const int pixelBytes = channels;
+
+    //Trying every filter pays off in size, except at the fastest levels
+    const bool adaptive = level > 1;
+
+    //A band unpacks the row above its first one itself, so bands only share
+    //the image
+    BandScheduler::run(count, 0, [&](const Band &band) {
+        QByteArray up = above;
+        QByteArray raw(rowBytes, 0);
+        QByteArray trial(stride, 0);
+        if(band.first > 0)
+            unpackRow(image, first + band.first - 1, pixelBytes, reinterpret_cast<uchar *>(up.data()));
+
+        for(int y = band.first; y < band.last; y++)
+        {
+            unpackRow(image, first + y, pixelBytes, reinterpret_cast<uchar *>(raw.data()));
+            filterRow(reinterpret_cast<const uchar *>(raw.constData()),
+                      reinterpret_cast<const uchar *>(up.constData()),
+                      rowBytes, pixelBytes, adaptive, out + y * stride,
+                      reinterpret_cast<uchar *>(trial.data()));
+            up.swap(raw);
+        }
+    });
+
+    unpackRow(image, first + count - 1, channels, reinterpret_cast<uchar *>(previous.data()));
+    rowsWritten += count;
+}
+
+/**************************************************************************//**
+ * @brief Compresses the rows left, ends the zlib stream and writes the IEND
+ * chunk.  The file only replaces the target if it is complete.
+ *
+ * @returns true if the whole image was written
+ *****************************************************************************/
+bool PngWriter::close()
+{
+    if(!isOpen)
+        return false;
+
+    if(rowsWritten != imageSize.height())
+        fail(QString("%1 of %2 rows written").arg(rowsWritten).arg(imageSize.height()));
+
+    deflateBatch(true);
+    writeIdat(true);
+    writeChunk("IEND", QByteArray());
+    isOpen = false;
+
+    if(!error.isEmpty())
+    {
+        //Discards the temporary file, the target stays as it was
+        file.cancelWriting();
+        file.commit();
+        return false;
+    }
+
+    if(!file.commit())
+    {
+        fail(file.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Deflates the pending rows in parallel.  Each band of the
+ * BandScheduler compresses one block of them as raw deflate, primed with
+ * the 32 KB before it; the blocks are appended in order and the Adler-32
+ * of the stream is updated from theirs.
+ *
+ * @param[in] last - Whether these are the last rows, so the final block
+ * ends the deflate stream and the trailer follows
+ *****************************************************************************/
+void PngWriter::deflateBatch(bool last)
+{
+    const int size = pending.size();
+    const int units = qMax((size + BlockUnit - 1) / BlockUnit, last ? 1 : 0);
+    if(0 == units)
+        return;
+
+    QVector<QByteArray> blocks(units);  //At the index of the first unit
+    QVector<uLong> sums(units);
+    QVector<int> ends(units, 0);        //Unit after the block, 0 if not run
+    QAtomicInt failed(0);
+
+    const char *data = pending.constData();
+    const QByteArray before = dictionary;
+    const int blockLevel = level;
+
+    BandScheduler::run(units, 0, [&](const Band &band) {
+        const int begin = band.first * BlockUnit;
+        const int end = qMin(band.last * BlockUnit, size);
+        const bool finishes = last && band.last == units;
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if(Z_OK != deflateInit2(&stream, blockLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+        {
+            failed.store(1);
+            return;
+        }
+
+        //The dictionary is what a single stream would have in its window
+        QByteArray window;
+        if(begin >= WindowSize)
+            window = QByteArray::fromRawData(data + begin - WindowSize, WindowSize);
+        else
+            window = (before + QByteArray(data, begin)).right(WindowSize);
+        if(!window.isEmpty())
+            deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(window.constData()), window.size());
+
+        QByteArray out(int(deflateBound(&stream, end - begin)) + 16, 0);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data + begin));
+        stream.avail_in = end - begin;
+        stream.next_out = reinterpret_cast<Bytef *>(out.data());
+        stream.avail_out = out.size();
+
+        //A sync flush ends the block on a byte boundary without ending the
+        //stream, so the next block can follow it
+        const int flush = finishes ? Z_FINISH : Z_SYNC_FLUSH;
+        for(;;)
+        {
+            int result = deflate(&stream, flush);
+            if(Z_STREAM_ERROR == result)
+            {
+                failed.store(1);
+                break;
+            }
+
+            const bool done = finishes ? (Z_STREAM_END == result) : (0 != stream.avail_out);
+            if(done)
+                break;
+
+            const int used = out.size() - stream.avail_out;
+            out.resize(out.size() * 2);
+            stream.next_out = reinterpret_cast<Bytef *>(out.data()) + used;
+            stream.avail_out = out.size() - used;
+        }
+
+        out.resize(out.size() - stream.avail_out);
+        deflateEnd(&stream);
+
+        blocks[band.first] = out;
+        sums[band.first] = adler32(adler32(0, NULL, 0), reinterpret_cast<const Bytef *>(data + begin), end - begin);
+        ends[band.first] = band.last;
+    });
+
+    for(int i = 0; i < units && !failed.load(); i = ends[i])
+    {
+        //A band the scheduler skipped, the stream would have a hole
+        if(ends[i] <= i)
+        {
+            failed.store(1);
+            break;
+        }
+
+        const int length = qMin(ends[i] * BlockUnit, size) - i * BlockUnit;
+        compressed.append(blocks[i]);
+        blocks[i] = QByteArray();
+        adler = adler32_combine(adler, sums[i], length);
+    }
+
+    if(failed.load())
+        fail("deflate failed");
+
+    if(size >= WindowSize)
+        dictionary = pending.right(WindowSize);
+    else
+        dictionary = (dictionary + pending).right(WindowSize);
+    pending.clear();
+
+    if(last)
+        appendUint32(compressed, quint32(adler));
+}
+
+/**************************************************************************//**
+ * @brief Writes the compressed data out in IDAT chunks.
+ *
+ * @param[in] last - Write the rest too, instead of full chunks only
+ *****************************************************************************/
+void PngWriter::writeIdat(bool last)
+{
+    int offset = 0;
+    while(compressed.size() - offset >= ChunkSize || (last && offset < compressed.size()))
+    {
+        const int length = qMin(int(ChunkSize), compressed.size() - offset);
+        writeChunk("IDAT", QByteArray::fromRawData(compressed.constData() + offset, length));
+        offset += length;
+    }
+
+    compressed.remove(0, offset);
+}
+
+/**************************************************************************//**
+ * @brief Writes the pHYs chunk and a text chunk per key.  Text that Latin-1
+ * can hold goes into tEXt, the rest into uncompressed iTXt as UTF-8.  Keys
+ * PNG doesn't allow are skipped.
+ *****************************************************************************/
+void PngWriter::writeMetadata()
+{
+    if(dotsPerMeterX > 0 && dotsPerMeterY > 0)
+    {
+        QByteArray physical;
+        appendUint32(physical, dotsPerMeterX);
+        appendUint32(physical, dotsPerMeterY);
+        physical.append(char(1));  //Unit is the meter
+        writeChunk("pHYs", physical);
+    }
+
+    for(int i = 0; i < texts.size(); i++)
+    {
+        const QString &key = texts[i].first;
+        const QString &value = texts[i].second;
+
+        const QByteArray keyword = key.toLatin1();
+        if(keyword.isEmpty() || keyword.size() > 79 || QString::fromLatin1(keyword) != key)
+        {
+            qDebug() << "PngWriter::writeMetadata -> skipping text key" << key;
+            continue;
+        }
+
+        const QByteArray latin1 = value.toLatin1();
+        if(QString::fromLatin1(latin1) == value)
+        {
+            writeChunk("tEXt", keyword + '\0' + latin1);
+        }
+        else
+        {
+            //No compression, no language and no translated keyword
+            QByteArray international = keyword;
+            international.append(QByteArray(5, '\0'));
+            international.append(value.toUtf8());
+            writeChunk("iTXt", international);
+        }
+    }
+}
+
+/**************************************************************************//**
+ * @brief Writes a chunk: its length, type, data and the CRC of type and data.
+ *
+ * @param[in] type - Four letter chunk type
+ * @param[in] data - Contents of the chunk
+ *****************************************************************************/
+void PngWriter::writeChunk(const char *type, const QByteArray &data)
+{
+    QByteArray chunk;
+    appendUint32(chunk, data.size());
+    chunk.append(type, 4);
+    chunk.append(data);
+
+    const Bytef *typeAndData = reinterpret_cast<const Bytef *>(chunk.constData()) + 4;
+    appendUint32(chunk, crc32(0, typeAndData, data.size() + 4));
+
+    if(file.write(chunk) != chunk.size())
+        fail(QString("cannot write %1").arg(file.fileName()));
+}
+
+/**************************************************************************//**
+ * @brief Keeps the first error; later ones are usually caused by it.
+ *****************************************************************************/
+void PngWriter::fail(const QString &message)
+{
+    if(error.isEmpty())
+        error = message;
+}
+
+/**************************************************************************//**
+ * @brief Writes an image that is in memory as a whole, a batch of rows at a
+ * time so the filtered copy stays small.  The alpha channel is only kept
+ * if a pixel isn't opaque.
+ *
+ * @param[in] fileName - The file to write
+ * @param[in] image - The image, in any format
+ * @param[out] error - Why the file couldn't be written, may be NULL
+ *
+ * @returns true if the file was replaced
+ *****************************************************************************/
+bool PngWriter::write(const QString &fileName, const QImage &image, QString *error)
+{
+    QImage source = Scanline::normalized(image);
+
+    bool alpha = false;
+    for(int y = 0; y < source.height() && !alpha; y++)
+    {
+        const QRgb *pixels = Scanline::constRow(source, y);
+        for(int x = 0; x < source.width(); x++)
+        {
+            if(qAlpha(pixels[x]) != 255)
+            {
+                alpha = true;
+                break;
+            }
+        }
+    }
+
+    PngWriter writer;
+    writer.setResolution(image.dotsPerMeterX(), image.dotsPerMeterY());
+    foreach(const QString &key, image.textKeys())
+        writer.setText(key, image.text(key));
+
+    bool written = writer.open(fileName, source.size(), alpha);
+
+    if(written)
+        written = writer.writeRows(source, 0, source.height());
+
+    if(!writer.close())
+        written = false;
+
+    if(!written && error)
+        *error = writer.errorString();
+    return written;
+}
+
+/**************************************************************************//**
+ * @brief Sets the level new writers start with.
+ *
+ * @param[in] level - 0 stores, 1 is the fastest and 9 the smallest
+ *****************************************************************************/
+void PngWriter::setDefaultLevel(int level)
+{
+    pngLevel.store(qBound(0, level, 9));
+}
+
+/**************************************************************************//**
+ * @brief Returns the level new writers start with.
+ *****************************************************************************/
+int PngWriter::defaultLevel()
+{
+    return pngLevel.load();
+}
@@ -0,0 +1,112 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the PngWriter class.
+ *****************************************************************************/
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QList>
+#include <QPair>
+#include <QSaveFile>
+#include <QString>
+#include <zlib.h>
+
+/**************************************************************************//**
+ * @brief Writes a PNG file a few rows at a time, so an image never has to be
+ * in memory as a whole to be saved, and compresses it on all cores.
+ *
+ * open() writes the header, writeRows() filters the rows it is given and
+ * close() ends the file.  Rows are 8 bit RGB, or RGBA if the image has an
+ * alpha channel.  Each row gets the filter libpng would pick for it, or
+ * simply Paeth at the fastest levels.
+ *
+ * The filtered rows are deflated the way pigz does it: they are collected
+ * into batches, each batch is cut into blocks on the BandScheduler threads,
+ * and each block is compressed as raw deflate on its own.  A block is
+ * primed with the last 32 KB before it as its dictionary, so it loses
+ * almost nothing against one long stream, and ends on a sync flush, so the
+ * blocks simply follow each other in the zlib stream.  The Adler-32 of the
+ * blocks is combined for the trailer.
+ *
+ * The file is written through a QSaveFile and only replaces the target
+ * when close() succeeds.  The resolution and text of the image are kept in
+ * pHYs and tEXt (iTXt if not Latin-1) chunks, like Qt's own writer does.
+ *****************************************************************************/
+class PngWriter
+{
+public:
+    PngWriter();
+
+    //Deflate level of the files opened after, 0 (fastest) to 9 (smallest)
+    void setLevel(int level);
+
+    //Metadata the next open() writes, as Qt's PNG writer does: the pixel
+    //size in dots per meter (0 for none) as pHYs, and text chunks
+    void setResolution(int dotsPerMeterX, int dotsPerMeterY);
+    void setText(const QString &key, const QString &value);
+
+    //Creates the file and writes the header
+    bool open(const QString &fileName, const QSize &size, bool alpha);
+
+    //Appends count rows of image starting at row first.  image is
+    //Format_ARGB32 and as wide as the file.  Any count is taken a batch at
+    //a time.
+    bool writeRows(const QImage &image, int first, int count);
+
+    //Writes the last chunks.  false if anything failed since open().
+    bool close();
+
+    QString errorString() const { return error; }
+
+    //Writes a whole image, RGB if all of it is opaque, with its resolution
+    //and text
+    static bool write(const QString &fileName, const QImage &image, QString *error = NULL);
+
+    //Level writers start with, from the settings
+    static void setDefaultLevel(int level);
+    static int defaultLevel();
+
+    //Memory a writer holds at most for an image of width pixels, on top of
+    //the rows it is given
+    static qint64 bufferBytes(int width);
+
+private:
+    void filterRows(const QImage &image, int first, int count);
+    void deflateBatch(bool last);
+    void writeIdat(bool last);
+    void writeChunk(const char *type, const QByteArray &data);
+    void writeMetadata();
+    void fail(const QString &message);
+
+    QSaveFile file;
+    bool isOpen;
+    int level;
+    QSize imageSize;
+    int channels;          //3 for RGB, 4 for RGBA
+    int rowsWritten;
+    QByteArray previous;   //Unfiltered bytes of the last row written
+    QByteArray pending;    //Filtered rows not compressed yet
+    QByteArray dictionary; //Last bytes before pending, at most 32 KB
+    QByteArray compressed; //zlib stream not written to an IDAT chunk yet
+    uLong adler;           //Adler-32 of all filtered bytes so far
+    QString error;
+    int dotsPerMeterX;
+    int dotsPerMeterY;
+    QList<QPair<QString, QString> > texts;  //Key, value
+
+    //Bytes of compressed data per IDAT chunk
+    static const int ChunkSize = 1 << 16;
+
+    //Filtered bytes compressed at once; larger batches keep more threads busy
+    static const int BatchSize = 1 << 23;
+
+    //Blocks are cut at multiples of this, BandScheduler makes them at least
+    //16 of these long
+    static const int BlockUnit = 1 << 14;
+};
+
+#endif // PNGWRITER_H
@@ -0,0 +1,138 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Renders the live previews of the effect dialogs away from the GUI
+ * thread, always working on the newest parameters only.
+ *****************************************************************************/
+
+#include "previewworker.h"
+#include "bandscheduler.h"
+#include <QMutexLocker>
+
+/**************************************************************************//**
+ * @brief Constructor.  Starts the thread, which sleeps until a request.
+ *
+ * @param[in] scratch - Pool the frames are written into, must outlive the
+ * worker
+ * @param[in] parent - Parent object
+ *****************************************************************************/
+PreviewWorker::PreviewWorker(ScratchPool *scratch, QObject *parent)
+    : QThread(parent), scratch(scratch)
+{
+    pending = false;
+    busy = false;
+    stopping = false;
+    pendingGeneration = 0;
+
+    start();
+}
+
+/**************************************************************************//**
+ * @brief Destructor.  Cancels the frame being rendered and waits for the
+ * thread to end.
+ *****************************************************************************/
+PreviewWorker::~PreviewWorker()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        pending = false;
+        cancelFlag.storeRelease(1);
+        wakeUp.wakeAll();
+    }
+
+    wait();
+}
+
+/**************************************************************************//**
+ * @brief Asks for a frame.  A request that has not started yet is replaced,
+ * and the frame being rendered is cancelled, since it is out of date.
+ *
+ * @param[in] source - Image to render from, shared not copied
+ * @param[in] render - Makes the frame, called on the worker thread
+ *****************************************************************************/
+void PreviewWorker::request(const QImage &source, const Render &render)
+{
+    QMutexLocker locker(&mutex);
+
+    pendingSource = source;
+    pendingRender = render;
+    pendingGeneration = latestGeneration.fetchAndAddOrdered(1) + 1;
+    pending = true;
+    cancelFlag.storeRelease(1);
+
+    wakeUp.wakeAll();
+}
+
+/**************************************************************************//**
+ * @brief Forgets the pending request and cancels the frame being rendered.
+ * A frame already posted is ignored by the receiver, since its generation is
+ * no longer the newest.
+ *****************************************************************************/
+void PreviewWorker::cancel()
+{
+    QMutexLocker locker(&mutex);
+
+    pending = false;
+    pendingSource = QImage();
+    pendingRender = Render();
+    latestGeneration.fetchAndAddOrdered(1);
+    cancelFlag.storeRelease(1);
+}
+
+/**************************************************************************//**
+ * @brief Waits until the worker has nothing left to do.  The newest frame,
+ * if any, has been posted by then; the caller still has to process the
+ * posted event to receive it.
+ *****************************************************************************/
+void PreviewWorker::finish()
+{
+    QMutexLocker locker(&mutex);
+
+    while(pending || busy)
+        idle.wait(&mutex);
+}
+
+/**************************************************************************//**
+ * @brief Thread loop.  Takes the newest request, renders it with the cancel
+ * flag in place and posts the frame unless a newer request came in.
+ *****************************************************************************/
+void PreviewWorker::run()
+{
+    BandScheduler::setCancelFlag(&cancelFlag);
+
+    QMutexLocker locker(&mutex);
+    while(!stopping)
+    {
+        if(!pending)
+        {
+            idle.wakeAll();
+            wakeUp.wait(&mutex);
+            continue;
+        }
+
+        QImage source = pendingSource;
+        Render render = pendingRender;
+        int frameGeneration = pendingGeneration;
+        pendingSource = QImage();
+        pendingRender = Render();
+        pending = false;
+        busy = true;
+        cancelFlag.storeRelease(0);
+
+        locker.unlock();
+        QImage frame = render(source, *scratch);
+        locker.relock();
+
+        busy = false;
+
+        //A cancelled frame may have bands that were never written
+        if(!frame.isNull() && 0 == cancelFlag.loadAcquire() && frameGeneration == generation())
+            emit frameReady(frame, frameGeneration);
+        else
+            scratch->recycle(frame);
+    }
+
+    BandScheduler::setCancelFlag(NULL);
+    idle.wakeAll();
+}
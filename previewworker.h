@@ -0,0 +1,76 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the PreviewWorker class.
+ *****************************************************************************/
+
+#ifndef PREVIEWWORKER_H
+#define PREVIEWWORKER_H
+
+#include <QThread>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <functional>
+#include "scratchpool.h"
+
+/**************************************************************************//**
+ * @brief Renders the live preview of a dialog on its own thread.
+ *
+ * A dialog asks for a new frame every time a value changes, far more often
+ * than a large image can be rendered.  Only the newest request is kept: a
+ * request replaces one that has not started yet, and cancels the one being
+ * rendered (see BandScheduler::setCancelFlag()).  Every request gets the next
+ * generation number, and a frame is only posted back (frameReady()) while it
+ * is still the newest, so the GUI thread never shows a stale frame and never
+ * waits for one.
+ *****************************************************************************/
+class PreviewWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<QImage (const QImage &source, ScratchPool &scratch)> Render;
+
+    explicit PreviewWorker(ScratchPool *scratch, QObject *parent = NULL);
+    ~PreviewWorker();
+
+    //Renders source with render, replacing whatever was asked for before
+    void request(const QImage &source, const Render &render);
+
+    //Drops the pending request and the one being rendered
+    void cancel();
+
+    //Blocks until the newest request has been rendered and posted
+    void finish();
+
+    //Generation of the newest request or cancel()
+    int generation() const { return latestGeneration.loadAcquire(); }
+
+signals:
+    void frameReady(const QImage &frame, int generation);
+
+protected:
+    void run();
+
+private:
+    ScratchPool *scratch;
+
+    QMutex mutex;
+    QWaitCondition wakeUp;    //A request came in or the thread should stop
+    QWaitCondition idle;      //Nothing pending and nothing being rendered
+
+    //Guarded by mutex
+    bool pending;
+    bool busy;
+    bool stopping;
+    QImage pendingSource;
+    Render pendingRender;
+    int pendingGeneration;
+
+    QAtomicInt latestGeneration;
+    QAtomicInt cancelFlag;    //Set to stop the frame being rendered
+};
+
+#endif // PREVIEWWORKER_H
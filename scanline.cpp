@@ -0,0 +1,85 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Out of line parts of the row-major pixel access layer.
+ *****************************************************************************/
+
+#include "scanline.h"
+
+Q_LOGGING_CATEGORY(effectTiming, "photoedit.effects", QtInfoMsg)
+
+/**************************************************************************//**
+ * @brief Converts an image to Format_ARGB32.  Effects call this once up front
+ * so their inner loops never have to deal with indexed or 16 bit formats.
+ *
+ * @param[in] image - Image in any format
+ *
+ * @returns The image in Format_ARGB32.  If it already was, no copy is made.
+ *****************************************************************************/
+QImage Scanline::normalized(const QImage &image)
+{
+    if(image.isNull() || image.format() == QImage::Format_ARGB32)
+        return image;
+
+    return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+/**************************************************************************//**
+ * @brief Converts an image to the format a document keeps it in between
+ * edits.  Format_Indexed8 images, like a palette posterize result, are kept
+ * as they are; anything else is normalized.
+ *
+ * @param[in] image - Image in any format
+ *
+ * @returns The image as it is committed
+ *****************************************************************************/
+QImage Scanline::stored(const QImage &image)
+{
+    if(image.format() == QImage::Format_Indexed8)
+        return image;
+
+    return normalized(image);
+}
+
+/**************************************************************************//**
+ * @brief Starts timing an effect.
+ *
+ * @param[in] name - Name printed in the log, e.g. "Image::sharpen"
+ * @param[in] size - Size of the image being processed
+ *****************************************************************************/
+EffectTimer::EffectTimer(const char *name, const QSize &size)
+{
+    effectName = name;
+    logged = size.height() > 1 && effectTiming().isDebugEnabled();
+    pixels = qint64(size.width()) * size.height();
+    busyAtStart = BandScheduler::busyNanoseconds();
+    timer.start();
+}
+
+/**************************************************************************//**
+ * @brief Logs the elapsed time, throughput and thread utilization of the
+ * effect.  Utilization is the time the bands took added up over all
+ * threads, divided by the wall clock time of all threads; it tells how well
+ * the bands kept the threads busy, not how much faster than one thread the
+ * effect ran.
+ *****************************************************************************/
+EffectTimer::~EffectTimer()
+{
+    //A cancelled preview skipped bands, its timing means nothing
+    if(!logged || BandScheduler::cancelled())
+        return;
+
+    //Avoid dividing by 0 on small images
+    qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+    qint64 busy = BandScheduler::busyNanoseconds() - busyAtStart;
+    int threads = BandScheduler::threadCount();
+    double megapixels = pixels / 1000000.0;
+
+    double milliseconds = elapsed / 1000000.0;
+    double throughput = megapixels * 1000.0 / milliseconds;
+    double utilization = 100.0 * busy / (double(elapsed) * threads);
+
+    qCDebug(effectTiming) << effectName << "->" << megapixels << "MP in" << milliseconds
+                          << "ms (" << throughput << "MP/s," << threads << "threads"
+                          << utilization << "% busy )";
+}
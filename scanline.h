@@ -0,0 +1,131 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Row-major pixel access shared by all of the Image effects.
+ *
+ * QImage stores its pixels row by row, so the effects walk y in the outer
+ * loop and x in the inner loop and read whole rows through constScanLine()
+ * and scanLine() instead of calling pixel()/setPixel() for every pixel.
+ * Images are normalized to Format_ARGB32 once, so every row can be treated
+ * as a plain array of QRgb values.
+ *****************************************************************************/
+
+#ifndef SCANLINE_H
+#define SCANLINE_H
+
+#include <QImage>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <QLoggingCategory>
+#include "bandscheduler.h"
+
+//Effect timings, off unless enabled with
+//QT_LOGGING_RULES="photoedit.effects.debug=true"
+Q_DECLARE_LOGGING_CATEGORY(effectTiming)
+
+namespace Scanline
+{
+    //Returns the image as Format_ARGB32 (shares the data if it already is)
+    QImage normalized(const QImage &image);
+
+    //Returns the image in the format it is kept in once committed: indexed
+    //images stay indexed, the rest is normalized
+    QImage stored(const QImage &image);
+
+    //Read only access to row y
+    inline const QRgb *constRow(const QImage &image, int y)
+    {
+        return reinterpret_cast<const QRgb *>(image.constScanLine(y));
+    }
+
+    //Writable access to row y (detaches the image if it is shared)
+    inline QRgb *row(QImage &image, int y)
+    {
+        return reinterpret_cast<QRgb *>(image.scanLine(y));
+    }
+
+    /**********************************************************************//**
+     * @brief Applies op to every pixel of source and stores the result in
+     * destination.  Both images must be Format_ARGB32 and the same size.
+     * The rows are split into bands that run in parallel, so op must be safe
+     * to call from several threads at once.
+     *
+     * @param[in] source - Image that is read from
+     * @param[out] destination - Image that is written to (may be source)
+     * @param[in] op - Callable taking a QRgb and returning a QRgb
+     *************************************************************************/
+    template <typename PixelOp>
+    void mapPixels(const QImage &source, QImage &destination, PixelOp op)
+    {
+        const int width = source.width();
+        const int inStride = source.bytesPerLine();
+
+        //Detach here, before any band runs, so the threads never do
+        uchar *outBits = destination.bits();
+        const int outStride = destination.bytesPerLine();
+        const uchar *inBits = source.constBits();
+
+        BandScheduler::run(source.height(), 0, [&](const Band &band) {
+            for(int y = band.first; y < band.last; y++)
+            {
+                const QRgb *in = reinterpret_cast<const QRgb *>(inBits + size_t(y) * inStride);
+                QRgb *out = reinterpret_cast<QRgb *>(outBits + size_t(y) * outStride);
+
+                for(int x = 0; x < width; x++)
+                    out[x] = op(in[x]);
+            }
+        });
+    }
+
+    /**********************************************************************//**
+     * @brief Like mapPixels(), but destination is a Format_Indexed8 image and
+     * op returns the colour table index of each pixel.
+     *
+     * @param[in] source - Format_ARGB32 image that is read from
+     * @param[out] destination - Format_Indexed8 image of the same size
+     * @param[in] op - Callable taking a QRgb and returning an index
+     *************************************************************************/
+    template <typename IndexOp>
+    void mapIndexes(const QImage &source, QImage &destination, IndexOp op)
+    {
+        const int width = source.width();
+        const int inStride = source.bytesPerLine();
+
+        uchar *outBits = destination.bits();
+        const int outStride = destination.bytesPerLine();
+        const uchar *inBits = source.constBits();
+
+        BandScheduler::run(source.height(), 0, [&](const Band &band) {
+            for(int y = band.first; y < band.last; y++)
+            {
+                const QRgb *in = reinterpret_cast<const QRgb *>(inBits + size_t(y) * inStride);
+                uchar *out = outBits + size_t(y) * outStride;
+
+                for(int x = 0; x < width; x++)
+                    out[x] = op(in[x]);
+            }
+        });
+    }
+}
+
+/**************************************************************************//**
+ * @brief Logs how long an effect took, its throughput in megapixels per
+ * second and how busy its threads were once it goes out of scope.  Only
+ * logged when the effectTiming category is enabled, and not for images a
+ * single row tall, like the lookup ramp of a pipeline.
+ *****************************************************************************/
+class EffectTimer
+{
+public:
+    EffectTimer(const char *name, const QSize &size);
+    ~EffectTimer();
+
+private:
+    const char *effectName;
+    bool logged;
+    qint64 pixels;
+    qint64 busyAtStart;  //BandScheduler::busyNanoseconds() when timing began
+    QElapsedTimer timer;
+};
+
+#endif // SCANLINE_H
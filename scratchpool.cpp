@@ -0,0 +1,125 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Recycles the full size images the effects write into.
+ *****************************************************************************/
+
+#include "scratchpool.h"
+#include <QMutexLocker>
+
+namespace
+{
+    //Bytes of pixel data in an image
+    qint64 imageBytes(const QImage &image)
+    {
+        return qint64(image.bytesPerLine()) * image.height();
+    }
+}
+
+/**************************************************************************//**
+ * @brief Constructor.  The pool starts out empty.
+ *****************************************************************************/
+ScratchPool::ScratchPool()
+{
+    idleBytes = 0;
+    handedOutBytes = 0;
+}
+
+/**************************************************************************//**
+ * @brief Returns an image to write into.  An idle image of the same size and
+ * format is reused if there is one, otherwise a new one is allocated.
+ *
+ * @param[in] size - Size of the image
+ * @param[in] format - Format of the image
+ *
+ * @returns The image.  The pool keeps no reference to it, so writing to it
+ * does not make a copy.
+ *****************************************************************************/
+QImage ScratchPool::acquire(const QSize &size, QImage::Format format)
+{
+    QMutexLocker locker(&mutex);
+
+    QImage image;
+    for(int i = 0; i < idle.size(); i++)
+    {
+        if(idle[i].size() == size && idle[i].format() == format)
+        {
+            image = idle.takeAt(i);
+            idleBytes -= imageBytes(image);
+            break;
+        }
+    }
+
+    if(image.isNull())
+        image = QImage(size, format);
+
+    //Images are told apart by their pixels, which writing to an unshared
+    //image leaves in place; cacheKey() changes on every detach().  An image
+    //that was let go of without recycle() may have left its address to
+    //this one.
+    if(!image.isNull())
+    {
+        const uchar *bits = image.constBits();
+        handedOutBytes -= handedOut.value(bits);
+        handedOut.insert(bits, imageBytes(image));
+        handedOutBytes += imageBytes(image);
+    }
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Gives an image back.  Images that did not come from acquire(), or
+ * that are still shared (e.g. committed or on the undo stack), are only let
+ * go of.
+ *
+ * @param[in,out] image - The image, set to null
+ *****************************************************************************/
+void ScratchPool::recycle(QImage &image)
+{
+    QMutexLocker locker(&mutex);
+
+    if(image.isNull())
+        return;
+
+    QHash<const uchar *, qint64>::iterator found = handedOut.find(image.constBits());
+    if(found == handedOut.end())
+    {
+        image = QImage();
+        return;
+    }
+
+    handedOutBytes -= found.value();
+    handedOut.erase(found);
+
+    if(image.isDetached() && idle.size() < MaximumIdle)
+    {
+        idle.append(image);
+        idleBytes += imageBytes(image);
+    }
+
+    image = QImage();
+}
+
+/**************************************************************************//**
+ * @brief Frees the idle images.  Images still handed out now belong to
+ * whoever holds them.
+ *****************************************************************************/
+void ScratchPool::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    idle.clear();
+    handedOut.clear();
+    idleBytes = 0;
+    handedOutBytes = 0;
+}
+
+/**************************************************************************//**
+ * @brief Returns how much memory the pool accounts for right now.
+ *****************************************************************************/
+qint64 ScratchPool::bytesInFlight() const
+{
+    QMutexLocker locker(&mutex);
+    return idleBytes + handedOutBytes;
+}
@@ -0,0 +1,52 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the ScratchPool class.
+ *****************************************************************************/
+
+#ifndef SCRATCHPOOL_H
+#define SCRATCHPOOL_H
+
+#include <QImage>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+/**************************************************************************//**
+ * @brief Full size images the effects write into, kept for reuse.
+ *
+ * Every tick of a live preview needs a new full size image.  Instead of
+ * allocating one per tick, the effect acquires one here, and the result it
+ * replaces is recycled once nothing else refers to it.  Each document has
+ * its own pool; commit() and revert() release everything it holds.
+ *****************************************************************************/
+class ScratchPool
+{
+public:
+    ScratchPool();
+
+    //An image of the given size and format, contents undefined
+    QImage acquire(const QSize &size, QImage::Format format);
+
+    //Takes image back if it came from acquire() and nothing else shares it.
+    //image is null afterwards either way.
+    void recycle(QImage &image);
+
+    //Frees the idle images and forgets the ones handed out
+    void clear();
+
+    //Bytes of the images that are idle or handed out and not yet returned
+    qint64 bytesInFlight() const;
+
+    //Idle images kept at most, the rest are freed
+    static const int MaximumIdle = 3;
+
+private:
+    mutable QMutex mutex;
+    QList<QImage> idle;
+    QHash<const uchar *, qint64> handedOut;  //constBits() -> bytes
+    qint64 idleBytes;
+    qint64 handedOutBytes;
+};
+
+#endif // SCRATCHPOOL_H
@@ -0,0 +1,145 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Streams images larger than memory from file to file in strips.
+ *****************************************************************************/
+
+#include "stripstream.h"
+#include "pngwriter.h"
+#include "scanline.h"
+#include <QFileInfo>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QPixelFormat>
+
+namespace
+{
+
+//Copies of a strip held at once: the decoded rows, their normalized copy,
+//and the input and result of the effect that is running
+const int StripsInFlight = 4;
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Returns whether every operation of the pipeline works on strips,
+ * the input can be read a strip at a time and the output is a PNG file, the
+ * format PngWriter streams.
+ *
+ * @param[in] pipeline - The operations
+ * @param[in] input - The file to read
+ * @param[in] output - The file to write
+ * @param[out] reason - Why the file can't be streamed
+ *****************************************************************************/
+bool StripStream::canStream(const Pipeline &pipeline, const QString &input,
+                            const QString &output, QString *reason)
+{
+    if(pipeline.halo() == Pipeline::WholeImage)
+    {
+        *reason = "the effects need the whole image at once";
+        return false;
+    }
+
+    if(0 != QFileInfo(output).suffix().compare("png", Qt::CaseInsensitive))
+    {
+        *reason = "only PNG results are written in strips";
+        return false;
+    }
+
+    QImageReader reader(input);
+    if(!reader.supportsOption(QImageIOHandler::ClipRect))
+    {
+        *reason = QString("%1 files can't be read in strips").arg(QString::fromLatin1(reader.format()));
+        return false;
+    }
+
+    return true;
+}
+
+/**************************************************************************//**
+ * @brief Reads, processes and writes the image a strip at a time.  Each
+ * strip is read with halo() extra rows on both sides, which are dropped
+ * after the effects ran, so the result is the same as processing the whole
+ * image at once.
+ *
+ * @param[in] input - The file to read
+ * @param[in] output - The PNG file to write
+ * @param[in] pipeline - Operations that passed canStream() with input
+ * @param[in] memoryBytes - Bytes the strips in flight and the writer may take
+ * @param[out] error - Why the file failed
+ *
+ * @returns true if the output was written
+ *****************************************************************************/
+bool StripStream::process(const QString &input, const QString &output, const Pipeline &pipeline,
+                          qint64 memoryBytes, QString *error)
+{
+    QImageReader probe(input);
+    const QSize size = probe.size();
+    if(!size.isValid())
+    {
+        *error = probe.errorString();
+        return false;
+    }
+
+    const bool alpha = QImage::toPixelFormat(probe.imageFormat()).alphaUsage() == QPixelFormat::UsesAlpha;
+    const int halo = pipeline.halo();
+
+    //The writer's buffers come out of the same budget as the strips
+    const qint64 stripBytes = memoryBytes - PngWriter::bufferBytes(size.width());
+    const qint64 rowBytes = qint64(size.width()) * 4 * StripsInFlight;
+    const int rows = int(qBound<qint64>(MinimumRows, stripBytes / rowBytes - 2 * halo, size.height()));
+
+    //The text is in the header, the resolution comes with the first strip
+    PngWriter writer;
+    foreach(const QString &key, probe.textKeys())
+        writer.setText(key, probe.text(key));
+
+    ScratchPool scratch;
+    for(int y = 0; y < size.height(); y += rows)
+    {
+        QRect strip(0, y, size.width(), qMin(rows, size.height() - y));
+        QRect read = strip.adjusted(0, -halo, 0, halo) & QRect(QPoint(0, 0), size);
+
+        QImageReader reader(input);
+        reader.setClipRect(read);
+        QImage source = Scanline::normalized(reader.read());
+        if(source.isNull())
+        {
+            *error = reader.errorString();
+            writer.close();
+            return false;
+        }
+
+        if(0 == y)
+        {
+            writer.setResolution(source.dotsPerMeterX(), source.dotsPerMeterY());
+            if(!writer.open(output, size, alpha))
+            {
+                *error = writer.errorString();
+                return false;
+            }
+        }
+
+        QImage result = Scanline::normalized(pipeline.apply(source, scratch));
+        source = QImage();
+        if(result.isNull())
+        {
+            *error = "an effect rejected its parameters";
+            writer.close();
+            return false;
+        }
+
+        bool written = writer.writeRows(result, strip.y() - read.y(), strip.height());
+        scratch.recycle(result);
+        if(!written)
+            break;
+    }
+
+    if(!writer.close())
+    {
+        *error = writer.errorString();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,42 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the StripStream class.
+ *****************************************************************************/
+
+#ifndef STRIPSTREAM_H
+#define STRIPSTREAM_H
+
+#include <QString>
+#include "pipeline.h"
+
+/**************************************************************************//**
+ * @brief Runs a pipeline from one file to another a strip of rows at a
+ * time, so an image larger than memory can be processed.
+ *
+ * Each strip is read with a QImageReader clip rect, together with the rows
+ * of halo the neighbourhood effects read above and below it (see
+ * Pipeline::halo()), run through the pipeline, and its own rows are appended
+ * to the output by PngWriter.  Only formats whose reader can clip are
+ * streamed; the others would have to be decoded in full, which is what a
+ * file too large for memory can't be.  Clipped reads of formats like JPEG
+ * decode the rows above the strip again for every strip, so strips are made
+ * as tall as the memory allows.
+ *****************************************************************************/
+class StripStream
+{
+public:
+    //Whether the pipeline can run strip by strip from input into output.
+    //If not, reason says why.
+    static bool canStream(const Pipeline &pipeline, const QString &input,
+                          const QString &output, QString *reason);
+
+    //Processes input into output in strips that take about memoryBytes
+    static bool process(const QString &input, const QString &output, const Pipeline &pipeline,
+                        qint64 memoryBytes, QString *error);
+
+    //Strips are never shorter than this, however wide the image
+    static const int MinimumRows = 16;
+};
+
+#endif // STRIPSTREAM_H
@@ -0,0 +1,172 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Stores an image as reference counted tiles, so versions of it share
+ * the tiles they have in common.
+ *****************************************************************************/
+
+#include "tiledimage.h"
+#include <string.h>
+
+/**************************************************************************//**
+ * @brief Constructor.  The image is null.
+ *****************************************************************************/
+TiledImage::TiledImage()
+{
+    imageFormat = QImage::Format_Invalid;
+    columns = 0;
+}
+
+/**************************************************************************//**
+ * @brief Constructor.  Splits image into tiles, which copies its pixels.
+ *
+ * @param[in] image - The image, any format
+ *****************************************************************************/
+TiledImage::TiledImage(const QImage &image)
+{
+    imageSize = image.size();
+    imageFormat = image.format();
+    colorTable = image.colorTable();
+    columns = (image.width() + TileSize - 1) / TileSize;
+
+    if(image.isNull())
+        return;
+
+    int rows = (image.height() + TileSize - 1) / TileSize;
+    tiles.resize(columns * rows);
+    for(int i = 0; i < tiles.size(); i++)
+        tiles[i] = image.copy(tileRect(i));
+}
+
+/**************************************************************************//**
+ * @brief Constructor.  Lays out the tiles of an image without any pixels;
+ * every tile has to be given with setTile() before the image is used.
+ *
+ * @param[in] size - Size of the image
+ * @param[in] format - Format of the tiles
+ * @param[in] colors - Colour table of Format_Indexed8 tiles
+ *****************************************************************************/
+TiledImage::TiledImage(const QSize &size, QImage::Format format, const QVector<QRgb> &colors)
+{
+    imageSize = size;
+    imageFormat = format;
+    colorTable = colors;
+    columns = (size.width() + TileSize - 1) / TileSize;
+
+    int rows = (size.height() + TileSize - 1) / TileSize;
+    tiles.resize(qMax(columns * rows, 0));
+}
+
+/**************************************************************************//**
+ * @brief Returns the whole image as a single QImage.  The tiles are copied
+ * into it one row at a time.
+ *****************************************************************************/
+QImage TiledImage::toImage() const
+{
+    if(isNull())
+        return QImage();
+
+    QImage image(imageSize, imageFormat);
+    if(imageFormat == QImage::Format_Indexed8)
+        image.setColorTable(colorTable);
+
+    const int bytesPerPixel = image.depth() / 8;
+    for(int i = 0; i < tiles.size(); i++)
+    {
+        QRect area = tileRect(i);
+        const int rowBytes = area.width() * bytesPerPixel;
+        for(int y = 0; y < area.height(); y++)
+        {
+            memcpy(image.scanLine(area.top() + y) + area.left() * bytesPerPixel,
+                   tiles[i].constScanLine(y), rowBytes);
+        }
+    }
+
+    return image;
+}
+
+/**************************************************************************//**
+ * @brief Replaces the tiles that area touches with the pixels of image.  The
+ * other tiles are kept, and stay shared with the copies of this image.  If
+ * image has another size or format, all of it is taken.
+ *
+ * @param[in] image - The new version of the image
+ * @param[in] area - Part of image that changed
+ *****************************************************************************/
+void TiledImage::update(const QImage &image, const QRect &area)
+{
+    if(image.size() != imageSize || image.format() != imageFormat ||
+       image.colorTable() != colorTable)
+    {
+        *this = TiledImage(image);
+        return;
+    }
+
+    QRect changed = area & rect();
+    if(changed.isEmpty())
+        return;
+
+    int firstColumn = changed.left() / TileSize;
+    int lastColumn = changed.right() / TileSize;
+    int firstRow = changed.top() / TileSize;
+    int lastRow = changed.bottom() / TileSize;
+
+    for(int row = firstRow; row <= lastRow; row++)
+    {
+        for(int column = firstColumn; column <= lastColumn; column++)
+        {
+            int index = row * columns + column;
+            tiles[index] = image.copy(tileRect(index));
+        }
+    }
+}
+
+/**************************************************************************//**
+ * @brief Returns the area of the image a tile covers.
+ *
+ * @param[in] index - Tile, row major
+ *****************************************************************************/
+QRect TiledImage::tileRect(int index) const
+{
+    QRect area((index % columns) * TileSize, (index / columns) * TileSize, TileSize, TileSize);
+    return area & rect();
+}
+
+/**************************************************************************//**
+ * @brief Returns whether both images hold the same tile at index, as opposed
+ * to two tiles that may only look alike.  Images of another size never do.
+ *
+ * @param[in] other - The other image
+ * @param[in] index - Tile, row major
+ *****************************************************************************/
+bool TiledImage::sharesTile(const TiledImage &other, int index) const
+{
+    if(!sameLayout(other))
+        return false;
+
+    return tiles[index].cacheKey() == other.tiles[index].cacheKey();
+}
+
+/**************************************************************************//**
+ * @brief Returns whether the tiles of both images line up: same size, format
+ * and colour table.
+ *
+ * @param[in] other - The other image
+ *****************************************************************************/
+bool TiledImage::sameLayout(const TiledImage &other) const
+{
+    return other.imageSize == imageSize && other.imageFormat == imageFormat &&
+           other.colorTable == colorTable;
+}
+
+/**************************************************************************//**
+ * @brief Returns the memory taken by the pixels of all tiles.
+ *****************************************************************************/
+qint64 TiledImage::byteCount() const
+{
+    qint64 bytes = 0;
+    for(int i = 0; i < tiles.size(); i++)
+        bytes += tiles[i].byteCount();
+
+    return bytes;
+}
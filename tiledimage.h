@@ -0,0 +1,70 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the TiledImage class.
+ *****************************************************************************/
+
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <QImage>
+#include <QVector>
+
+/**************************************************************************//**
+ * @brief An image stored as a grid of TileSize x TileSize tiles.
+ *
+ * Every tile is a QImage of its own, so copying a TiledImage only copies
+ * references and the copies share their pixels.  update() replaces just the
+ * tiles of the area that changed; the copies that still refer to the old
+ * tiles keep them.  Versions of a large document that differ by a small edit
+ * therefore only cost the tiles the edit touched.  Tiles on the right and
+ * bottom edges are smaller when the size is not a multiple of TileSize.
+ *****************************************************************************/
+class TiledImage
+{
+public:
+    TiledImage();
+    explicit TiledImage(const QImage &image);
+
+    //An image of the given size and format whose tiles are all null, to be
+    //filled in with setTile()
+    TiledImage(const QSize &size, QImage::Format format, const QVector<QRgb> &colors);
+
+    bool isNull() const { return tiles.isEmpty(); }
+    QSize size() const { return imageSize; }
+    QRect rect() const { return QRect(QPoint(0, 0), imageSize); }
+    QImage::Format format() const { return imageFormat; }
+    const QVector<QRgb> &colors() const { return colorTable; }
+
+    //The whole image in one QImage, a copy of the tiles
+    QImage toImage() const;
+
+    //Takes over the pixels of area from image.  Only the tiles area touches
+    //are replaced, unless image differs in size or format.
+    void update(const QImage &image, const QRect &area);
+
+    int tileCount() const { return tiles.size(); }
+    QRect tileRect(int index) const;
+    const QImage &tile(int index) const { return tiles[index]; }
+    void setTile(int index, const QImage &tile) { tiles[index] = tile; }
+
+    //Whether tile index is the very same tile (not only equal pixels)
+    bool sharesTile(const TiledImage &other, int index) const;
+
+    //Whether both have the same size and format, so their tiles line up
+    bool sameLayout(const TiledImage &other) const;
+
+    //Bytes of pixel data held by the tiles
+    qint64 byteCount() const;
+
+    static const int TileSize = 256;
+
+private:
+    QSize imageSize;
+    QImage::Format imageFormat;
+    QVector<QRgb> colorTable;  //Of Format_Indexed8 images
+    int columns;
+    QVector<QImage> tiles;     //Row major
+};
+
+#endif // TILEDIMAGE_H
@@ -0,0 +1,597 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Keeps the undo history of a document as a journal of operations,
+ * with a keyframe of the image every few of them.
+ *****************************************************************************/
+
+#include "undohistory.h"
+#include "scanline.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+#include <QDebug>
+
+/**************************************************************************//**
+ * @brief Keyframes the background thread has packed and the history has not
+ * picked up yet.  Shared with the tasks, so a history that goes away before
+ * they are done doesn't leave them writing into freed memory.
+ *****************************************************************************/
+struct PackedKeyframes
+{
+    QMutex mutex;
+    QHash<int, PackedImage> done;  //Entry id -> its packed keyframe
+};
+
+namespace
+{
+
+//512 MB unless set from the settings
+qint64 historyBudget = qint64(512) * 1024 * 1024;
+
+//1 GB unless set from the settings
+qint64 historySwapThreshold = qint64(1024) * 1024 * 1024;
+
+//Ids of the entries of all documents, in the order they were made
+int nextEntryId = 0;
+
+//Every history, so the oldest keyframes of all documents can be spilled
+QList<UndoHistory *> histories;
+
+//Packs one keyframe
+class PackTask : public QRunnable
+{
+public:
+    PackTask(const QSharedPointer<PackedKeyframes> &queue, int id, const TiledImage &keyframe)
+        : queue(queue), id(id), keyframe(keyframe) {}
+
+    void run()
+    {
+        PackedImage packed = PackedImage::pack(keyframe);
+
+        QMutexLocker locker(&queue->mutex);
+        queue->done.insert(id, packed);
+    }
+
+private:
+    QSharedPointer<PackedKeyframes> queue;
+    int id;
+    TiledImage keyframe;
+};
+
+QThreadPool *pool()
+{
+    static QThreadPool packPool;
+
+    //A single thread, so packing never takes more than a core from the effects
+    packPool.setMaxThreadCount(1);
+    return &packPool;
+}
+
+} // namespace
+
+/**************************************************************************//**
+ * @brief Constructor.  The history is empty.
+ *****************************************************************************/
+UndoHistory::UndoHistory()
+    : packedKeyframes(new PackedKeyframes)
+{
+    position = -1;
+    replayCount = 0;
+    replayTime = 0;
+    unpackedId = -1;
+    unpackTime = 0;
+    unpackTotal = 0;
+    unpackCount = 0;
+
+    histories.append(this);
+}
+
+/**************************************************************************//**
+ * @brief Destructor.  Keyframes still being packed are dropped when done.
+ *****************************************************************************/
+UndoHistory::~UndoHistory()
+{
+    histories.removeAll(this);
+}
+
+/**************************************************************************//**
+ * @brief Forgets every entry and makes state the current state, kept as the
+ * first keyframe.
+ *
+ * @param[in] state - The committed image
+ * @param[in] name - What made the state, shown in the journal
+ *****************************************************************************/
+void UndoHistory::reset(const TiledImage &state, const QString &name)
+{
+    Entry entry = newEntry(name.isEmpty() ? QString("snapshot") : name);
+    entry.keyframe = state;
+
+    entries.clear();
+    entries.push_back(entry);
+    position = 0;
+    latest = state;
+    unpacked = TiledImage();
+    unpackedId = -1;
+}
+
+/**************************************************************************//**
+ * @brief Records a commit.  The state is kept as a keyframe if the operation
+ * can't be replayed or KeyframeInterval operations went by since the last
+ * one.  Anything that could be redone is forgotten.
+ *
+ * @param[in] state - The newly committed image
+ * @param[in] operation - What led to state from the previous state
+ *****************************************************************************/
+void UndoHistory::commit(const TiledImage &state, const Operation &operation)
+{
+    if(position < 0)
+    {
+        reset(state, operation.name);
+        return;
+    }
+
+    //Nothing changed, e.g. a dialog accepted with its first values
+    bool unchanged = state.sameLayout(latest);
+    for(int i = 0; unchanged && i < state.tileCount(); i++)
+        unchanged = state.sharesTile(latest, i);
+    if(unchanged)
+        return;
+
+    collectPacked();
+    entries.erase(entries.begin() + position + 1, entries.end());
+
+    int sinceKeyframe = 0;
+    while(!entries[position - sinceKeyframe].isKeyframe())
+        sinceKeyframe++;
+
+    Entry entry = newEntry(operation.name);
+    entry.replay = operation.replay;
+    if(!entry.replay || sinceKeyframe + 1 >= KeyframeInterval)
+        entry.keyframe = state;
+
+    entries.push_back(entry);
+    position++;
+    latest = state;
+
+    //The next undo starts from the new state, not the unpacked keyframe
+    unpacked = TiledImage();
+    unpackedId = -1;
+
+    trim();
+    packOlderKeyframes();
+    spillOldest();
+}
+
+/**************************************************************************//**
+ * @brief Goes back one entry.
+ *
+ * @returns The previous state, or the current one if there is nothing to
+ * undo.
+ *****************************************************************************/
+TiledImage UndoHistory::undo()
+{
+    if(!canUndo())
+        return latest;
+
+    collectPacked();
+    latest = rebuild(position - 1);
+    position--;
+    return latest;
+}
+
+/**************************************************************************//**
+ * @brief Goes forward one entry that was undone.
+ *
+ * @returns The next state, or the current one if there is nothing to redo.
+ *****************************************************************************/
+TiledImage UndoHistory::redo()
+{
+    if(!canRedo())
+        return latest;
+
+    collectPacked();
+    latest = rebuild(position + 1);
+    position++;
+    return latest;
+}
+
+/**************************************************************************//**
+ * @brief Returns the journal for display, one line per entry, oldest first.
+ * The current entry is marked with a '>' and keyframes with "[keyframe]".
+ *****************************************************************************/
+QStringList UndoHistory::journal() const
+{
+    QStringList lines;
+    for(int i = 0; i < int(entries.size()); i++)
+    {
+        QString line = QString("%1 %2. %3").arg(i == position ? ">" : " ").arg(i + 1).arg(entries[i].name);
+        if(entries[i].packed.isSpilled())
+            line += "  [keyframe, swapped]";
+        else if(!entries[i].packed.isNull())
+            line += "  [keyframe, packed]";
+        else if(!entries[i].keyframe.isNull())
+            line += "  [keyframe]";
+
+        lines.append(line);
+    }
+
+    return lines;
+}
+
+/**************************************************************************//**
+ * @brief Returns the memory taken by the keyframes, packed or not, and by the
+ * last keyframe unpacked.  Keyframes share the tiles an operation did not
+ * touch, so each tile is counted once.  Keyframes in the swap file don't
+ * count.
+ *****************************************************************************/
+qint64 UndoHistory::byteCount() const
+{
+    QSet<qint64> counted;
+    qint64 bytes = packedBytes() - swappedBytes();
+
+    for(size_t i = 0; i <= entries.size(); i++)
+    {
+        const TiledImage &keyframe = i < entries.size() ? entries[i].keyframe : unpacked;
+        for(int tile = 0; tile < keyframe.tileCount(); tile++)
+        {
+            qint64 key = keyframe.tile(tile).cacheKey();
+            if(counted.contains(key))
+                continue;
+
+            counted.insert(key);
+            bytes += keyframe.tile(tile).byteCount();
+        }
+    }
+
+    return bytes;
+}
+
+/**************************************************************************//**
+ * @brief Returns the size of the packed keyframes, in memory or spilled.
+ *****************************************************************************/
+qint64 UndoHistory::packedBytes() const
+{
+    return countPacked(false);
+}
+
+/**************************************************************************//**
+ * @brief Returns the size of the packed keyframes spilled to the swap file.
+ *****************************************************************************/
+qint64 UndoHistory::swappedBytes() const
+{
+    return countPacked(true);
+}
+
+/**************************************************************************//**
+ * @brief Adds up the packed keyframes.  Packed tiles the keyframes share are
+ * counted once.
+ *
+ * @param[in] spilledOnly - Only count the keyframes in the swap file
+ *****************************************************************************/
+qint64 UndoHistory::countPacked(bool spilledOnly) const
+{
+    QSet<quintptr> counted;
+    qint64 bytes = 0;
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        const PackedImage &packed = entries[i].packed;
+        if(spilledOnly && !packed.isSpilled())
+            continue;
+
+        for(int tile = 0; tile < packed.tileCount(); tile++)
+        {
+            quintptr key = quintptr(packed.tile(tile).constData());
+            if(counted.contains(key))
+                continue;
+
+            counted.insert(key);
+            bytes += packed.tile(tile).size();
+        }
+    }
+
+    return bytes;
+}
+
+/**************************************************************************//**
+ * @brief Returns the memory the packed keyframes would take unpacked, which
+ * over packedBytes() is the compression ratio.
+ *****************************************************************************/
+qint64 UndoHistory::packedRawBytes() const
+{
+    QSet<qint64> counted;
+    qint64 bytes = 0;
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        const PackedImage &packed = entries[i].packed;
+        for(int tile = 0; tile < packed.tileCount(); tile++)
+        {
+            if(counted.contains(packed.tileKey(tile)))
+                continue;
+
+            counted.insert(packed.tileKey(tile));
+            bytes += packed.tileRawBytes(tile);
+        }
+    }
+
+    return bytes;
+}
+
+/**************************************************************************//**
+ * @brief Returns the average time an unpack of a keyframe took, in ms.
+ *****************************************************************************/
+qint64 UndoHistory::averageUnpackTime() const
+{
+    if(0 == unpackCount)
+        return 0;
+
+    return unpackTotal / unpackCount;
+}
+
+/**************************************************************************//**
+ * @brief Sets the budget of the keyframes.  It is applied to each document
+ * the next time it commits.
+ *
+ * @param[in] bytes - Budget in bytes
+ *****************************************************************************/
+void UndoHistory::setBudget(qint64 bytes)
+{
+    historyBudget = qMax<qint64>(bytes, 0);
+}
+
+/**************************************************************************//**
+ * @brief Returns the budget of the keyframes of a document, in bytes.
+ *****************************************************************************/
+qint64 UndoHistory::budget()
+{
+    return historyBudget;
+}
+
+/**************************************************************************//**
+ * @brief Sets how much memory the histories of all documents may take
+ * together before their oldest packed keyframes go to the swap file.
+ *
+ * @param[in] bytes - Threshold in bytes
+ *****************************************************************************/
+void UndoHistory::setSwapThreshold(qint64 bytes)
+{
+    historySwapThreshold = qMax<qint64>(bytes, 0);
+}
+
+/**************************************************************************//**
+ * @brief Returns the memory the histories of all documents may take before
+ * they spill to the swap file, in bytes.
+ *****************************************************************************/
+qint64 UndoHistory::swapThreshold()
+{
+    return historySwapThreshold;
+}
+
+/**************************************************************************//**
+ * @brief Moves the oldest packed keyframes of all documents to the swap file
+ * (see HistorySwap) until the histories fit the swap threshold in memory.
+ * Keyframes that are not packed yet stay; they are spilled by a later
+ * commit, once the background thread is done with them.
+ *****************************************************************************/
+void UndoHistory::spillOldest()
+{
+    qint64 total = 0;
+    for(int i = 0; i < histories.size(); i++)
+        total += histories[i]->byteCount();
+
+    while(total > historySwapThreshold)
+    {
+        UndoHistory *owner = NULL;
+        int oldest = -1;
+        for(int i = 0; i < histories.size(); i++)
+        {
+            const std::deque<Entry> &list = histories[i]->entries;
+            for(int j = 0; j < int(list.size()); j++)
+            {
+                if(list[j].packed.isNull() || list[j].packed.isSpilled())
+                    continue;
+
+                if(NULL == owner || list[j].id < owner->entries[oldest].id)
+                {
+                    owner = histories[i];
+                    oldest = j;
+                }
+                break;
+            }
+        }
+
+        if(NULL == owner)
+            break;
+
+        qint64 before = owner->byteCount();
+        if(!owner->entries[oldest].packed.spill())
+            break;
+
+        total -= before - owner->byteCount();
+        qDebug() << "UndoHistory::spillOldest -> over the swap threshold, keyframe moved to the swap file";
+    }
+}
+
+/**************************************************************************//**
+ * @brief Returns an entry with a new id and nothing else set.
+ *
+ * @param[in] name - The operation, shown in the journal
+ *****************************************************************************/
+UndoHistory::Entry UndoHistory::newEntry(const QString &name)
+{
+    Entry entry;
+    entry.id = nextEntryId++;
+    entry.name = name;
+    entry.packing = false;
+
+    return entry;
+}
+
+/**************************************************************************//**
+ * @brief Makes the state of an entry by replaying the operations since the
+ * nearest keyframe at or before it.  Going forward from the current state
+ * only replays the operations in between.
+ *
+ * @param[in] index - Entry to rebuild
+ *
+ * @returns The state of the entry
+ *****************************************************************************/
+TiledImage UndoHistory::rebuild(int index)
+{
+    int start = index;
+    while(!entries[start].isKeyframe())
+        start--;
+
+    TiledImage state;
+    if(position >= start && position <= index)
+    {
+        start = position;
+        state = latest;
+    }
+    else
+    {
+        state = keyframeOf(entries[start]);
+    }
+
+    replayCount = index - start;
+    replayTime = 0;
+    if(0 == replayCount)
+        return state;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QImage image = state.toImage();
+    for(int i = start + 1; i <= index; i++)
+    {
+        QImage next = entries[i].replay(image);
+        if(!next.isNull())
+            image = Scanline::stored(next);
+    }
+
+    replayTime = timer.elapsed();
+    qDebug() << "UndoHistory::rebuild ->" << replayCount << "operations replayed in"
+             << replayTime << "ms";
+
+    return TiledImage(image);
+}
+
+/**************************************************************************//**
+ * @brief Returns the keyframe of an entry, unpacking it if it was packed.
+ * The last keyframe unpacked is kept, since undoing through the entries
+ * after it starts from it each time.
+ *
+ * @param[in] entry - A keyframe entry
+ *****************************************************************************/
+TiledImage UndoHistory::keyframeOf(const Entry &entry)
+{
+    if(!entry.keyframe.isNull())
+        return entry.keyframe;
+
+    if(entry.id == unpackedId)
+        return unpacked;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    unpacked = entry.packed.unpack();
+    unpackedId = entry.id;
+
+    unpackTime = timer.elapsed();
+    unpackTotal += unpackTime;
+    unpackCount++;
+    qDebug() << "UndoHistory::keyframeOf -> keyframe unpacked in" << unpackTime << "ms";
+
+    return unpacked;
+}
+
+/**************************************************************************//**
+ * @brief Hands the keyframes before the newest one to the background thread
+ * to be packed.  The newest keyframe is what undo starts from most of the
+ * time, so it is left as it is.
+ *****************************************************************************/
+void UndoHistory::packOlderKeyframes()
+{
+    int newest = int(entries.size()) - 1;
+    while(newest > 0 && !entries[newest].isKeyframe())
+        newest--;
+
+    for(int i = 0; i < newest; i++)
+    {
+        Entry &entry = entries[i];
+        if(entry.keyframe.isNull() || entry.packing)
+            continue;
+
+        entry.packing = true;
+        pool()->start(new PackTask(packedKeyframes, entry.id, entry.keyframe));
+    }
+}
+
+/**************************************************************************//**
+ * @brief Swaps the keyframes the background thread has packed for their
+ * packed versions, which frees the tiles no other keyframe shares.  Packed
+ * tiles an older packed keyframe holds too are shared with it.  Keyframes of
+ * entries that were forgotten in the meantime are dropped.
+ *****************************************************************************/
+void UndoHistory::collectPacked()
+{
+    QHash<int, PackedImage> done;
+    {
+        QMutexLocker locker(&packedKeyframes->mutex);
+        done.swap(packedKeyframes->done);
+    }
+
+    if(done.isEmpty())
+        return;
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        Entry &entry = entries[i];
+        if(!done.contains(entry.id))
+            continue;
+
+        PackedImage packed = done.value(entry.id);
+        for(size_t j = 0; j < entries.size(); j++)
+        {
+            if(!entries[j].packed.isNull())
+                packed.shareTiles(entries[j].packed);
+        }
+
+        entry.packed = packed;
+        entry.keyframe = TiledImage();
+        entry.packing = false;
+    }
+
+    qDebug() << "UndoHistory::collectPacked ->" << packedRawBytes() / 1048576.0 << "MB of keyframes packed into"
+             << packedBytes() / 1048576.0 << "MB";
+}
+
+/**************************************************************************//**
+ * @brief Forgets the oldest entries until the keyframes fit the budget.
+ * Entries go up to the next keyframe at a time, so the first entry is always
+ * a keyframe, and the keyframe the current state is rebuilt from is kept
+ * even if it is larger than the budget on its own.
+ *****************************************************************************/
+void UndoHistory::trim()
+{
+    while(byteCount() > historyBudget)
+    {
+        int next = 1;
+        while(next < int(entries.size()) && !entries[next].isKeyframe())
+            next++;
+
+        if(next > position)
+            break;
+
+        entries.erase(entries.begin(), entries.begin() + next);
+        position -= next;
+        qDebug() << "UndoHistory::trim -> over budget, forgetting the oldest entries";
+    }
+}
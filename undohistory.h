@@ -0,0 +1,145 @@
+/**************************************************************************//**
+ * @file
+ *
+ * @brief Header for the UndoHistory class.
+ *****************************************************************************/
+
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <QSharedPointer>
+#include <deque>
+#include <functional>
+#include "tiledimage.h"
+#include "packedimage.h"
+
+struct PackedKeyframes;
+
+/**************************************************************************//**
+ * @brief The undo and redo history of a document, kept as a journal of the
+ * operations that were committed.
+ *
+ * Each entry holds the name of an operation with its parameters, e.g.
+ * "gamma(1.8)", and a function that redoes it on the state before it.  Every
+ * KeyframeInterval operations, and for any operation that can't be replayed
+ * (opening a file, say), the entry also keeps the state itself as a keyframe.
+ * Going to an entry starts from the nearest keyframe at or before it and
+ * replays the operations in between, so a step of history costs a few bytes
+ * of parameters instead of the pixels it changed.  Keyframes are TiledImage
+ * copies and share the tiles they have in common.  When the keyframes take
+ * more than budget() bytes, the oldest entries up to the next keyframe are
+ * forgotten.
+ *
+ * Keyframes older than the newest one are rarely gone back to, so they are
+ * packed (see PackedImage) on a background thread and unpacked when an undo
+ * or redo needs them.  The packed keyframes are picked up by the next
+ * commit, undo or redo.  Once the histories of all documents together take
+ * more than swapThreshold() bytes, the oldest packed keyframes are moved to
+ * the swap file (see HistorySwap), so a long session is bounded by the disk
+ * rather than by memory.
+ *****************************************************************************/
+class UndoHistory
+{
+public:
+    //Redoes an operation on the state before it, which is Format_ARGB32 or
+    //Format_Indexed8.  A null result leaves the state as it is.
+    typedef std::function<QImage (const QImage &state)> Replay;
+
+    //A committed operation.  Without a replay the state is kept as a keyframe.
+    struct Operation
+    {
+        QString name;
+        Replay replay;
+    };
+
+    UndoHistory();
+    ~UndoHistory();
+
+    //Starts over from state, e.g. after a load
+    void reset(const TiledImage &state, const QString &name = QString());
+
+    //Records operation, which led to state
+    void commit(const TiledImage &state, const Operation &operation);
+
+    bool canUndo() const { return position > 0; }
+    bool canRedo() const { return position + 1 < int(entries.size()); }
+
+    //The state to go back (or forward) to, which becomes the current state
+    TiledImage undo();
+    TiledImage redo();
+
+    int undoCount() const { return qMax(position, 0); }
+
+    //One line per entry, oldest first, with the keyframes and the current
+    //entry marked
+    QStringList journal() const;
+
+    //Operations replayed by the last undo or redo, and how long it took
+    int lastReplayCount() const { return replayCount; }
+    qint64 lastReplayTime() const { return replayTime; }
+
+    //Bytes of the keyframe tiles in memory, each shared tile counted once
+    qint64 byteCount() const;
+
+    //Bytes of the packed keyframes, and of the pixels they hold
+    qint64 packedBytes() const;
+    qint64 packedRawBytes() const;
+
+    //Bytes of the packed keyframes in the swap file
+    qint64 swappedBytes() const;
+
+    //How long the last unpack of a keyframe took, and all of them on average
+    qint64 lastUnpackTime() const { return unpackTime; }
+    qint64 averageUnpackTime() const;
+
+    //Bytes the keyframes of every document may take
+    static void setBudget(qint64 bytes);
+    static qint64 budget();
+
+    //Bytes the histories of all documents may keep in memory together
+    static void setSwapThreshold(qint64 bytes);
+    static qint64 swapThreshold();
+
+    //Operations between two keyframes at most
+    static const int KeyframeInterval = 8;
+
+private:
+    struct Entry
+    {
+        int id;
+        QString name;
+        Replay replay;
+        TiledImage keyframe;  //Null unless the entry is an unpacked keyframe
+        PackedImage packed;   //Null unless the entry is a packed keyframe
+        bool packing;         //Handed to the background thread
+
+        bool isKeyframe() const { return !keyframe.isNull() || !packed.isNull(); }
+    };
+
+    Entry newEntry(const QString &name);
+    TiledImage rebuild(int index);
+    TiledImage keyframeOf(const Entry &entry);
+    void packOlderKeyframes();
+    void collectPacked();
+    void trim();
+    qint64 countPacked(bool spilledOnly) const;
+    static void spillOldest();
+
+    std::deque<Entry> entries;  //Oldest first
+    int position;               //Entry of the current state, -1 if none
+    TiledImage latest;          //Shares its tiles with the committed image
+    int replayCount;
+    qint64 replayTime;
+
+    QSharedPointer<PackedKeyframes> packedKeyframes;
+    TiledImage unpacked;  //Last keyframe unpacked, kept for the next undo
+    int unpackedId;
+    qint64 unpackTime;
+    qint64 unpackTotal;
+    int unpackCount;
+};
+
+#endif // UNDOHISTORY_H